@@ -0,0 +1,352 @@
+/**
+ * macropad_bench - Benchmarks for the MacroPad core
+ *
+ * Runs without a display, Bluetooth or QML. Every result is printed as
+ * one JSON object per line on stdout, so runs can be diffed or plotted:
+ *
+ *   {"benchmark":"config_load_json","macros":1000,"value":4.2,"unit":"ms"}
+ *
+ * Pass benchmark names as arguments to run only those.
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <poll.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+
+#include "configcache.h"
+#include "hidreport.h"
+#include "hidwriter.h"
+#include "keyboardlayout.h"
+#include "latencyhistogram.h"
+#include "loopbacktransport.h"
+#include "macrocompiler.h"
+#include "macroconfig.h"
+#include "macroprogram.h"
+#include "spscring.h"
+
+// Keeps the optimizer from dropping work whose result is otherwise unused
+static volatile uint64_t g_sink = 0;
+
+static const int Repetitions = 5;
+
+static void printResult(const QString &benchmark, const QJsonObject &params, double value, const QString &unit)
+{
+    QJsonObject result = params;
+    result["benchmark"] = benchmark;
+    result["value"] = value;
+    result["unit"] = unit;
+    
+    fputs(QJsonDocument(result).toJson(QJsonDocument::Compact).constData(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+/**
+ * Fastest of several runs, in nanoseconds; the minimum is the least
+ * disturbed by scheduling noise. setup runs untimed before each run.
+ */
+static int64_t bestOf(int runs, const std::function<void()> &body,
+                      const std::function<void()> &setup = nullptr)
+{
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < runs; ++i) {
+        if (setup) {
+            setup();
+        }
+        const int64_t start = monotonicNowNs();
+        body();
+        best = qMin(best, monotonicNowNs() - start);
+    }
+    return best;
+}
+
+static QString sampleText(int length)
+{
+    static const QString alphabet = QStringLiteral(
+        "The quick brown fox jumps over the lazy dog. 0123456789 !@#$%^&*() <>?\n");
+    
+    QString text;
+    text.reserve(length);
+    while (text.size() < length) {
+        text.append(alphabet.left(length - text.size()));
+    }
+    return text;
+}
+
+static QVariantList sampleSequence(int steps)
+{
+    QVariantList sequence;
+    for (int i = 0; i < steps; ++i) {
+        switch (i % 4) {
+        case 0:
+            sequence.append(MacroConfig::createKeyAction(0x04 + i % 26));
+            break;
+        case 1:
+            sequence.append(MacroConfig::createComboAction({ 0x06 }, 0x01));
+            break;
+        case 2:
+            sequence.append(MacroConfig::createTextAction(QStringLiteral("hello world")));
+            break;
+        default:
+            sequence.append(MacroConfig::createDelayAction(10));
+            break;
+        }
+    }
+    return sequence;
+}
+
+static void benchCharToKeyCode()
+{
+    const QString text = sampleText(65536);
+    const int rounds = 32;
+    const KeyboardLayout &layout = KeyboardLayout::current();
+    
+    const int64_t elapsed = bestOf(Repetitions, [&]() {
+        uint64_t sum = 0;
+        for (int round = 0; round < rounds; ++round) {
+            for (QChar c : text) {
+                const KeyboardLayout::KeyStroke stroke = layout.keyStroke(c);
+                sum += stroke.keyCode + stroke.modifiers;
+            }
+        }
+        g_sink += sum;
+    });
+    
+    printResult("char_to_keycode", {}, double(elapsed) / (double(rounds) * text.size()), "ns/char");
+}
+
+static void benchTextEncoding()
+{
+    const QString text = sampleText(10000);
+    
+    for (bool packed : { false, true }) {
+        int reports = 0;
+        const int64_t elapsed = bestOf(Repetitions, [&]() {
+            MacroCompiler compiler(0);
+            compiler.addText(text, packed);
+            reports = compiler.finish().size();
+        });
+        
+        const QJsonObject params {
+            { "packed", packed },
+            { "chars", text.size() },
+            { "reports", reports }
+        };
+        printResult("text_encoding", params, text.size() * 1e3 / double(elapsed), "Mchars/s");
+    }
+}
+
+static void benchMacroStep()
+{
+    const int steps = 1000;
+    const QVariantList sequence = sampleSequence(steps);
+    
+    // Compiling a sequence: what loading a config or editing a macro costs
+    MacroProgram program;
+    const int64_t compileNs = bestOf(Repetitions, [&]() {
+        program = MacroCompiler::compile(sequence);
+    });
+    printResult("macro_step_compile", { { "steps", steps } }, double(compileNs) / steps, "ns/step");
+    
+    // Expanding a compiled program into timed reports on a ring, the same
+    // walk BluetoothHID::runProgram does on every button press
+    static SpscRing<HidReport, 4096> ring;
+    const int64_t expandNs = bestOf(Repetitions, [&]() {
+        int64_t deadline = monotonicNowNs();
+        for (const MacroInstruction &instruction : program) {
+            deadline += static_cast<int64_t>(instruction.delayUs) * 1000;
+            if (instruction.opcode == MacroInstruction::OpDelay) {
+                continue;
+            }
+            
+            HidReport report;
+            report.deadlineNs = deadline;
+            report.flags = HidReport::NoFlags;
+            report.voice = 0;
+            memcpy(report.data, instruction.report, HID_REPORT_SIZE);
+            if (!ring.push(report)) {
+                // Stand-in consumer: drain in bulk so the ring never blocks
+                while (ring.front()) {
+                    ring.pop();
+                }
+                ring.push(report);
+            }
+        }
+        while (const HidReport *front = ring.front()) {
+            g_sink += front->data[4];
+            ring.pop();
+        }
+    });
+    
+    const QJsonObject params {
+        { "steps", steps },
+        { "instructions", program.size() }
+    };
+    printResult("macro_step_expand", params, double(expandNs) / program.size(), "ns/instruction");
+}
+
+static void benchConfig()
+{
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return;
+    }
+    
+    for (int macros : { 10, 100, 1000, 10000 }) {
+        const QString path = dir.filePath(QString("macros-%1.json").arg(macros));
+        const QVariantList sequence = sampleSequence(8);
+        
+        MacroConfig source;
+        for (int i = 0; i < macros; ++i) {
+            QVariantMap macro;
+            macro["id"] = QString("macro_%1").arg(i);
+            macro["name"] = QString("Macro %1").arg(i);
+            macro["icon"] = "⌨️";
+            macro["color"] = "#2196F3";
+            macro["sequence"] = sequence;
+            source.addMacro(macro);
+        }
+        
+        const QJsonObject params { { "macros", macros } };
+        
+        const int64_t saveNs = bestOf(Repetitions, [&]() {
+            source.saveConfig(path);
+        });
+        printResult("config_save", params, saveNs / 1e6, "ms");
+        
+        // Saving writes the compiled cache too, so a plain load would only
+        // ever hit it; parse the JSON with the cache removed first
+        std::unique_ptr<MacroConfig> fresh;
+        const int64_t loadJsonNs = bestOf(Repetitions, [&]() {
+            fresh->loadConfig(path);
+        }, [&]() {
+            // Waits for the cache the previous load writes in the background
+            fresh.reset();
+            QFile::remove(ConfigCache::cachePath(path));
+            fresh.reset(new MacroConfig());
+        });
+        fresh.reset();
+        printResult("config_load_json", params, loadJsonNs / 1e6, "ms");
+        
+        const int64_t loadCacheNs = bestOf(Repetitions, [&]() {
+            MacroConfig config;
+            config.loadConfig(path);
+        });
+        printResult("config_load_cache", params, loadCacheNs / 1e6, "ms");
+        
+        // Button presses look macros up by ID; spread lookups over the list
+        const int lookups = 1000;
+        const int64_t lookupNs = bestOf(Repetitions, [&]() {
+            for (int i = 0; i < lookups; ++i) {
+                const int index = static_cast<int>((uint64_t(i) * 7919) % macros);
+                g_sink += source.getMacroProgram(QString("macro_%1").arg(index)).size();
+            }
+        });
+        printResult("config_lookup", params, double(lookupNs) / lookups, "ns/lookup");
+    }
+}
+
+static void benchLoopbackEmission()
+{
+    const int reports = 20000;
+    
+    LoopbackTransport *transport = new LoopbackTransport();
+    if (!transport->isValid()) {
+        delete transport;
+        return;
+    }
+    const int hostFd = transport->hostFd();
+    
+    HidWriter writer;
+    writer.setReportInterval(0, 0, 30000);
+    writer.setTransport(transport);
+    writer.start(QThread::HighPriority);
+    
+    // Let the writer adopt the transport before timing starts
+    QThread::msleep(50);
+    
+    QList<int64_t> deadlines;
+    deadlines.reserve(reports);
+    QList<LoopbackRecord> records;
+    records.reserve(reports);
+    
+    LatencyHistogram lateness;
+    LatencyHistogram delivery;
+    
+    const int64_t start = monotonicNowNs();
+    int64_t lastActivity = start;
+    
+    while (records.size() < reports) {
+        while (deadlines.size() < reports) {
+            const int64_t now = monotonicNowNs();
+            const HidReport report = makeKeyboardReport(0, deadlines.size() % 2 ? 0x00 : 0x04, now);
+            if (!writer.enqueue(report)) {
+                break;
+            }
+            deadlines.append(now);
+        }
+        
+        struct pollfd pfd = { hostFd, POLLIN, 0 };
+        ::poll(&pfd, 1, 100);
+        
+        const int first = records.size();
+        if (transport->readRecords(records) > 0) {
+            const int64_t now = monotonicNowNs();
+            for (int i = first; i < records.size(); ++i) {
+                lateness.record(records[i].sentNs - deadlines[i]);
+                delivery.record(now - records[i].sentNs);
+            }
+            lastActivity = now;
+        } else if (monotonicNowNs() - lastActivity > 2000000000LL) {
+            fprintf(stderr, "Loopback emission stalled after %d reports\n", int(records.size()));
+            break;
+        }
+    }
+    
+    const int64_t elapsed = monotonicNowNs() - start;
+    writer.stop();
+    
+    const QJsonObject params { { "reports", records.size() } };
+    printResult("loopback_rate", params, records.size() * 1e9 / double(elapsed), "reports/s");
+    
+    for (double percentile : { 50.0, 99.0 }) {
+        QJsonObject stats = params;
+        stats["percentile"] = percentile;
+        printResult("loopback_send_lateness", stats, lateness.percentileNs(percentile) / 1e3, "us");
+        printResult("loopback_delivery", stats, delivery.percentileNs(percentile) / 1e3, "us");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    
+    const QList<QPair<QString, void (*)()>> benchmarks = {
+        { "char_to_keycode", benchCharToKeyCode },
+        { "text_encoding", benchTextEncoding },
+        { "macro_step", benchMacroStep },
+        { "config", benchConfig },
+        { "loopback", benchLoopbackEmission }
+    };
+    
+    QStringList selected = app.arguments().mid(1);
+    for (const auto &benchmark : benchmarks) {
+        if (selected.isEmpty() || selected.contains(benchmark.first)) {
+            benchmark.second();
+        }
+    }
+    
+    return 0;
+}
@@ -9,6 +9,7 @@ Rectangle {
     id: root
     
     property string macroId: ""
+    property int macroHandle: -1
     property string macroName: ""
     property string macroIcon: ""
     property string macroColor: "#666666"
@@ -85,7 +86,11 @@ Rectangle {
     MouseArea {
         id: mouseArea
         anchors.fill: parent
-        onClicked: root.clicked()
+        onClicked: {
+            // Start of the press-to-report latency measurement
+            macroController.markClick()
+            root.clicked()
+        }
         
         // Press feedback
         onPressed: {
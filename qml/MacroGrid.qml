@@ -11,10 +11,9 @@ Item {
     
     property int columns: 4
     property int rows: 3
-    property var macros: []
-    property string executingMacro: ""
+    property var macros: null
     
-    signal macroClicked(string macroId)
+    signal macroClicked(string macroId, int macroHandle)
     
     GridView {
         id: gridView
@@ -34,14 +33,15 @@ Item {
                 anchors.fill: parent
                 anchors.margins: 5
                 
-                macroId: modelData.id || ""
-                macroName: modelData.name || ""
-                macroIcon: modelData.icon || "⚡"
-                macroColor: modelData.color || "#666666"
-                isExecuting: executingMacro === macroId
+                macroId: model.macroId
+                macroHandle: model.macroHandle
+                macroName: model.name || ""
+                macroIcon: model.icon || "⚡"
+                macroColor: model.color || "#666666"
+                isExecuting: model.executing
                 
                 onClicked: {
-                    root.macroClicked(macroId)
+                    root.macroClicked(macroId, macroHandle)
                 }
             }
         }
@@ -58,7 +58,7 @@ Item {
     Rectangle {
         anchors.fill: parent
         color: "transparent"
-        visible: macros.length === 0
+        visible: gridView.count === 0
         
         Column {
             anchors.centerIn: parent
@@ -97,6 +97,80 @@ Rectangle {
                             }
                         }
                         
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Label {
+                                text: "Max Typing Rate:"
+                                Layout.preferredWidth: 120
+                            }
+                            
+                            Slider {
+                                id: typingRateSlider
+                                Layout.fillWidth: true
+                                from: 10
+                                to: 1000
+                                stepSize: 10
+                                value: macroController.maxTypingRate
+                                
+                                onPressedChanged: {
+                                    if (!pressed) {
+                                        macroController.maxTypingRate = value
+                                    }
+                                }
+                            }
+                            
+                            Label {
+                                text: typingRateSlider.value.toFixed(0) + " chars/s"
+                                Layout.preferredWidth: 90
+                            }
+                        }
+                        
+                        Label {
+                            text: "Host accepts about " + macroController.typingRate + " chars/s"
+                            font.pixelSize: 12
+                            color: Material.hintTextColor
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Label {
+                                text: "Keyboard Layout:"
+                                Layout.preferredWidth: 120
+                            }
+                            
+                            ComboBox {
+                                Layout.fillWidth: true
+                                model: macroController.keyboardLayouts
+                                displayText: currentText.toUpperCase()
+                                currentIndex: model.indexOf(macroController.keyboardLayout)
+                                
+                                onActivated: function(index) {
+                                    macroController.keyboardLayout = model[index]
+                                }
+                            }
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Label {
+                                text: "Unicode Input:"
+                                Layout.preferredWidth: 120
+                            }
+                            
+                            ComboBox {
+                                Layout.fillWidth: true
+                                model: ["None", "Linux", "Windows", "macOS"]
+                                currentIndex: macroController.unicodeInputs.indexOf(macroController.unicodeInput)
+                                
+                                onActivated: function(index) {
+                                    macroController.unicodeInput = macroController.unicodeInputs[index]
+                                }
+                            }
+                        }
+                        
                         RowLayout {
                             Layout.fillWidth: true
                             spacing: 10
@@ -202,26 +276,46 @@ Rectangle {
                             font.pixelSize: 12
                             color: Material.hintTextColor
                         }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Label {
+                                text: "Pages: " + macroController.pageNames.length
+                                Layout.fillWidth: true
+                            }
+                            
+                            Button {
+                                text: "Add Page"
+                                onClicked: macroController.addPage("Page " + (macroController.pageNames.length + 1))
+                            }
+                            
+                            Button {
+                                text: "Remove Page"
+                                enabled: macroController.pageNames.length > 1
+                                onClicked: macroController.removePage(macroController.currentPage)
+                            }
+                        }
                     }
                 }
                 
                 // Macros Section
                 GroupBox {
                     Layout.fillWidth: true
-                    title: "Macros (" + macroController.macros.length + ")"
+                    title: "Macros (" + macroController.macroModel.count + ")"
                     
                     ColumnLayout {
                         anchors.fill: parent
                         spacing: 10
                         
                         Repeater {
-                            model: macroController.macros
+                            model: macroController.macroModel
                             
                             delegate: Rectangle {
                                 Layout.fillWidth: true
                                 height: 50
                                 radius: 8
-                                color: modelData.color || "#666666"
+                                color: model.color || "#666666"
                                 
                                 RowLayout {
                                     anchors.fill: parent
@@ -229,12 +323,12 @@ Rectangle {
                                     spacing: 10
                                     
                                     Text {
-                                        text: modelData.icon || "⚡"
+                                        text: model.icon || "⚡"
                                         font.pixelSize: 24
                                     }
                                     
                                     Label {
-                                        text: modelData.name || "Unnamed"
+                                        text: model.name || "Unnamed"
                                         font.bold: true
                                         color: "white"
                                         Layout.fillWidth: true
@@ -244,8 +338,8 @@ Rectangle {
                                         text: "🗑️"
                                         flat: true
                                         onClicked: {
-                                            deleteConfirmDialog.macroId = modelData.id
-                                            deleteConfirmDialog.macroName = modelData.name
+                                            deleteConfirmDialog.macroId = model.macroId
+                                            deleteConfirmDialog.macroName = model.name
                                             deleteConfirmDialog.open()
                                         }
                                     }
@@ -263,6 +357,83 @@ Rectangle {
                     }
                 }
                 
+                // Latency Section
+                GroupBox {
+                    Layout.fillWidth: true
+                    title: "Latency"
+                    
+                    ColumnLayout {
+                        anchors.fill: parent
+                        spacing: 5
+                        
+                        Timer {
+                            interval: 1000
+                            running: root.visible
+                            repeat: true
+                            triggeredOnStart: true
+                            onTriggered: latencyRepeater.model = macroController.latencyStats()
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Label { text: "Stage"; font.bold: true; Layout.preferredWidth: 90 }
+                            Label { text: "Count"; font.bold: true; Layout.preferredWidth: 70 }
+                            Label { text: "p50"; font.bold: true; Layout.preferredWidth: 80 }
+                            Label { text: "p99"; font.bold: true; Layout.preferredWidth: 80 }
+                            Label { text: "Max"; font.bold: true; Layout.fillWidth: true }
+                        }
+                        
+                        Repeater {
+                            id: latencyRepeater
+                            
+                            delegate: RowLayout {
+                                Layout.fillWidth: true
+                                
+                                function formatUs(us) {
+                                    return us >= 1000 ? (us / 1000).toFixed(1) + " ms" : us.toFixed(0) + " µs"
+                                }
+                                
+                                Label { text: modelData.name; Layout.preferredWidth: 90 }
+                                Label { text: modelData.count; Layout.preferredWidth: 70 }
+                                Label { text: formatUs(modelData.p50Us); Layout.preferredWidth: 80 }
+                                Label { text: formatUs(modelData.p99Us); Layout.preferredWidth: 80 }
+                                Label { text: formatUs(modelData.maxUs); Layout.fillWidth: true }
+                            }
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            spacing: 10
+                            
+                            Button {
+                                text: "Save to File"
+                                onClicked: {
+                                    var path = macroController.dumpLatency()
+                                    latencyDumpLabel.text = path ? "Saved to " + path : ""
+                                }
+                            }
+                            
+                            Button {
+                                text: "Reset"
+                                onClicked: {
+                                    macroController.resetLatency()
+                                    latencyRepeater.model = macroController.latencyStats()
+                                }
+                            }
+                        }
+                        
+                        Label {
+                            id: latencyDumpLabel
+                            Layout.fillWidth: true
+                            font.pixelSize: 12
+                            color: Material.hintTextColor
+                            wrapMode: Text.WrapAnywhere
+                            visible: text !== ""
+                        }
+                    }
+                }
+                
                 // About Section
                 GroupBox {
                     Layout.fillWidth: true
@@ -87,10 +87,51 @@ ApplicationWindow {
                     Layout.fillHeight: true
                     columns: macroController.columns
                     rows: macroController.rows
-                    macros: macroController.macros
+                    macros: macroController.macroModel
                     
-                    onMacroClicked: function(macroId) {
-                        macroController.executeMacro(macroId)
+                    onMacroClicked: function(macroId, macroHandle) {
+                        macroController.executeMacroHandle(macroHandle)
+                    }
+                }
+                
+                // Paste progress, while a long text is being typed
+                RowLayout {
+                    Layout.fillWidth: true
+                    visible: macroController.paster.active
+                    spacing: 10
+                    
+                    ProgressBar {
+                        Layout.fillWidth: true
+                        value: macroController.paster.progress
+                    }
+                    
+                    Label {
+                        text: macroController.paster.charsPerSecond + " chars/s"
+                        font.pixelSize: 14
+                        color: Material.foreground
+                    }
+                    
+                    Button {
+                        text: "Cancel"
+                        onClicked: macroController.cancelPaste()
+                    }
+                }
+                
+                // Page tabs, only when there is more than one page
+                TabBar {
+                    Layout.fillWidth: true
+                    visible: macroController.pageNames.length > 1
+                    currentIndex: macroController.currentPage
+                    
+                    onCurrentIndexChanged: macroController.currentPage = currentIndex
+                    
+                    Repeater {
+                        model: macroController.pageNames
+                        
+                        TabButton {
+                            text: modelData || ("Page " + (index + 1))
+                            width: implicitWidth
+                        }
                     }
                 }
             }
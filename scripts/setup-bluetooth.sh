@@ -41,6 +41,16 @@ PairableTimeout = 0
 AutoEnable=true
 EOF
 
+# MacroPad accepts the HID channels itself; keep bluetoothd's input
+# plugin from claiming the HID PSMs
+mkdir -p /etc/systemd/system/bluetooth.service.d
+cat > /etc/systemd/system/bluetooth.service.d/macropad.conf << 'EOF'
+[Service]
+ExecStart=
+ExecStart=/usr/libexec/bluetooth/bluetoothd --noplugin=input
+EOF
+systemctl daemon-reload
+
 # Create udev rules for Bluetooth permissions
 cat > /etc/udev/rules.d/99-bluetooth-hid.rules << 'EOF'
 # Allow the pi user to access Bluetooth HID
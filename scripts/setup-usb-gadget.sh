@@ -0,0 +1,101 @@
+#!/bin/bash
+# Setup script for wired USB HID on Raspberry Pi Zero
+# This script creates a USB keyboard gadget (/dev/hidg0) through configfs
+
+set -e
+
+MACROPAD=${MACROPAD:-/usr/local/bin/macropad}
+MACROPAD_USER=${MACROPAD_USER:-pi}   # User macropad.service runs as
+GADGET=/sys/kernel/config/usb_gadget/macropad
+INSTALLED=/usr/local/sbin/macropad-usb-gadget
+UNIT=macropad-usb-gadget.service
+
+# configfs is not persistent, so this runs again at every boot from
+# macropad-usb-gadget.service (setup-usb-gadget.sh --gadget)
+create_gadget() (
+    if [ -d "$GADGET" ]; then
+        echo "Gadget already configured"
+        return 0
+    fi
+
+    # Create the gadget
+    echo "Creating USB HID gadget..."
+    mkdir -p "$GADGET"
+    cd "$GADGET"
+    echo 0x1d6b > idVendor   # Linux Foundation
+    echo 0x0104 > idProduct  # Multifunction Composite Gadget
+    echo 0x0100 > bcdDevice
+    echo 0x0200 > bcdUSB
+
+    mkdir -p strings/0x409
+    echo "macropad" > strings/0x409/serialnumber
+    echo "MacroPad" > strings/0x409/manufacturer
+    echo "MacroPad Keyboard" > strings/0x409/product
+
+    mkdir -p configs/c.1/strings/0x409
+    echo "Keyboard" > configs/c.1/strings/0x409/configuration
+    echo 250 > configs/c.1/MaxPower
+
+    # HID function; the report descriptor comes from the application so
+    # USB and Bluetooth hosts see the same device
+    mkdir -p functions/hid.usb0
+    echo 1 > functions/hid.usb0/protocol      # Keyboard
+    echo 0 > functions/hid.usb0/subclass      # No boot interface (reports carry an ID)
+    echo 9 > functions/hid.usb0/report_length # Report ID + 8 bytes
+    "$MACROPAD" --hid-descriptor > functions/hid.usb0/report_desc
+    ln -s functions/hid.usb0 configs/c.1/
+
+    # Bind to the first device controller
+    ls /sys/class/udc | head -n 1 > UDC
+)
+
+# Check if running as root
+if [ "$EUID" -ne 0 ]; then
+    echo "Please run as root (sudo)"
+    exit 1
+fi
+
+# At boot only the gadget has to be built again
+if [ "$1" = "--gadget" ]; then
+    modprobe libcomposite
+    create_gadget
+    exit 0
+fi
+
+echo "=== USB HID Gadget Setup for Raspberry Pi Zero ==="
+
+# Enable the USB device controller in peripheral mode
+if ! grep -q "^dtoverlay=dwc2" /boot/config.txt; then
+    echo "Enabling dwc2 overlay (reboot required)..."
+    echo "dtoverlay=dwc2" >> /boot/config.txt
+fi
+grep -q "^dwc2" /etc/modules || echo "dwc2" >> /etc/modules
+grep -q "^libcomposite" /etc/modules || echo "libcomposite" >> /etc/modules
+modprobe libcomposite
+
+# Only the macropad group may write reports; anyone who can write to
+# /dev/hidg0 can type into the attached host
+groupadd -f macropad
+usermod -a -G macropad "$MACROPAD_USER"
+cat > /etc/udev/rules.d/99-macropad-hidg.rules << 'EOF'
+SUBSYSTEM=="hidg", KERNEL=="hidg[0-9]*", GROUP="macropad", MODE="0660"
+EOF
+udevadm control --reload-rules
+
+# Build the gadget at every boot, before macropad.service starts
+install -m 0755 "$0" "$INSTALLED"
+sed "s|^Environment=MACROPAD=.*|Environment=MACROPAD=$MACROPAD|" \
+    "$(dirname "$0")/$UNIT" > "/etc/systemd/system/$UNIT"
+systemctl daemon-reload
+systemctl enable "$UNIT"
+
+create_gadget
+
+# The device node was created before udev saw the rule on first setup
+udevadm trigger --subsystem-match=hidg
+
+echo ""
+echo "=== Setup Complete ==="
+echo "Set hid/transport to \"usb\" or \"auto\" in ~/.config/MacroPad/MacroPad.conf"
+echo "to type over USB whenever a host is plugged in."
+echo ""
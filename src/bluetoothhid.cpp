@@ -1,11 +1,21 @@
 #include "bluetoothhid.h"
+#include "hiddescriptor.h"
+#include "hidgtransport.h"
+#include "hidwriter.h"
+#include "l2captransport.h"
+#include "macrocompiler.h"
+#include "uhidtransport.h"
 
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QDBusReply>
 #include <QDBusArgument>
-#include <QThread>
+#include <QSettings>
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <bluetooth/bluetooth.h>
@@ -18,42 +28,50 @@ static const QString HID_PROFILE_UUID = "00001124-0000-1000-8000-00805f9b34fb";
 static const int L2CAP_PSM_HIDP_CTRL = 0x11;
 static const int L2CAP_PSM_HIDP_INTR = 0x13;
 
-// HID Report Descriptor for a standard keyboard
-static const uint8_t HID_REPORT_DESCRIPTOR[] = {
-    0x05, 0x01,  // Usage Page (Generic Desktop)
-    0x09, 0x06,  // Usage (Keyboard)
-    0xA1, 0x01,  // Collection (Application)
-    0x85, 0x01,  //   Report ID (1)
-    0x05, 0x07,  //   Usage Page (Key Codes)
-    0x19, 0xE0,  //   Usage Minimum (224)
-    0x29, 0xE7,  //   Usage Maximum (231)
-    0x15, 0x00,  //   Logical Minimum (0)
-    0x25, 0x01,  //   Logical Maximum (1)
-    0x75, 0x01,  //   Report Size (1)
-    0x95, 0x08,  //   Report Count (8)
-    0x81, 0x02,  //   Input (Data, Variable, Absolute) - Modifier byte
-    0x95, 0x01,  //   Report Count (1)
-    0x75, 0x08,  //   Report Size (8)
-    0x81, 0x01,  //   Input (Constant) - Reserved byte
-    0x95, 0x05,  //   Report Count (5)
-    0x75, 0x01,  //   Report Size (1)
-    0x05, 0x08,  //   Usage Page (LEDs)
-    0x19, 0x01,  //   Usage Minimum (1)
-    0x29, 0x05,  //   Usage Maximum (5)
-    0x91, 0x02,  //   Output (Data, Variable, Absolute) - LED report
-    0x95, 0x01,  //   Report Count (1)
-    0x75, 0x03,  //   Report Size (3)
-    0x91, 0x01,  //   Output (Constant) - LED report padding
-    0x95, 0x06,  //   Report Count (6)
-    0x75, 0x08,  //   Report Size (8)
-    0x15, 0x00,  //   Logical Minimum (0)
-    0x25, 0x65,  //   Logical Maximum (101)
-    0x05, 0x07,  //   Usage Page (Key Codes)
-    0x19, 0x00,  //   Usage Minimum (0)
-    0x29, 0x65,  //   Usage Maximum (101)
-    0x81, 0x00,  //   Input (Data, Array) - Key arrays (6 keys)
-    0xC0         // End Collection
-};
+// Report pacing: start fast, let HidWriter back off for slow hosts
+static const int DEFAULT_REPORT_INTERVAL_US = 2000;
+static const int MAX_REPORT_INTERVAL_US = 30000;
+static const int DEFAULT_MAX_TYPING_RATE = 1000;  // Characters per second
+
+// Shortest Bluetooth connection interval; a host cannot tell apart two
+// reports that arrive closer than its poll interval
+static const int DEFAULT_HOST_POLL_INTERVAL_US = 7500;
+
+// Queue slots a fed program leaves free, so cancels and releases always fit
+static const int QUEUE_RESERVE = 2 * HID_VOICES;
+
+// USB gadget: how often the UDC state is checked for a host
+static const int USB_HOST_POLL_INTERVAL_MS = 500;
+static const QString USB_HOST_ADDRESS = "usb";
+
+// Non-blocking outgoing HIDP channel to a host; -1 on failure
+static int connectChannel(const QString &address, int psm)
+{
+    int fd = ::socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_L2CAP);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_l2 target;
+    memset(&target, 0, sizeof(target));
+    target.l2_family = AF_BLUETOOTH;
+    target.l2_psm = htobs(psm);
+    str2ba(address.toLatin1().constData(), &target.l2_bdaddr);
+    
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&target), sizeof(target)) < 0
+        && errno != EINPROGRESS) {
+        qWarning() << "Cannot connect to" << address << "on PSM" << psm << ":" << strerror(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// A typed character is a press and a release report
+static int reportIntervalToTypingRate(int intervalUs)
+{
+    return 1000000 / qMax(1, 2 * intervalUs);
+}
 
 BluetoothHID::BluetoothHID(QObject *parent)
     : QObject(parent)
@@ -61,26 +79,46 @@ BluetoothHID::BluetoothHID(QObject *parent)
     , m_discoverable(false)
     , m_deviceName("MacroPad")
     , m_status("Not initialized")
-    , m_hidInterruptFd(-1)
-    , m_hidControlFd(-1)
-    , m_macroIndex(0)
-    , m_macroTimer(new QTimer(this))
+    , m_maxTypingRate(qBound(10, QSettings().value("typing/maxRate", DEFAULT_MAX_TYPING_RATE).toInt(), 1000))
+    , m_keyboardLeds(0)
+    , m_controlListenFd(-1)
+    , m_interruptListenFd(-1)
+    , m_controlNotifier(nullptr)
+    , m_interruptNotifier(nullptr)
+    , m_acceptedControlFd(-1)
+    , m_reconnectControlFd(-1)
+    , m_reconnectInterruptFd(-1)
+    , m_reconnectNotifier(nullptr)
+    , m_transportId(0)
+    , m_usbHostTimer(nullptr)
+    , m_usbHostPresent(false)
+    , m_writer(new HidWriter(this))
+    , m_nextRun(0)
     , m_bluetoothAdapter(nullptr)
     , m_profileManager(nullptr)
 {
-    connect(m_macroTimer, &QTimer::timeout, this, &BluetoothHID::processNextMacroStep);
+    for (int64_t &deadline : m_lastDeadlineNs) {
+        deadline = 0;
+    }
+    
+    connect(m_writer, &HidWriter::writeFailed, this, &BluetoothHID::onWriteFailed);
+    connect(m_writer, &HidWriter::macroFinished, this, &BluetoothHID::onMacroFinished);
+    connect(m_writer, &HidWriter::macroFinished, this, &BluetoothHID::typingRateChanged);
+    connect(m_writer, &HidWriter::queueDrained, this, &BluetoothHID::onQueueDrained);
+    connect(m_writer, &HidWriter::hostDisconnected, this, &BluetoothHID::onHostDisconnected);
+    connect(m_writer, &HidWriter::ledsChanged, this, &BluetoothHID::onLedsChanged);
+    
+    applyTypingRate(DEFAULT_REPORT_INTERVAL_US);
+    m_writer->setPollInterval(QSettings().value("hid/pollIntervalUs", DEFAULT_HOST_POLL_INTERVAL_US).toInt());
+    m_writer->setLatencyMonitor(&m_latency);
+    m_writer->start(QThread::HighPriority);
 }
 
 BluetoothHID::~BluetoothHID()
 {
     disconnect();
-    
-    if (m_hidInterruptFd >= 0) {
-        ::close(m_hidInterruptFd);
-    }
-    if (m_hidControlFd >= 0) {
-        ::close(m_hidControlFd);
-    }
+    stopListening();
+    m_writer->stop();
 }
 
 bool BluetoothHID::isConnected() const
@@ -103,6 +141,39 @@ QString BluetoothHID::status() const
     return m_status;
 }
 
+int BluetoothHID::typingRate() const
+{
+    return reportIntervalToTypingRate(m_writer->reportIntervalUs());
+}
+
+int BluetoothHID::maxTypingRate() const
+{
+    return m_maxTypingRate;
+}
+
+int BluetoothHID::keyboardLeds() const
+{
+    return m_keyboardLeds;
+}
+
+LatencyMonitor *BluetoothHID::latencyMonitor()
+{
+    return &m_latency;
+}
+
+void BluetoothHID::setMaxTypingRate(int charsPerSecond)
+{
+    charsPerSecond = qBound(10, charsPerSecond, 1000);
+    if (m_maxTypingRate != charsPerSecond) {
+        m_maxTypingRate = charsPerSecond;
+        QSettings().setValue("typing/maxRate", charsPerSecond);
+        
+        applyTypingRate(m_writer->reportIntervalUs());
+        emit maxTypingRateChanged();
+        emit typingRateChanged();
+    }
+}
+
 void BluetoothHID::setDiscoverable(bool discoverable)
 {
     if (m_discoverable != discoverable) {
@@ -135,6 +206,23 @@ bool BluetoothHID::initialize()
     m_status = "Initializing Bluetooth HID...";
     emit statusChanged();
     
+    // The uhid transport types into this machine and needs no radio
+    const QString transport = QSettings().value("hid/transport", "bluetooth").toString();
+    if (transport == "uhid") {
+        return attachLocalKeyboard();
+    }
+    
+    // USB is used whenever a host is plugged in; "auto" falls back to
+    // Bluetooth while it is not
+    if (transport == "usb" || transport == "auto") {
+        startUsbHostMonitor();
+    }
+    if (transport == "usb") {
+        m_status = "Ready - Waiting for USB host";
+        emit statusChanged();
+        return true;
+    }
+    
     setupDBus();
     
     if (!m_bluetoothAdapter || !m_bluetoothAdapter->isValid()) {
@@ -153,6 +241,14 @@ bool BluetoothHID::initialize()
     // Register the HID profile
     registerHIDProfile();
     
+    // Accept the HID channels ourselves
+    if (!listenForHosts()) {
+        m_status = "Error: Cannot listen for HID connections";
+        emit statusChanged();
+        emit error("Cannot listen for HID connections");
+        return false;
+    }
+    
     m_status = "Ready - Waiting for connection";
     emit statusChanged();
     
@@ -236,21 +332,18 @@ void BluetoothHID::registerHIDProfile()
         "<attribute id=\"0x0102\"><text value=\"MacroPad\" /></attribute>"
         "<attribute id=\"0x0200\"><uint16 value=\"0x0100\" /></attribute>"
         "<attribute id=\"0x0201\"><uint16 value=\"0x0111\" /></attribute>"
-        "<attribute id=\"0x0202\"><uint8 value=\"0x40\" /></attribute>"
+        "<attribute id=\"0x0202\"><uint8 value=\"0xC0\" /></attribute>"
         "<attribute id=\"0x0203\"><uint8 value=\"0x00\" /></attribute>"
         "<attribute id=\"0x0204\"><boolean value=\"true\" /></attribute>"
         "<attribute id=\"0x0205\"><boolean value=\"true\" /></attribute>"
         "<attribute id=\"0x0206\">"
         "<sequence><sequence>"
         "<uint8 value=\"0x22\" />"
-        "<text encoding=\"hex\" value=\""
-        "05010906a101850105071900e029e7150025017501950881029501750881010595"
-        "0175010508190129059102950175039101950675081500652605071900296581000"
-        "c0\" />"
+        "<text encoding=\"hex\" value=\"%1\" />"
         "</sequence></sequence>"
         "</attribute>"
         "</record>"
-    );
+    ).arg(QString::fromLatin1(hidReportDescriptor().toHex()));
     
     QDBusReply<void> reply = m_profileManager->call(
         "RegisterProfile",
@@ -264,41 +357,145 @@ void BluetoothHID::registerHIDProfile()
     }
 }
 
-void BluetoothHID::sendHIDReport(uint8_t modifiers, uint8_t keyCode)
+bool BluetoothHID::sendHIDReport(const uint8_t *data, int64_t deadlineNs, uint8_t flags, int voice)
 {
-    if (m_hidInterruptFd < 0) {
-        qWarning() << "HID interrupt channel not connected";
-        return;
+    HidReport report;
+    report.deadlineNs = deadlineNs;
+    report.flags = flags;
+    report.voice = voice;
+    memcpy(report.data, data, sizeof(report.data));
+    
+    if (!m_writer->enqueue(report)) {
+        qWarning() << "HID output queue full, dropping report";
+        emit error("Too many keys queued");
+        return false;
     }
     
-    // HID keyboard report format:
-    // Byte 0: Report ID (0xA1 for INPUT report)
-    // Byte 1: Modifier keys
-    // Byte 2: Reserved (0x00)
-    // Bytes 3-8: Key codes (up to 6 simultaneous keys)
-    uint8_t report[10] = {
-        0xA1,       // INPUT report
-        0x01,       // Report ID
-        modifiers,  // Modifier keys
-        0x00,       // Reserved
-        keyCode,    // Key code
-        0x00,       // Additional keys (unused)
-        0x00,
-        0x00,
-        0x00,
-        0x00
-    };
+    m_lastDeadlineNs[voice] = deadlineNs;
+    return true;
+}
+
+bool BluetoothHID::releaseAllKeys(uint8_t flags, int voice)
+{
+    uint8_t report[HID_REPORT_SIZE];
+    buildKeyboardReport(report, 0x00, 0x00);
+    return sendHIDReport(report, qMax(monotonicNowNs(), m_lastDeadlineNs[voice]), flags, voice);
+}
+
+void BluetoothHID::runProgram(const MacroProgram &program, int run, int voice)
+{
+    const uint8_t flags = run >= 0 ? HidReport::PressStart : HidReport::NoFlags;
+    m_feeds[voice].enqueue(Feed { program, 0, run, flags, 0 });
     
-    ssize_t written = write(m_hidInterruptFd, report, sizeof(report));
-    if (written < 0) {
-        qWarning() << "Failed to send HID report";
-        emit error("Failed to send key press");
+    // Behind a program that is still being fed it waits its turn
+    if (m_feeds[voice].size() == 1) {
+        feedVoice(voice);
     }
 }
 
-void BluetoothHID::releaseAllKeys()
+void BluetoothHID::feedVoice(int voice)
 {
-    sendHIDReport(0x00, 0x00);
+    QQueue<Feed> &feeds = m_feeds[voice];
+    while (!feeds.isEmpty()) {
+        Feed &feed = feeds.head();
+        const MacroInstruction *instructions = feed.program.constData();
+        const int count = feed.program.size();
+        
+        // Anchor the whole program once; every deadline after that is an
+        // absolute offset from it, so per-step jitter cannot accumulate.
+        if (feed.next == 0) {
+            feed.deadlineNs = qMax(monotonicNowNs(), m_lastDeadlineNs[voice]);
+        }
+        
+        while (feed.next < count) {
+            const MacroInstruction &instruction = instructions[feed.next];
+            if (instruction.opcode == MacroInstruction::OpReport && m_writer->queueSpace() <= QUEUE_RESERVE) {
+                // Carry on once the writer has taken the queue over
+                m_writer->requestQueueSpace();
+                return;
+            }
+            
+            feed.deadlineNs += static_cast<int64_t>(instruction.delayUs) * 1000;
+            ++feed.next;
+            
+            if (instruction.opcode == MacroInstruction::OpDelay) {
+                m_lastDeadlineNs[voice] = feed.deadlineNs;
+                continue;
+            }
+            if (instruction.opcode == MacroInstruction::OpStream) {
+                // Played by TextPaster; alone it types nothing
+                continue;
+            }
+            
+            // The last report doubles as the completion marker
+            const bool last = feed.run >= 0 && feed.next == count;
+            const uint8_t flags = feed.flags | (last ? HidReport::MacroEnd : HidReport::NoFlags);
+            if (!sendHIDReport(instruction.report, feed.deadlineNs, flags, voice)) {
+                cancelVoice(voice);
+                return;
+            }
+            feed.flags = HidReport::NoFlags;
+            if (last) {
+                m_voiceRuns[voice].enqueue(feed.run);
+            }
+        }
+        
+        // Empty program or one ending in a delay: mark the end with a release
+        const bool ended = count > 0 && instructions[count - 1].opcode == MacroInstruction::OpReport;
+        if (feed.run >= 0 && !ended) {
+            if (m_writer->queueSpace() <= QUEUE_RESERVE) {
+                m_writer->requestQueueSpace();
+                return;
+            }
+            if (!releaseAllKeys(HidReport::MacroEnd, voice)) {
+                cancelVoice(voice);
+                return;
+            }
+            m_voiceRuns[voice].enqueue(feed.run);
+        }
+        feeds.dequeue();
+    }
+}
+
+bool BluetoothHID::cancelVoice(int voice)
+{
+    // Programs not fed in full never queued their MacroEnd report
+    while (!m_feeds[voice].isEmpty()) {
+        const int run = m_feeds[voice].dequeue().run;
+        if (run >= 0) {
+            QMetaObject::invokeMethod(this, [this, run]() {
+                emit macroCancelled(run);
+                emit macroComplete(run);
+            }, Qt::QueuedConnection);
+        }
+    }
+    
+    // Drops what the writer still has for the voice and releases its keys
+    HidReport cancel = makeKeyboardReport(0x00, 0x00, monotonicNowNs(), voice);
+    cancel.flags = HidReport::Cancel;
+    if (!m_writer->enqueue(cancel)) {
+        return false;
+    }
+    
+    // The writer still reports the dropped runs as finished
+    for (int run : m_voiceRuns[voice]) {
+        m_cancelledRuns.insert(run);
+    }
+    
+    // What comes next for the voice starts now, not after the dropped reports
+    m_lastDeadlineNs[voice] = cancel.deadlineNs;
+    return true;
+}
+
+int BluetoothHID::freeVoice() const
+{
+    const int64_t now = monotonicNowNs();
+    for (int voice = 1; voice < HID_VOICES; ++voice) {
+        if (m_voiceRuns[voice].isEmpty() && m_feeds[voice].isEmpty() && m_lastDeadlineNs[voice] <= now) {
+            return voice;
+        }
+    }
+    return -1;
 }
 
 void BluetoothHID::sendKey(uint8_t keyCode, uint8_t modifiers)
@@ -308,14 +505,9 @@ void BluetoothHID::sendKey(uint8_t keyCode, uint8_t modifiers)
         return;
     }
     
-    // Send key press
-    sendHIDReport(modifiers, keyCode);
-    
-    // Small delay
-    QThread::msleep(10);
-    
-    // Send key release
-    releaseAllKeys();
+    MacroCompiler compiler;
+    compiler.addKey(keyCode, modifiers);
+    runProgram(compiler.finish());
 }
 
 void BluetoothHID::sendKeyCombo(const QVariantList &keyCodes, uint8_t modifiers)
@@ -325,164 +517,452 @@ void BluetoothHID::sendKeyCombo(const QVariantList &keyCodes, uint8_t modifiers)
         return;
     }
     
-    // For key combinations, we need to send all keys pressed together
-    // then release them all
-    for (const QVariant &keyVar : keyCodes) {
-        uint8_t keyCode = static_cast<uint8_t>(keyVar.toUInt());
-        sendHIDReport(modifiers, keyCode);
-        QThread::msleep(10);
+    MacroCompiler compiler;
+    compiler.addCombo(keyCodes, modifiers);
+    runProgram(compiler.finish());
+}
+
+void BluetoothHID::sendText(const QString &text, bool packed)
+{
+    if (!m_connected) {
+        emit error("Not connected to any device");
+        return;
     }
     
-    releaseAllKeys();
+    MacroCompiler compiler;
+    compiler.addText(text, packed);
+    runProgram(compiler.finish());
 }
 
-uint8_t BluetoothHID::charToKeyCode(QChar c, bool &needsShift) const
+void BluetoothHID::executeMacro(const QVariantList &sequence)
 {
-    needsShift = false;
+    executeProgram(MacroCompiler::compile(sequence));
+}
+
+int BluetoothHID::executeProgram(const MacroProgram &program, ExecutionPolicy policy)
+{
+    if (!m_connected) {
+        emit error("Not connected to any device");
+        return -1;
+    }
     
-    if (c >= 'a' && c <= 'z') {
-        return static_cast<uint8_t>(KeyCode::KEY_A) + (c.unicode() - 'a');
+    const int run = m_nextRun;
+    m_nextRun = (m_nextRun + 1) & 0x7fffffff;
+    
+    int voice = 0;
+    if (policy == ExecutionPolicy::Preempt) {
+        // Parallel macros are running too; stop every voice, then take the first
+        const int64_t now = monotonicNowNs();
+        for (int v = 0; v < HID_VOICES; ++v) {
+            if (!m_voiceRuns[v].isEmpty() || !m_feeds[v].isEmpty() || m_lastDeadlineNs[v] > now) {
+                cancelVoice(v);
+            }
+        }
+    } else if (policy == ExecutionPolicy::Parallel) {
+        // With every voice busy it waits its turn like a queued macro
+        voice = qMax(0, freeVoice());
     }
     
-    if (c >= 'A' && c <= 'Z') {
-        needsShift = true;
-        return static_cast<uint8_t>(KeyCode::KEY_A) + (c.unicode() - 'A');
+    // Queued as far as the writer's queue allows; the writer thread plays it back
+    runProgram(program, run, voice);
+    return run;
+}
+
+void BluetoothHID::startPairing()
+{
+    setDiscoverable(true);
+    m_status = "Pairing mode - Waiting for connection...";
+    emit statusChanged();
+}
+
+void BluetoothHID::disconnect()
+{
+    saveHostTypingRate();
+    m_hostAddress.clear();
+    cancelReconnect();
+    detachHost();
+    
+    if (m_acceptedControlFd >= 0) {
+        ::close(m_acceptedControlFd);
+        m_acceptedControlFd = -1;
     }
     
-    if (c >= '1' && c <= '9') {
-        return static_cast<uint8_t>(KeyCode::KEY_1) + (c.unicode() - '1');
+    if (m_connected) {
+        m_connected = false;
+        emit connectedChanged();
     }
     
-    if (c == '0') {
-        return static_cast<uint8_t>(KeyCode::KEY_0);
+    m_status = "Disconnected";
+    emit statusChanged();
+}
+
+void BluetoothHID::onConnectionStateChanged()
+{
+    // This would be called by D-Bus signals when connection state changes
+    emit connectedChanged();
+    emit statusChanged();
+}
+
+void BluetoothHID::onWriteFailed(int errorCode)
+{
+    Q_UNUSED(errorCode);
+    emit error("Failed to send key press");
+}
+
+void BluetoothHID::onControlConnection()
+{
+    struct sockaddr_l2 address;
+    socklen_t length = sizeof(address);
+    int fd = ::accept4(m_controlListenFd, reinterpret_cast<struct sockaddr *>(&address), &length,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
     }
     
-    if (c == ' ') {
-        return static_cast<uint8_t>(KeyCode::KEY_SPACE);
+    // Only one host at a time; a newer control channel replaces one that
+    // never got its interrupt channel
+    if (m_acceptedControlFd >= 0) {
+        ::close(m_acceptedControlFd);
     }
     
-    if (c == '\n' || c == '\r') {
-        return static_cast<uint8_t>(KeyCode::KEY_ENTER);
+    char addressString[18];
+    ba2str(&address.l2_bdaddr, addressString);
+    m_acceptedControlFd = fd;
+    m_acceptedControlAddress = QString::fromLatin1(addressString);
+}
+
+void BluetoothHID::onInterruptConnection()
+{
+    struct sockaddr_l2 address;
+    socklen_t length = sizeof(address);
+    int fd = ::accept4(m_interruptListenFd, reinterpret_cast<struct sockaddr *>(&address), &length,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
     }
     
-    if (c == '\t') {
-        return static_cast<uint8_t>(KeyCode::KEY_TAB);
+    char addressString[18];
+    ba2str(&address.l2_bdaddr, addressString);
+    const QString hostAddress = QString::fromLatin1(addressString);
+    
+    if (m_acceptedControlFd < 0 || hostAddress != m_acceptedControlAddress) {
+        qWarning() << "HID interrupt channel from" << hostAddress << "without a control channel";
+        ::close(fd);
+        return;
     }
     
-    // Handle special characters (simplified)
-    switch (c.unicode()) {
-        case '!': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_1);
-        case '@': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_2);
-        case '#': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_3);
-        case '$': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_4);
-        case '%': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_5);
-        case '^': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_6);
-        case '&': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_7);
-        case '*': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_8);
-        case '(': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_9);
-        case ')': needsShift = true; return static_cast<uint8_t>(KeyCode::KEY_0);
-        default: return 0x00;
+    const int controlFd = m_acceptedControlFd;
+    m_acceptedControlFd = -1;
+    m_acceptedControlAddress.clear();
+    
+    // A wired host takes priority
+    if (m_hostAddress == USB_HOST_ADDRESS) {
+        qDebug() << "Refusing Bluetooth host" << hostAddress << "while USB is attached";
+        ::close(controlFd);
+        ::close(fd);
+        return;
     }
+    
+    // Reconnected to once USB is unplugged again
+    QSettings().setValue("hid/lastBluetoothHost", hostAddress);
+    attachHost(hostAddress, new L2capTransport(controlFd, fd));
 }
 
-void BluetoothHID::sendText(const QString &text)
+void BluetoothHID::onHostDisconnected(int transportId)
 {
-    if (!m_connected) {
-        emit error("Not connected to any device");
+    // A transport that was already replaced may hang up late
+    if (transportId != m_transportId) {
         return;
     }
     
-    for (const QChar &c : text) {
-        bool needsShift = false;
-        uint8_t keyCode = charToKeyCode(c, needsShift);
+    // The writer has already closed the link
+    hostLost();
+}
+
+void BluetoothHID::hostLost()
+{
+    saveHostTypingRate();
+    m_hostAddress.clear();
+    
+    if (m_connected) {
+        m_connected = false;
+        emit connectedChanged();
+    }
+    
+    m_status = "Ready - Waiting for connection";
+    emit statusChanged();
+}
+
+void BluetoothHID::onUsbHostCheck()
+{
+    // The UDC reports "configured" once a host has enumerated the gadget
+    QFile stateFile("/sys/class/udc/" + m_usbController + "/state");
+    bool present = false;
+    if (stateFile.open(QIODevice::ReadOnly)) {
+        present = stateFile.readAll().trimmed() == "configured";
+    }
+    
+    if (present == m_usbHostPresent) {
+        return;
+    }
+    m_usbHostPresent = present;
+    
+    if (present) {
+        const QString device = QSettings().value("hid/usbDevice", "/dev/hidg0").toString();
+        HidgTransport *transport = HidgTransport::open(device);
+        if (!transport) {
+            emit error("Cannot open " + device);
+            return;
+        }
+        attachHost(USB_HOST_ADDRESS, transport);
+    } else if (m_hostAddress == USB_HOST_ADDRESS) {
+        detachHost();
+        hostLost();
         
-        if (keyCode != 0x00) {
-            uint8_t modifiers = needsShift ? static_cast<uint8_t>(Modifier::LEFT_SHIFT) : 0;
-            sendKey(keyCode, modifiers);
-            QThread::msleep(20);  // Small delay between characters
+        // Fail back to Bluetooth without waiting for the host to call
+        reconnectBluetoothHost();
+    }
+}
+
+void BluetoothHID::onLedsChanged(int leds)
+{
+    if (m_keyboardLeds != leds) {
+        m_keyboardLeds = leds;
+        emit keyboardLedsChanged();
+    }
+}
+
+void BluetoothHID::onMacroFinished(int voice)
+{
+    // The writer finishes a voice's macros in the order they were queued
+    if (voice >= 0 && voice < HID_VOICES && !m_voiceRuns[voice].isEmpty()) {
+        const int run = m_voiceRuns[voice].dequeue();
+        if (m_cancelledRuns.remove(run)) {
+            emit macroCancelled(run);
         }
+        emit macroComplete(run);
     }
 }
 
-void BluetoothHID::executeMacro(const QVariantList &sequence)
+void BluetoothHID::onQueueDrained()
 {
-    if (!m_connected) {
-        emit error("Not connected to any device");
-        return;
+    for (int voice = 0; voice < HID_VOICES; ++voice) {
+        feedVoice(voice);
+    }
+}
+
+bool BluetoothHID::listenForHosts()
+{
+    if (m_controlListenFd >= 0) {
+        return true;
     }
     
-    m_macroQueue = sequence;
-    m_macroIndex = 0;
+    // Listening on both PSMs needs bluetoothd's input plugin disabled
+    auto listenOn = [](int psm) {
+        int fd = ::socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_L2CAP);
+        if (fd < 0) {
+            return -1;
+        }
+        
+        struct sockaddr_l2 address;
+        memset(&address, 0, sizeof(address));
+        address.l2_family = AF_BLUETOOTH;
+        address.l2_psm = htobs(psm);
+        bdaddr_t any = {{0, 0, 0, 0, 0, 0}};
+        bacpy(&address.l2_bdaddr, &any);
+        
+        if (::bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0
+            || ::listen(fd, 1) < 0) {
+            qWarning() << "Cannot listen on L2CAP PSM" << psm << ":" << strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    };
+    
+    m_controlListenFd = listenOn(L2CAP_PSM_HIDP_CTRL);
+    m_interruptListenFd = listenOn(L2CAP_PSM_HIDP_INTR);
+    if (m_controlListenFd < 0 || m_interruptListenFd < 0) {
+        stopListening();
+        return false;
+    }
     
-    // Start processing the macro
-    processNextMacroStep();
+    m_controlNotifier = new QSocketNotifier(m_controlListenFd, QSocketNotifier::Read, this);
+    connect(m_controlNotifier, &QSocketNotifier::activated, this, &BluetoothHID::onControlConnection);
+    m_interruptNotifier = new QSocketNotifier(m_interruptListenFd, QSocketNotifier::Read, this);
+    connect(m_interruptNotifier, &QSocketNotifier::activated, this, &BluetoothHID::onInterruptConnection);
+    return true;
 }
 
-void BluetoothHID::processNextMacroStep()
+void BluetoothHID::startUsbHostMonitor()
 {
-    if (m_macroIndex >= m_macroQueue.size()) {
-        m_macroQueue.clear();
-        m_macroIndex = 0;
-        emit macroComplete();
+    m_usbController = QSettings().value("hid/usbController").toString();
+    if (m_usbController.isEmpty()) {
+        m_usbController = QDir("/sys/class/udc").entryList(QDir::Dirs | QDir::NoDotAndDotDot).value(0);
+    }
+    if (m_usbController.isEmpty()) {
+        qWarning() << "No USB device controller found, USB HID disabled";
         return;
     }
     
-    QVariantMap step = m_macroQueue[m_macroIndex].toMap();
-    m_macroIndex++;
-    
-    QString type = step.value("type").toString();
-    
-    if (type == "key") {
-        uint8_t keyCode = static_cast<uint8_t>(step.value("keyCode").toUInt());
-        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
-        sendKey(keyCode, modifiers);
-    } else if (type == "text") {
-        sendText(step.value("text").toString());
-    } else if (type == "delay") {
-        int delayMs = step.value("ms", 100).toInt();
-        m_macroTimer->start(delayMs);
-        return;  // Don't process next step immediately
-    } else if (type == "combo") {
-        QVariantList keys = step.value("keys").toList();
-        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
-        sendKeyCombo(keys, modifiers);
+    // sysfs attributes cannot be watched with inotify, so poll
+    m_usbHostTimer = new QTimer(this);
+    m_usbHostTimer->setInterval(USB_HOST_POLL_INTERVAL_MS);
+    connect(m_usbHostTimer, &QTimer::timeout, this, &BluetoothHID::onUsbHostCheck);
+    m_usbHostTimer->start();
+    onUsbHostCheck();
+}
+
+void BluetoothHID::stopListening()
+{
+    delete m_controlNotifier;
+    m_controlNotifier = nullptr;
+    delete m_interruptNotifier;
+    m_interruptNotifier = nullptr;
+    
+    if (m_controlListenFd >= 0) {
+        ::close(m_controlListenFd);
+        m_controlListenFd = -1;
+    }
+    if (m_interruptListenFd >= 0) {
+        ::close(m_interruptListenFd);
+        m_interruptListenFd = -1;
+    }
+}
+
+bool BluetoothHID::attachLocalKeyboard()
+{
+    UhidTransport *transport = new UhidTransport();
+    if (!transport->isValid()) {
+        delete transport;
+        m_status = "Error: Cannot create uhid keyboard";
+        emit statusChanged();
+        emit error("Cannot create uhid keyboard");
+        return false;
     }
     
-    // Process next step with a small delay
-    m_macroTimer->start(30);
+    attachHost("uhid", transport);
+    return true;
 }
 
-void BluetoothHID::startPairing()
+void BluetoothHID::attachHost(const QString &address, HidTransport *transport)
 {
-    setDiscoverable(true);
-    m_status = "Pairing mode - Waiting for connection...";
+    saveHostTypingRate();
+    cancelReconnect();
+    m_hostAddress = address;
+    
+    // Resume at the rate this host was last known to accept
+    QSettings settings;
+    applyTypingRate(settings.value("hosts/" + address + "/reportIntervalUs",
+                                   DEFAULT_REPORT_INTERVAL_US).toInt());
+    m_writer->setTransport(transport, ++m_transportId);
+    
+    m_connected = true;
+    m_status = "Connected to " + address;
+    emit connectedChanged();
     emit statusChanged();
+    emit typingRateChanged();
 }
 
-void BluetoothHID::disconnect()
+void BluetoothHID::detachHost()
+{
+    m_writer->setTransport(nullptr, ++m_transportId);
+}
+
+void BluetoothHID::reconnectBluetoothHost()
 {
-    if (m_hidInterruptFd >= 0) {
-        ::close(m_hidInterruptFd);
-        m_hidInterruptFd = -1;
+    // Only while Bluetooth is in use, and to a host that was connected before
+    const QString address = QSettings().value("hid/lastBluetoothHost").toString();
+    if (m_controlListenFd < 0 || address.isEmpty()) {
+        return;
     }
     
-    if (m_hidControlFd >= 0) {
-        ::close(m_hidControlFd);
-        m_hidControlFd = -1;
+    cancelReconnect();
+    m_reconnectControlFd = connectChannel(address, L2CAP_PSM_HIDP_CTRL);
+    if (m_reconnectControlFd < 0) {
+        return;
     }
+    m_reconnectAddress = address;
     
-    if (m_connected) {
-        m_connected = false;
-        emit connectedChanged();
-    }
+    // Writable once the connection is set up or has failed
+    m_reconnectNotifier = new QSocketNotifier(m_reconnectControlFd, QSocketNotifier::Write, this);
+    connect(m_reconnectNotifier, &QSocketNotifier::activated, this, &BluetoothHID::onReconnectProgress);
     
-    m_status = "Disconnected";
+    m_status = "Reconnecting to " + address + "...";
     emit statusChanged();
 }
 
-void BluetoothHID::onConnectionStateChanged()
+void BluetoothHID::onReconnectProgress()
 {
-    // This would be called by D-Bus signals when connection state changes
-    emit connectedChanged();
-    emit statusChanged();
+    const bool interrupt = m_reconnectInterruptFd >= 0;
+    const int fd = interrupt ? m_reconnectInterruptFd : m_reconnectControlFd;
+    
+    int result = 0;
+    socklen_t length = sizeof(result);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &result, &length) < 0) {
+        result = errno;
+    }
+    if (result != 0) {
+        qWarning() << "Cannot reconnect to" << m_reconnectAddress << ":" << strerror(result);
+        cancelReconnect();
+        m_status = "Ready - Waiting for connection";
+        emit statusChanged();
+        return;
+    }
+    
+    // The interrupt channel follows the control channel
+    m_reconnectNotifier->deleteLater();
+    m_reconnectNotifier = nullptr;
+    if (!interrupt) {
+        m_reconnectInterruptFd = connectChannel(m_reconnectAddress, L2CAP_PSM_HIDP_INTR);
+        if (m_reconnectInterruptFd < 0) {
+            cancelReconnect();
+            return;
+        }
+        m_reconnectNotifier = new QSocketNotifier(m_reconnectInterruptFd, QSocketNotifier::Write, this);
+        connect(m_reconnectNotifier, &QSocketNotifier::activated, this, &BluetoothHID::onReconnectProgress);
+        return;
+    }
+    
+    const QString address = m_reconnectAddress;
+    HidTransport *transport = new L2capTransport(m_reconnectControlFd, m_reconnectInterruptFd);
+    m_reconnectControlFd = -1;
+    m_reconnectInterruptFd = -1;
+    attachHost(address, transport);
+}
+
+void BluetoothHID::cancelReconnect()
+{
+    if (m_reconnectNotifier) {
+        // May be the notifier whose signal is being handled
+        m_reconnectNotifier->setEnabled(false);
+        m_reconnectNotifier->deleteLater();
+        m_reconnectNotifier = nullptr;
+    }
+    if (m_reconnectControlFd >= 0) {
+        ::close(m_reconnectControlFd);
+        m_reconnectControlFd = -1;
+    }
+    if (m_reconnectInterruptFd >= 0) {
+        ::close(m_reconnectInterruptFd);
+        m_reconnectInterruptFd = -1;
+    }
+    m_reconnectAddress.clear();
+}
+
+void BluetoothHID::saveHostTypingRate()
+{
+    if (m_hostAddress.isEmpty()) {
+        return;
+    }
+    
+    QSettings settings;
+    settings.setValue("hosts/" + m_hostAddress + "/reportIntervalUs", m_writer->reportIntervalUs());
+}
+
+void BluetoothHID::applyTypingRate(int reportIntervalUs)
+{
+    // The typing rate cap becomes the shortest interval the writer may use
+    const int minIntervalUs = 1000000 / (2 * m_maxTypingRate);
+    m_writer->setReportInterval(reportIntervalUs, minIntervalUs, MAX_REPORT_INTERVAL_US);
 }
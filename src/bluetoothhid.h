@@ -3,11 +3,21 @@
 
 #include <QObject>
 #include <QProcess>
-#include <QTimer>
+#include <QQueue>
+#include <QSet>
 #include <QString>
 #include <QVariantList>
 #include <QDBusConnection>
 #include <QDBusInterface>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "hidreport.h"
+#include "latencymonitor.h"
+#include "macroprogram.h"
+
+class HidTransport;
+class HidWriter;
 
 /**
  * @brief BluetoothHID - Bluetooth HID Keyboard Emulator
@@ -15,6 +25,11 @@
  * This class implements a Bluetooth HID (Human Interface Device) profile
  * that allows the Raspberry Pi Zero to act as a Bluetooth keyboard.
  * It uses the BlueZ D-Bus API and the Bluetooth HID Profile (HIDP).
+ *
+ * Macros are started with an ExecutionPolicy. Queued and preempting
+ * macros share voice 0 with single keys and text; parallel macros get a
+ * voice of their own, and HidWriter merges the voices' keys into each
+ * report it sends. A preempting macro cancels every voice before it starts.
  */
 class BluetoothHID : public QObject
 {
@@ -23,6 +38,9 @@ class BluetoothHID : public QObject
     Q_PROPERTY(bool discoverable READ isDiscoverable WRITE setDiscoverable NOTIFY discoverableChanged)
     Q_PROPERTY(QString deviceName READ deviceName WRITE setDeviceName NOTIFY deviceNameChanged)
     Q_PROPERTY(QString status READ status NOTIFY statusChanged)
+    Q_PROPERTY(int typingRate READ typingRate NOTIFY typingRateChanged)
+    Q_PROPERTY(int maxTypingRate READ maxTypingRate WRITE setMaxTypingRate NOTIFY maxTypingRateChanged)
+    Q_PROPERTY(int keyboardLeds READ keyboardLeds NOTIFY keyboardLedsChanged)
 
 public:
     explicit BluetoothHID(QObject *parent = nullptr);
@@ -33,8 +51,32 @@ public:
     QString deviceName() const;
     QString status() const;
 
+    /**
+     * @brief Characters per second the connected host currently accepts
+     *
+     * Learned from how the host drains the interrupt channel and
+     * remembered per host address.
+     */
+    int typingRate() const;
+
+    /**
+     * @brief Upper bound for typingRate(), in characters per second
+     */
+    int maxTypingRate() const;
+
+    /**
+     * @brief Lock key LEDs last set by the host (bit 0 Num, 1 Caps, 2 Scroll)
+     */
+    int keyboardLeds() const;
+
+    /**
+     * @brief Press-to-report latency histograms
+     */
+    LatencyMonitor *latencyMonitor();
+
     void setDiscoverable(bool discoverable);
     void setDeviceName(const QString &name);
+    void setMaxTypingRate(int charsPerSecond);
 
     // HID Keyboard scancodes
     enum class KeyCode : uint8_t {
@@ -98,11 +140,37 @@ public:
         KEY_LEFT_ARROW = 0x50,
         KEY_DOWN_ARROW = 0x51,
         KEY_UP_ARROW = 0x52,
+        KEY_KEYPAD_PLUS = 0x57,
+        KEY_KEYPAD_1 = 0x59,
+        KEY_KEYPAD_0 = 0x62,
         KEY_VOLUME_MUTE = 0x7F,
         KEY_VOLUME_UP = 0x80,
         KEY_VOLUME_DOWN = 0x81,
     };
 
+    // Consumer Control usages (media keys), sent in their own report
+    enum class ConsumerUsage : uint16_t {
+        NONE = 0x000,
+        BRIGHTNESS_UP = 0x06F,
+        BRIGHTNESS_DOWN = 0x070,
+        NEXT_TRACK = 0x0B5,
+        PREVIOUS_TRACK = 0x0B6,
+        STOP = 0x0B7,
+        PLAY_PAUSE = 0x0CD,
+        MUTE = 0x0E2,
+        VOLUME_UP = 0x0E9,
+        VOLUME_DOWN = 0x0EA,
+    };
+
+    // Mouse buttons
+    enum class MouseButton : uint8_t {
+        LEFT = 0x01,
+        RIGHT = 0x02,
+        MIDDLE = 0x04,
+        BACK = 0x08,
+        FORWARD = 0x10
+    };
+
     // Modifier keys
     enum class Modifier : uint8_t {
         NONE = 0x00,
@@ -134,14 +202,29 @@ public slots:
 
     /**
      * @brief Send a string of text as keyboard input
+     * @param packed Pack up to six keys per report for faster typing
      */
-    void sendText(const QString &text);
+    void sendText(const QString &text, bool packed = false);
 
     /**
      * @brief Execute a macro sequence with delays
+     *
+     * Compiles the sequence first; prefer executeProgram() with a
+     * program compiled ahead of time.
      */
     void executeMacro(const QVariantList &sequence);
 
+    /**
+     * @brief Execute a compiled macro program
+     *
+     * Programs longer than the writer's queue are handed over as it
+     * drains. If a report still cannot be queued, the voice is cancelled
+     * so no key is left down.
+     *
+     * @return Run id that macroComplete() reports, or -1 if not connected
+     */
+    int executeProgram(const MacroProgram &program, ExecutionPolicy policy = ExecutionPolicy::Queue);
+
     /**
      * @brief Start pairing mode
      */
@@ -159,30 +242,109 @@ signals:
     void statusChanged();
     void error(const QString &message);
     void pairingRequested(const QString &deviceAddress);
-    void macroComplete();
+    /**
+     * @brief A macro run finished, was preempted or could not be queued
+     */
+    void macroComplete(int run);
+    /**
+     * @brief A macro run was dropped before it played to the end
+     *
+     * Emitted just before macroComplete() for the same run.
+     */
+    void macroCancelled(int run);
+    void typingRateChanged();
+    void maxTypingRateChanged();
+    void keyboardLedsChanged();
 
 private slots:
     void onConnectionStateChanged();
-    void processNextMacroStep();
+    void onWriteFailed(int errorCode);
+    void onControlConnection();
+    void onInterruptConnection();
+    void onHostDisconnected(int transportId);
+    void onReconnectProgress();
+    void onUsbHostCheck();
+    void onLedsChanged(int leds);
+    void onMacroFinished(int voice);
+    void onQueueDrained();
 
 private:
     void setupDBus();
     void registerHIDProfile();
-    void sendHIDReport(uint8_t modifiers, uint8_t keyCode);
-    void releaseAllKeys();
-    uint8_t charToKeyCode(QChar c, bool &needsShift) const;
+    bool listenForHosts();
+    void stopListening();
+    void startUsbHostMonitor();
+    bool sendHIDReport(const uint8_t *data, int64_t deadlineNs,
+                       uint8_t flags = HidReport::NoFlags, int voice = 0);
+    bool releaseAllKeys(uint8_t flags = HidReport::NoFlags, int voice = 0);
+    void runProgram(const MacroProgram &program, int run = -1, int voice = 0);
+    void feedVoice(int voice);
+    bool cancelVoice(int voice);
+    int freeVoice() const;
+    bool attachLocalKeyboard();
+    void attachHost(const QString &address, HidTransport *transport);
+    void detachHost();
+    void hostLost();
+    void reconnectBluetoothHost();
+    void cancelReconnect();
+    void saveHostTypingRate();
+    void applyTypingRate(int reportIntervalUs);
 
     bool m_connected;
     bool m_discoverable;
     QString m_deviceName;
     QString m_status;
     
-    int m_hidInterruptFd;
-    int m_hidControlFd;
+    QString m_hostAddress;
+    int m_maxTypingRate;
+    int m_keyboardLeds;
+    
+    // Listening L2CAP sockets; a host connects the control channel first
+    int m_controlListenFd;
+    int m_interruptListenFd;
+    QSocketNotifier *m_controlNotifier;
+    QSocketNotifier *m_interruptNotifier;
+    int m_acceptedControlFd;
+    QString m_acceptedControlAddress;
+    
+    // Outgoing connection to the last Bluetooth host, after USB went away;
+    // the control channel connects first
+    QString m_reconnectAddress;
+    int m_reconnectControlFd;
+    int m_reconnectInterruptFd;
+    QSocketNotifier *m_reconnectNotifier;
+    
+    // Id of the transport last handed to the writer; hang-ups of the
+    // transports it replaced are stale
+    int m_transportId;
+    
+    // USB gadget host detection
+    QString m_usbController;
+    QTimer *m_usbHostTimer;
+    bool m_usbHostPresent;
+    
+    // Reports are only built here; HidWriter owns the transport
+    HidWriter *m_writer;
+    LatencyMonitor m_latency;
+    
+    // A program whose reports are handed to the writer as its queue
+    // drains, so programs of any length fit through it
+    struct Feed {
+        MacroProgram program;
+        int next;             // Next instruction to queue
+        int run;              // Reported by macroComplete(), or -1
+        uint8_t flags;        // For the next report queued
+        int64_t deadlineNs;   // Of the last instruction queued
+    };
     
-    QVariantList m_macroQueue;
-    int m_macroIndex;
-    QTimer *m_macroTimer;
+    // Per voice: when its last queued report is due, the runs whose
+    // MacroEnd reports are still queued, oldest first, and the programs
+    // still being fed
+    int64_t m_lastDeadlineNs[HID_VOICES];
+    QQueue<int> m_voiceRuns[HID_VOICES];
+    QQueue<Feed> m_feeds[HID_VOICES];
+    QSet<int> m_cancelledRuns;    // In m_voiceRuns, but dropped by a cancel
+    int m_nextRun;
     
     QDBusInterface *m_bluetoothAdapter;
     QDBusInterface *m_profileManager;
@@ -0,0 +1,368 @@
+#include "configcache.h"
+#include "keyboardlayout.h"
+#include "unicodeinput.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include <cstring>
+
+// Bump whenever the layout below or the compiled program format changes
+static const uint32_t CACHE_VERSION = 6;
+static const char CACHE_MAGIC[4] = { 'M', 'P', 'C', 'C' };
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t configMtimeMs;    // Stamp of the config the cache was built from
+    int64_t configSize;
+    uint64_t configHash;
+    uint64_t payloadHash;     // Checksum of everything after the header
+    uint64_t payloadSize;
+    int32_t columns;
+    int32_t rows;
+    uint32_t pageCount;
+    uint32_t instructionSize; // sizeof(MacroInstruction) of the writer
+    uint32_t layout;          // KeyboardLayout text was compiled for
+    uint32_t unicodeInput;    // UnicodeInput method it was compiled for
+};
+
+static_assert(sizeof(CacheHeader) == 72, "CacheHeader must not contain padding");
+
+/**
+ * Per page, followed by the name as UTF-16 and the page's record: its
+ * macros back to back, recordSize bytes in all
+ */
+struct CachePageHeader {
+    uint32_t nameLength;      // In UTF-16 code units
+    uint32_t reserved;
+    uint64_t recordSize;
+};
+
+static_assert(sizeof(CachePageHeader) == 16, "CachePageHeader must not contain padding");
+
+/**
+ * Per macro, followed by the four strings as UTF-16, the sequence as
+ * compact JSON and the program as raw MacroInstructions
+ */
+struct CacheMacroHeader {
+    uint32_t idLength;        // In UTF-16 code units
+    uint32_t nameLength;
+    uint32_t iconLength;
+    uint32_t colorLength;
+    uint32_t sequenceSize;    // In bytes
+    uint32_t instructionCount;
+    int32_t stepGapMs;
+    uint8_t policy;           // ExecutionPolicy; 0 is Queue
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(CacheMacroHeader) == 32, "CacheMacroHeader must not contain padding");
+
+// FNV-1a: fast enough to check a few megabytes on every start
+static uint64_t fnv1a(const uchar *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a(const QByteArray &data)
+{
+    return fnv1a(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+static void appendString(QByteArray &payload, const QString &string)
+{
+    payload.append(reinterpret_cast<const char *>(string.utf16()), string.size() * sizeof(char16_t));
+}
+
+/**
+ * Bounds-checked reads from the mapped payload; memcpy throughout, as
+ * nothing after the header is aligned
+ */
+class PayloadReader
+{
+public:
+    PayloadReader(const uchar *data, size_t size)
+        : m_data(data)
+        , m_remaining(size)
+    {
+    }
+    
+    bool read(void *out, size_t size)
+    {
+        if (size > m_remaining) {
+            return false;
+        }
+        memcpy(out, m_data, size);
+        m_data += size;
+        m_remaining -= size;
+        return true;
+    }
+    
+    bool readString(QString &string, uint32_t length)
+    {
+        string = QString(length, Qt::Uninitialized);
+        return read(string.data(), length * sizeof(char16_t));
+    }
+    
+    bool readBytes(QByteArray &bytes, uint32_t size)
+    {
+        bytes = QByteArray(size, Qt::Uninitialized);
+        return read(bytes.data(), size);
+    }
+    
+    bool atEnd() const
+    {
+        return m_remaining == 0;
+    }
+
+private:
+    const uchar *m_data;
+    size_t m_remaining;
+};
+
+static bool decodeRecord(const uchar *record, size_t size, QList<MacroConfig::Macro> &macros)
+{
+    PayloadReader reader(record, size);
+    macros.clear();
+    
+    while (!reader.atEnd()) {
+        CacheMacroHeader entry;
+        if (!reader.read(&entry, sizeof(entry))) {
+            return false;
+        }
+        
+        MacroConfig::Macro macro;
+        macro.stepGapMs = entry.stepGapMs;
+        macro.policy = entry.policy <= uint8_t(ExecutionPolicy::Parallel)
+            ? ExecutionPolicy(entry.policy) : ExecutionPolicy::Queue;
+        if (!reader.readString(macro.id, entry.idLength)
+            || !reader.readString(macro.name, entry.nameLength)
+            || !reader.readString(macro.icon, entry.iconLength)
+            || !reader.readString(macro.color, entry.colorLength)
+            || !reader.readBytes(macro.sequenceJson, entry.sequenceSize)) {
+            return false;
+        }
+        
+        macro.program.resize(entry.instructionCount);
+        if (!reader.read(macro.program.data(), entry.instructionCount * sizeof(MacroInstruction))) {
+            return false;
+        }
+        macros.append(macro);
+    }
+    return true;
+}
+
+static bool decodePayload(const uchar *payload, const CacheHeader &header, MacroConfig::Snapshot &contents)
+{
+    PayloadReader reader(payload, header.payloadSize);
+    
+    contents.columns = header.columns;
+    contents.rows = header.rows;
+    contents.pages.clear();
+    contents.pages.reserve(header.pageCount);
+    contents.macros.clear();
+    
+    for (uint32_t i = 0; i < header.pageCount; ++i) {
+        CachePageHeader entry;
+        MacroConfig::Page page { QString(), QByteArray(), true, 0, 0 };
+        if (!reader.read(&entry, sizeof(entry))
+            || !reader.readString(page.name, entry.nameLength)
+            || !reader.readBytes(page.source, entry.recordSize)) {
+            return false;
+        }
+        
+        // Other pages stay records until they are shown
+        if (int(i) == contents.currentPage) {
+            if (!ConfigCache::decodePage(page.source, contents.macros)) {
+                return false;
+            }
+            page.source.clear();
+        }
+        contents.pages.append(page);
+    }
+    return reader.atEnd();
+}
+
+static QByteArray encodeRecord(const QList<MacroConfig::Macro> &macros)
+{
+    QByteArray record;
+    for (const MacroConfig::Macro &macro : macros) {
+        const QByteArray sequence = macro.sequenceJson.isEmpty()
+            ? QJsonDocument(QJsonArray::fromVariantList(macro.sequence)).toJson(QJsonDocument::Compact)
+            : macro.sequenceJson;
+        
+        CacheMacroHeader entry;
+        entry.idLength = macro.id.size();
+        entry.nameLength = macro.name.size();
+        entry.iconLength = macro.icon.size();
+        entry.colorLength = macro.color.size();
+        entry.sequenceSize = sequence.size();
+        entry.instructionCount = macro.program.size();
+        entry.stepGapMs = macro.stepGapMs;
+        entry.policy = uint8_t(macro.policy);
+        memset(entry.reserved, 0, sizeof(entry.reserved));
+        
+        record.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        appendString(record, macro.id);
+        appendString(record, macro.name);
+        appendString(record, macro.icon);
+        appendString(record, macro.color);
+        record.append(sequence);
+        record.append(reinterpret_cast<const char *>(macro.program.constData()),
+                      macro.program.size() * sizeof(MacroInstruction));
+    }
+    return record;
+}
+
+static bool writeCache(const QString &path, const CacheHeader &header, const QByteArray &payload)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(payload);
+    return file.commit();
+}
+
+QString ConfigCache::cachePath(const QString &configPath)
+{
+    return configPath + ".cache";
+}
+
+bool ConfigCache::load(const QString &configPath, MacroConfig::Snapshot &contents, uint64_t *configHash)
+{
+    const QFileInfo configInfo(configPath);
+    QFile file(cachePath(configPath));
+    if (!configInfo.exists() || !file.open(QIODevice::ReadOnly)
+        || file.size() < qint64(sizeof(CacheHeader))) {
+        return false;
+    }
+    
+    const uchar *data = file.map(0, file.size());
+    if (!data) {
+        return false;
+    }
+    
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || header.version != CACHE_VERSION
+        || header.instructionSize != sizeof(MacroInstruction)
+        || header.layout != contents.layout
+        || header.unicodeInput != contents.unicodeInput
+        || header.payloadSize != uint64_t(file.size()) - sizeof(header)) {
+        return false;
+    }
+    
+    const uchar *payload = data + sizeof(header);
+    if (fnv1a(payload, header.payloadSize) != header.payloadHash) {
+        qWarning() << "Config cache is corrupt, rebuilding";
+        return false;
+    }
+    
+    // A new stamp alone (restored backup, unchanged save) keeps the cache
+    const int64_t mtimeMs = configInfo.lastModified().toMSecsSinceEpoch();
+    const bool restamp = header.configMtimeMs != mtimeMs || header.configSize != configInfo.size();
+    if (restamp) {
+        QFile config(configPath);
+        if (!config.open(QIODevice::ReadOnly) || fnv1a(config.readAll()) != header.configHash) {
+            return false;
+        }
+    }
+    
+    if (!decodePayload(payload, header, contents)) {
+        qWarning() << "Config cache is malformed, rebuilding";
+        return false;
+    }
+    
+    if (restamp) {
+        header.configMtimeMs = mtimeMs;
+        header.configSize = configInfo.size();
+        writeCache(file.fileName(), header, QByteArray(reinterpret_cast<const char *>(payload), header.payloadSize));
+    }
+    if (configHash) {
+        *configHash = header.configHash;
+    }
+    return true;
+}
+
+bool ConfigCache::save(const QString &configPath, const QByteArray &json, const MacroConfig::Snapshot &contents)
+{
+    QByteArray payload;
+    for (int i = 0; i < contents.pages.size(); ++i) {
+        const MacroConfig::Page &page = contents.pages[i];
+        
+        QByteArray record;
+        if (i == contents.currentPage) {
+            record = encodeRecord(contents.macros);
+        } else if (page.compiled) {
+            record = page.source;
+        } else {
+            // Pages not shown since the JSON was read are compiled here,
+            // so the next start finds every page ready
+            QList<MacroConfig::Macro> macros;
+            if (!MacroConfig::decodePage(page, macros, nullptr, contents.layout, contents.unicodeInput)) {
+                return false;
+            }
+            record = encodeRecord(macros);
+        }
+        
+        CachePageHeader entry;
+        entry.nameLength = page.name.size();
+        entry.reserved = 0;
+        entry.recordSize = record.size();
+        
+        payload.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        appendString(payload, page.name);
+        payload.append(record);
+    }
+    
+    const QFileInfo configInfo(configPath);
+    
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.configMtimeMs = configInfo.lastModified().toMSecsSinceEpoch();
+    header.configSize = json.size();
+    header.configHash = fnv1a(json);
+    header.payloadHash = fnv1a(payload);
+    header.payloadSize = payload.size();
+    header.columns = contents.columns;
+    header.rows = contents.rows;
+    header.pageCount = contents.pages.size();
+    header.instructionSize = sizeof(MacroInstruction);
+    header.layout = contents.layout;
+    header.unicodeInput = contents.unicodeInput;
+    
+    if (!writeCache(cachePath(configPath), header, payload)) {
+        qWarning() << "Failed to write config cache:" << cachePath(configPath);
+        return false;
+    }
+    return true;
+}
+
+QByteArray ConfigCache::encodePage(const QList<MacroConfig::Macro> &macros)
+{
+    return encodeRecord(macros);
+}
+
+bool ConfigCache::decodePage(const QByteArray &record, QList<MacroConfig::Macro> &macros)
+{
+    return decodeRecord(reinterpret_cast<const uchar *>(record.constData()), record.size(), macros);
+}
+
+uint64_t ConfigCache::hash(const QByteArray &data)
+{
+    return fnv1a(data);
+}
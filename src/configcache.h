@@ -0,0 +1,74 @@
+#ifndef CONFIGCACHE_H
+#define CONFIGCACHE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+#include "macroconfig.h"
+
+/**
+ * @brief ConfigCache - Compiled binary copy of macros.json
+ *
+ * Holds the grid settings and every macro with its compiled program, so
+ * startup maps one file and copies arrays instead of parsing JSON and
+ * compiling each step. Sequences are kept as compact JSON and only
+ * decoded when something edits or saves them. Each page is a separate
+ * record; only the current page is decoded on load, the others are
+ * handed out as records for decodePage().
+ *
+ * The cache sits next to the config as <config>.cache. It records the
+ * config's mtime, size and hash and is used only while they match; a
+ * config that was touched but not changed just gets its stamp updated.
+ * A version number and a payload checksum reject caches from other
+ * builds or torn writes, and programs typed for another keyboard layout
+ * or Unicode input method are not reused. The format is native-endian and not meant to
+ * be copied between machines.
+ */
+class ConfigCache
+{
+public:
+    /**
+     * @brief Path of the cache belonging to a config file
+     */
+    static QString cachePath(const QString &configPath);
+
+    /**
+     * @brief Load the cache if it matches the config file
+     *
+     * The page at contents.currentPage is decoded into contents.macros.
+     * Only a cache compiled for contents.layout and contents.unicodeInput
+     * is used.
+     *
+     * @param configHash Set to hash() of the config file on success
+     * @return false if there is no usable cache; the config must be parsed
+     */
+    static bool load(const QString &configPath, MacroConfig::Snapshot &contents, uint64_t *configHash = nullptr);
+
+    /**
+     * @brief Write the cache for a config file that was just read or written
+     *
+     * Pages not compiled yet are compiled for the snapshot's layout and
+     * Unicode input method, which the cache is stamped with.
+     *
+     * @param json Exact contents of the config file
+     */
+    static bool save(const QString &configPath, const QByteArray &json, const MacroConfig::Snapshot &contents);
+
+    /**
+     * @brief Encode macros as a page record
+     */
+    static QByteArray encodePage(const QList<MacroConfig::Macro> &macros);
+
+    /**
+     * @brief Decode a page record from load() or encodePage()
+     */
+    static bool decodePage(const QByteArray &record, QList<MacroConfig::Macro> &macros);
+
+    /**
+     * @brief Hash used to tell config file contents apart
+     */
+    static uint64_t hash(const QByteArray &data);
+};
+
+#endif // CONFIGCACHE_H
@@ -0,0 +1,767 @@
+#include "configparser.h"
+#include "macrocompiler.h"
+
+#include <QVariantList>
+#include <QVariantMap>
+
+#include <cstring>
+
+// Nesting allowed inside a step before the file is rejected
+static const int MAX_DEPTH = 32;
+
+// Longest pause a delay step or step gap may ask for
+static const qint64 MAX_DELAY_MS = 600000;
+
+// Highest usage the Consumer Control collection declares
+static const qint64 MAX_CONSUMER_USAGE = 0x3FF;
+
+// Farthest a single mouse_move or scroll step may go, in counts or notches
+static const qint64 MAX_MOUSE_DISTANCE = 32767;
+
+static bool isInteger(const QVariant &value)
+{
+    return value.typeId() == QMetaType::LongLong;
+}
+
+ConfigParser::ConfigParser(const QByteArray &data, int line, int column)
+    : m_pos(data.constData())
+    , m_end(data.constData() + data.size())
+    , m_lineStart(data.constData())
+    , m_line(line)
+    , m_columnOffset(column - 1)
+    , m_layout(&KeyboardLayout::current())
+    , m_unicodeInput(UnicodeInput::current())
+{
+}
+
+bool ConfigParser::parse(MacroConfig::Snapshot &snapshot)
+{
+    m_errors.clear();
+    m_layout = &KeyboardLayout::layout(snapshot.layout);
+    m_unicodeInput = snapshot.unicodeInput;
+    snapshot.pages.clear();
+    snapshot.macros.clear();
+    
+    const Position start = position();
+    skipWhitespace();
+    if (!peek('{')) {
+        return syntaxError("expected the config object");
+    }
+    
+    bool hasMacros = false;
+    bool hasPages = false;
+    const bool ok = parseMembers([&](const QString &key, const Position &at) {
+        // Top-level "macros" is the layout of files from before pages
+        if (key == "macros") {
+            if (!peek('[')) {
+                return syntaxError("\"macros\" must be an array");
+            }
+            hasMacros = true;
+            MacroConfig::Page page { QString(), QByteArray(), false, 1, 1 };
+            if (snapshot.currentPage != 0) {
+                snapshot.pages.append(page);
+                return capturePage(snapshot.pages.last());
+            }
+            snapshot.pages.append(page);
+            return parseMacros(snapshot.macros);
+        }
+        if (key == "pages") {
+            if (!peek('[')) {
+                return syntaxError("\"pages\" must be an array");
+            }
+            hasPages = true;
+            return parseElements([&](int index, const Position &pageAt) {
+                return parsePageObject(snapshot, index, pageAt);
+            });
+        }
+        
+        QVariant value;
+        if (!parseValue(value)) {
+            return false;
+        }
+        if (key == "columns" && checkInteger(value, at, "columns", 1, 8)) {
+            snapshot.columns = value.toInt();
+        } else if (key == "rows" && checkInteger(value, at, "rows", 1, 6)) {
+            snapshot.rows = value.toInt();
+        }
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+    
+    skipWhitespace();
+    if (m_pos != m_end) {
+        return syntaxError("unexpected data after the config object");
+    }
+    if (hasMacros && hasPages) {
+        schemaError(start, "use either \"macros\" or \"pages\", not both");
+    } else if (snapshot.pages.isEmpty()) {
+        snapshot.pages.append(MacroConfig::Page { QString(), QByteArray(), false, 1, 1 });
+    }
+    return m_errors.isEmpty();
+}
+
+bool ConfigParser::parsePage(QList<MacroConfig::Macro> &macros,
+                             const KeyboardLayout &layout, UnicodeInput::Method unicodeInput)
+{
+    m_errors.clear();
+    m_layout = &layout;
+    m_unicodeInput = unicodeInput;
+    macros.clear();
+    
+    skipWhitespace();
+    if (!peek('[')) {
+        return syntaxError("expected the array of macros");
+    }
+    if (!parseMacros(macros)) {
+        return false;
+    }
+    
+    skipWhitespace();
+    if (m_pos != m_end) {
+        return syntaxError("unexpected data after the macros");
+    }
+    return m_errors.isEmpty();
+}
+
+QStringList ConfigParser::errors() const
+{
+    return m_errors;
+}
+
+ConfigParser::Position ConfigParser::position() const
+{
+    return Position { m_line, m_lineStart, m_pos, m_columnOffset };
+}
+
+int ConfigParser::column(const Position &at)
+{
+    // Columns count characters, not UTF-8 bytes. Counted on demand rather
+    // than in position(), which runs for every value of a possibly
+    // single-line file.
+    int characters = 0;
+    for (const char *p = at.lineStart; p < at.at; ++p) {
+        if ((static_cast<uchar>(*p) & 0xC0) != 0x80) {
+            ++characters;
+        }
+    }
+    return 1 + characters + at.columnOffset;
+}
+
+void ConfigParser::schemaError(const Position &at, const QString &message)
+{
+    m_errors.append(QString("line %1, column %2: %3").arg(at.line).arg(column(at)).arg(message));
+}
+
+bool ConfigParser::syntaxError(const QString &message)
+{
+    schemaError(position(), message);
+    return false;
+}
+
+void ConfigParser::skipWhitespace()
+{
+    while (m_pos != m_end) {
+        const char c = *m_pos;
+        if (c == '\n') {
+            ++m_line;
+            m_lineStart = m_pos + 1;
+            m_columnOffset = 0;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            return;
+        }
+        ++m_pos;
+    }
+}
+
+bool ConfigParser::peek(char c) const
+{
+    return m_pos != m_end && *m_pos == c;
+}
+
+bool ConfigParser::expect(char c)
+{
+    skipWhitespace();
+    if (!peek(c)) {
+        return syntaxError(QString("expected '%1'").arg(QLatin1Char(c)));
+    }
+    ++m_pos;
+    return true;
+}
+
+bool ConfigParser::parseMembers(const MemberHandler &member)
+{
+    if (!expect('{')) {
+        return false;
+    }
+    skipWhitespace();
+    if (peek('}')) {
+        ++m_pos;
+        return true;
+    }
+    
+    for (;;) {
+        skipWhitespace();
+        QString key;
+        if (!peek('"')) {
+            return syntaxError("expected a member name");
+        }
+        if (!parseString(key) || !expect(':')) {
+            return false;
+        }
+        
+        skipWhitespace();
+        if (!member(key, position())) {
+            return false;
+        }
+        
+        skipWhitespace();
+        if (peek(',')) {
+            ++m_pos;
+            continue;
+        }
+        return expect('}');
+    }
+}
+
+bool ConfigParser::parseElements(const ElementHandler &element)
+{
+    if (!expect('[')) {
+        return false;
+    }
+    skipWhitespace();
+    if (peek(']')) {
+        ++m_pos;
+        return true;
+    }
+    
+    for (int index = 0;; ++index) {
+        skipWhitespace();
+        if (!element(index, position())) {
+            return false;
+        }
+        
+        skipWhitespace();
+        if (peek(',')) {
+            ++m_pos;
+            continue;
+        }
+        return expect(']');
+    }
+}
+
+bool ConfigParser::parseValue(QVariant &value, int depth)
+{
+    skipWhitespace();
+    if (m_pos == m_end) {
+        return syntaxError("unexpected end of file");
+    }
+    if (depth > MAX_DEPTH) {
+        return syntaxError("nested too deeply");
+    }
+    
+    switch (*m_pos) {
+    case '{': {
+        QVariantMap map;
+        const bool ok = parseMembers([&](const QString &key, const Position &) {
+            QVariant member;
+            if (!parseValue(member, depth + 1)) {
+                return false;
+            }
+            map.insert(key, member);
+            return true;
+        });
+        value = map;
+        return ok;
+    }
+    case '[': {
+        QVariantList list;
+        const bool ok = parseElements([&](int, const Position &) {
+            QVariant element;
+            if (!parseValue(element, depth + 1)) {
+                return false;
+            }
+            list.append(element);
+            return true;
+        });
+        value = list;
+        return ok;
+    }
+    case '"': {
+        QString string;
+        if (!parseString(string)) {
+            return false;
+        }
+        value = string;
+        return true;
+    }
+    case 't':
+        return parseLiteral("true", true, value);
+    case 'f':
+        return parseLiteral("false", false, value);
+    case 'n':
+        return parseLiteral("null", QVariant(), value);
+    default:
+        return parseNumber(value);
+    }
+}
+
+bool ConfigParser::parseString(QString &string)
+{
+    ++m_pos;  // Opening quote
+    string.clear();
+    
+    const char *run = m_pos;
+    while (m_pos != m_end) {
+        const uchar c = static_cast<uchar>(*m_pos);
+        
+        if (c == '"') {
+            string.append(QString::fromUtf8(run, m_pos - run));
+            ++m_pos;
+            return true;
+        }
+        if (c < 0x20) {
+            return syntaxError("control character in string");
+        }
+        if (c != '\\') {
+            ++m_pos;
+            continue;
+        }
+        
+        string.append(QString::fromUtf8(run, m_pos - run));
+        if (m_end - m_pos < 2) {
+            break;
+        }
+        
+        const char escape = m_pos[1];
+        m_pos += 2;
+        switch (escape) {
+        case '"': string.append(QLatin1Char('"')); break;
+        case '\\': string.append(QLatin1Char('\\')); break;
+        case '/': string.append(QLatin1Char('/')); break;
+        case 'b': string.append(QLatin1Char('\b')); break;
+        case 'f': string.append(QLatin1Char('\f')); break;
+        case 'n': string.append(QLatin1Char('\n')); break;
+        case 'r': string.append(QLatin1Char('\r')); break;
+        case 't': string.append(QLatin1Char('\t')); break;
+        case 'u': {
+            // Surrogate pairs arrive as two escapes and pair up in UTF-16
+            bool ok = m_end - m_pos >= 4;
+            const ushort code = ok ? QByteArray(m_pos, 4).toUShort(&ok, 16) : 0;
+            if (!ok) {
+                return syntaxError("invalid \\u escape");
+            }
+            string.append(QChar(code));
+            m_pos += 4;
+            break;
+        }
+        default:
+            m_pos -= 2;
+            return syntaxError("invalid escape in string");
+        }
+        run = m_pos;
+    }
+    return syntaxError("unterminated string");
+}
+
+bool ConfigParser::parseNumber(QVariant &number)
+{
+    const char *start = m_pos;
+    bool integral = true;
+    
+    auto digits = [this]() {
+        const char *first = m_pos;
+        while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9') {
+            ++m_pos;
+        }
+        return m_pos != first;
+    };
+    
+    if (peek('-')) {
+        ++m_pos;
+    }
+    if (!digits()) {
+        m_pos = start;
+        return syntaxError("expected a value");
+    }
+    if (peek('.')) {
+        ++m_pos;
+        integral = false;
+        if (!digits()) {
+            return syntaxError("expected digits after the decimal point");
+        }
+    }
+    if (peek('e') || peek('E')) {
+        ++m_pos;
+        integral = false;
+        if (peek('+') || peek('-')) {
+            ++m_pos;
+        }
+        if (!digits()) {
+            return syntaxError("expected digits in the exponent");
+        }
+    }
+    
+    // QByteArray's conversions ignore the locale, unlike strtod
+    const QByteArray text(start, m_pos - start);
+    bool ok = false;
+    if (integral) {
+        const qlonglong value = text.toLongLong(&ok);
+        if (ok) {
+            number = value;
+            return true;
+        }
+    }
+    number = text.toDouble(&ok);
+    return ok || syntaxError("invalid number");
+}
+
+bool ConfigParser::parseLiteral(const char *literal, const QVariant &value, QVariant &out)
+{
+    const size_t length = strlen(literal);
+    if (size_t(m_end - m_pos) < length || memcmp(m_pos, literal, length) != 0) {
+        return syntaxError("expected a value");
+    }
+    m_pos += length;
+    out = value;
+    return true;
+}
+
+bool ConfigParser::skipValue(int depth)
+{
+    skipWhitespace();
+    if (m_pos == m_end) {
+        return syntaxError("unexpected end of file");
+    }
+    if (depth > MAX_DEPTH) {
+        return syntaxError("nested too deeply");
+    }
+    
+    QVariant ignored;
+    switch (*m_pos) {
+    case '{':
+        return parseMembers([&](const QString &, const Position &) {
+            return skipValue(depth + 1);
+        });
+    case '[':
+        return parseElements([&](int, const Position &) {
+            return skipValue(depth + 1);
+        });
+    case '"':
+        return skipString();
+    case 't':
+        return parseLiteral("true", true, ignored);
+    case 'f':
+        return parseLiteral("false", false, ignored);
+    case 'n':
+        return parseLiteral("null", QVariant(), ignored);
+    default:
+        return parseNumber(ignored);
+    }
+}
+
+bool ConfigParser::skipString()
+{
+    ++m_pos;  // Opening quote
+    while (m_pos != m_end) {
+        const uchar c = static_cast<uchar>(*m_pos);
+        if (c == '"') {
+            ++m_pos;
+            return true;
+        }
+        if (c < 0x20) {
+            return syntaxError("control character in string");
+        }
+        if (c == '\\') {
+            if (m_end - m_pos < 2 || !memchr("\"\\/bfnrtu", m_pos[1], 9)) {
+                return syntaxError("invalid escape in string");
+            }
+            ++m_pos;
+        }
+        ++m_pos;
+    }
+    return syntaxError("unterminated string");
+}
+
+bool ConfigParser::parseMacros(QList<MacroConfig::Macro> &macros)
+{
+    return parseElements([&](int index, const Position &at) {
+        MacroConfig::Macro macro;
+        if (!parseMacro(macro, index, at)) {
+            return false;
+        }
+        macros.append(macro);
+        return true;
+    });
+}
+
+bool ConfigParser::parsePageObject(MacroConfig::Snapshot &snapshot, int index, const Position &at)
+{
+    const QString where = QString("page %1").arg(index + 1);
+    if (!peek('{')) {
+        schemaError(at, where + " must be an object");
+        return skipValue();
+    }
+    
+    MacroConfig::Page page { QString(), QByteArray("[]"), false, 1, 1 };
+    bool hasMacros = false;
+    const bool ok = parseMembers([&](const QString &key, const Position &valueAt) {
+        if (key == "macros") {
+            if (!peek('[')) {
+                return syntaxError(where + ": \"macros\" must be an array");
+            }
+            hasMacros = true;
+            if (index == snapshot.currentPage) {
+                page.source.clear();
+                return parseMacros(snapshot.macros);
+            }
+            return capturePage(page);
+        }
+        
+        QVariant value;
+        if (!parseValue(value)) {
+            return false;
+        }
+        if (key == "name" && checkString(value, valueAt, where + ": \"name\"")) {
+            page.name = value.toString();
+        }
+        return true;
+    });
+    if (ok && !hasMacros && index == snapshot.currentPage) {
+        page.source.clear();
+    }
+    snapshot.pages.append(page);
+    return ok;
+}
+
+bool ConfigParser::capturePage(MacroConfig::Page &page)
+{
+    // Syntax is checked now so a broken file is still rejected as a
+    // whole; the schema is checked when the page is parsed
+    const Position at = position();
+    const char *start = m_pos;
+    if (!skipValue()) {
+        return false;
+    }
+    page.source = QByteArray(start, m_pos - start);
+    page.compiled = false;
+    page.line = at.line;
+    page.column = column(at);
+    return true;
+}
+
+bool ConfigParser::parseMacro(MacroConfig::Macro &macro, int index, const Position &at)
+{
+    if (!peek('{')) {
+        schemaError(at, QString("macro %1 must be an object").arg(index + 1));
+        QVariant ignored;
+        return parseValue(ignored);
+    }
+    
+    macro.stepGapMs = MacroCompiler::DefaultStepGapMs;
+    QString where = QString("macro %1").arg(index + 1);
+    
+    const bool ok = parseMembers([&](const QString &key, const Position &valueAt) {
+        if (key == "sequence") {
+            if (!peek('[')) {
+                return syntaxError(where + ": \"sequence\" must be an array");
+            }
+            return parseElements([&](int stepIndex, const Position &stepAt) {
+                QVariantMap step;
+                if (!parseStep(step, QString("%1, step %2").arg(where).arg(stepIndex + 1), stepAt)) {
+                    return false;
+                }
+                macro.sequence.append(step);
+                return true;
+            });
+        }
+        
+        QVariant value;
+        if (!parseValue(value)) {
+            return false;
+        }
+        if (key == "id") {
+            if (checkString(value, valueAt, where + ": \"id\"")) {
+                macro.id = value.toString();
+                where = QString("macro \"%1\"").arg(macro.id);
+            }
+        } else if (key == "name") {
+            if (checkString(value, valueAt, where + ": \"name\"")) {
+                macro.name = value.toString();
+            }
+        } else if (key == "icon") {
+            if (checkString(value, valueAt, where + ": \"icon\"")) {
+                macro.icon = value.toString();
+            }
+        } else if (key == "color") {
+            if (checkString(value, valueAt, where + ": \"color\"")) {
+                macro.color = value.toString();
+            }
+        } else if (key == "stepGapMs") {
+            if (checkInteger(value, valueAt, where + ": \"stepGapMs\"", 0, MAX_DELAY_MS)) {
+                macro.stepGapMs = value.toInt();
+            }
+        } else if (key == "policy") {
+            bool known = false;
+            if (checkString(value, valueAt, where + ": \"policy\"")) {
+                macro.policy = MacroConfig::policyFromName(value.toString(), &known);
+                if (!known) {
+                    schemaError(valueAt, where + ": \"policy\" must be \"queue\", \"preempt\" or \"parallel\"");
+                }
+            }
+        }
+        return true;
+    });
+    if (!ok) {
+        return false;
+    }
+    
+    if (macro.id.isEmpty()) {
+        schemaError(at, where + " has no \"id\"");
+    }
+    
+    // The object is complete, so the gap is known: compile now
+    macro.program = MacroCompiler::compile(macro.sequence, macro.stepGapMs, *m_layout, m_unicodeInput);
+    return true;
+}
+
+bool ConfigParser::parseStep(QVariantMap &step, const QString &where, const Position &at)
+{
+    if (!peek('{')) {
+        schemaError(at, where + " must be an object");
+        QVariant ignored;
+        return parseValue(ignored);
+    }
+    
+    QHash<QString, Position> fields;
+    const bool ok = parseMembers([&](const QString &key, const Position &valueAt) {
+        QVariant value;
+        if (!parseValue(value, 1)) {
+            return false;
+        }
+        step.insert(key, value);
+        fields.insert(key, valueAt);
+        return true;
+    });
+    if (ok) {
+        validateStep(step, fields, where, at);
+    }
+    return ok;
+}
+
+void ConfigParser::validateStep(const QVariantMap &step, const QHash<QString, Position> &fields,
+                                const QString &where, const Position &at)
+{
+    auto required = [&](const char *field) {
+        if (!step.contains(field)) {
+            schemaError(at, QString("%1: missing \"%2\"").arg(where, QLatin1String(field)));
+            return false;
+        }
+        return true;
+    };
+    auto keyCode = [&](const char *field) {
+        if (step.contains(field)) {
+            checkInteger(step.value(field), fields.value(field), QString("%1: \"%2\"").arg(where, QLatin1String(field)), 0, 255);
+        }
+    };
+    
+    if (!required("type") || !checkString(step.value("type"), fields.value("type"), where + ": \"type\"")) {
+        return;
+    }
+    
+    const QString type = step.value("type").toString();
+    if (type == "consumer") {
+        if (required("usage")) {
+            checkInteger(step.value("usage"), fields.value("usage"), where + ": \"usage\"", 1, MAX_CONSUMER_USAGE);
+        }
+        keyCode("modifiers");
+    } else if (type == "mouse_move" || type == "scroll") {
+        if (!step.contains("x") && !step.contains("y")) {
+            schemaError(at, where + ": missing \"x\" or \"y\"");
+        }
+        for (const char *axis : { "x", "y" }) {
+            if (step.contains(axis)) {
+                checkInteger(step.value(axis), fields.value(axis), QString("%1: \"%2\"").arg(where, QLatin1String(axis)),
+                             -MAX_MOUSE_DISTANCE, MAX_MOUSE_DISTANCE);
+            }
+        }
+    } else if (type == "click") {
+        if (step.contains("button")) {
+            checkInteger(step.value("button"), fields.value("button"), where + ": \"button\"", 1, 5);
+        }
+        if (step.contains("count")) {
+            checkInteger(step.value("count"), fields.value("count"), where + ": \"count\"", 1, 3);
+        }
+    } else if (type == "key") {
+        if (required("keyCode")) {
+            keyCode("keyCode");
+        }
+        keyCode("modifiers");
+    } else if (type == "combo") {
+        if (required("keys")) {
+            const QVariant keys = step.value("keys");
+            const Position keysAt = fields.value("keys");
+            if (keys.typeId() != QMetaType::QVariantList || keys.toList().isEmpty()) {
+                schemaError(keysAt, where + ": \"keys\" must be a non-empty array of key codes");
+            } else {
+                for (const QVariant &key : keys.toList()) {
+                    if (!checkInteger(key, keysAt, where + ": every entry of \"keys\"", 0, 255)) {
+                        break;
+                    }
+                }
+            }
+        }
+        keyCode("modifiers");
+    } else if (type == "press") {
+        if (!step.contains("keyCode") && !step.contains("modifiers")) {
+            schemaError(at, where + ": missing \"keyCode\" or \"modifiers\"");
+        }
+        keyCode("keyCode");
+        keyCode("modifiers");
+    } else if (type == "release") {
+        // Both optional: a bare release lets go of everything
+        keyCode("keyCode");
+        keyCode("modifiers");
+    } else if (type == "text") {
+        // The text is either inline or read from a file while it streams
+        if (step.contains("file")) {
+            if (step.contains("text")) {
+                schemaError(fields.value("file"), where + ": \"text\" and \"file\" cannot both be set");
+            }
+            checkString(step.value("file"), fields.value("file"), where + ": \"file\"");
+        } else if (required("text")) {
+            checkString(step.value("text"), fields.value("text"), where + ": \"text\"");
+        }
+        for (const char *flag : { "packed", "stream" }) {
+            if (step.contains(flag) && step.value(flag).typeId() != QMetaType::Bool) {
+                schemaError(fields.value(flag), QString("%1: \"%2\" must be true or false").arg(where, QLatin1String(flag)));
+            }
+        }
+    } else if (type == "delay") {
+        if (step.contains("ms")) {
+            checkInteger(step.value("ms"), fields.value("ms"), where + ": \"ms\"", 0, MAX_DELAY_MS);
+        }
+    } else {
+        schemaError(fields.value("type"), QString("%1: unknown step type \"%2\"").arg(where, type));
+    }
+}
+
+bool ConfigParser::checkString(const QVariant &value, const Position &at, const QString &what)
+{
+    if (value.typeId() != QMetaType::QString) {
+        schemaError(at, what + " must be a string");
+        return false;
+    }
+    return true;
+}
+
+bool ConfigParser::checkInteger(const QVariant &value, const Position &at, const QString &what,
+                                qint64 min, qint64 max)
+{
+    if (!isInteger(value) || value.toLongLong() < min || value.toLongLong() > max) {
+        schemaError(at, QString("%1 must be an integer from %2 to %3").arg(what).arg(min).arg(max));
+        return false;
+    }
+    return true;
+}
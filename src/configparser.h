@@ -0,0 +1,118 @@
+#ifndef CONFIGPARSER_H
+#define CONFIGPARSER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <functional>
+
+#include "macroconfig.h"
+
+/**
+ * @brief ConfigParser - Streaming, validating reader for macros.json
+ *
+ * Walks the JSON text once and builds each macro as its object closes:
+ * the steps become the macro's sequence and are compiled right away, so
+ * no document tree of the whole file is ever held in memory.
+ *
+ * Each step is checked against the schema of its type (required fields,
+ * value types and ranges). Problems are reported as "line L, column C:"
+ * messages pointing at the offending value. Schema problems are
+ * collected and parsing carries on, so a single pass reports all of
+ * them. A syntax error stops the parse.
+ *
+ * Only the current page is built. The macros of every other page are
+ * checked for syntax and kept as a slice of the text, which parsePage()
+ * turns into macros once the page is shown.
+ */
+class ConfigParser
+{
+public:
+    /**
+     * @param line, column Where data starts in the file, for messages
+     */
+    explicit ConfigParser(const QByteArray &data, int line = 1, int column = 1);
+
+    /**
+     * @brief Parse a whole config into snapshot
+     *
+     * Grid sizes that the file does not set keep their value in snapshot.
+     * The page at snapshot.currentPage is built into snapshot.macros,
+     * compiled for snapshot.layout and snapshot.unicodeInput; if the
+     * file has fewer pages, snapshot.macros is left empty.
+     *
+     * @return false if there was any syntax or schema error
+     */
+    bool parse(MacroConfig::Snapshot &snapshot);
+
+    /**
+     * @brief Parse the JSON array of macros kept for a page
+     * @param layout, unicodeInput How the macros type text
+     * @return false if there was any syntax or schema error
+     */
+    bool parsePage(QList<MacroConfig::Macro> &macros,
+                   const KeyboardLayout &layout = KeyboardLayout::current(),
+                   UnicodeInput::Method unicodeInput = UnicodeInput::current());
+
+    /**
+     * @brief Problems found, in file order
+     */
+    QStringList errors() const;
+
+private:
+    // Where a value starts; the column is only counted for a message
+    struct Position {
+        int line;
+        const char *lineStart;
+        const char *at;
+        int columnOffset;
+    };
+
+    typedef std::function<bool(const QString &key, const Position &at)> MemberHandler;
+    typedef std::function<bool(int index, const Position &at)> ElementHandler;
+
+    Position position() const;
+    static int column(const Position &at);
+    void schemaError(const Position &at, const QString &message);
+    bool syntaxError(const QString &message);
+
+    void skipWhitespace();
+    bool peek(char c) const;
+    bool expect(char c);
+
+    bool parseMembers(const MemberHandler &member);
+    bool parseElements(const ElementHandler &element);
+    bool parseValue(QVariant &value, int depth = 0);
+    bool parseString(QString &string);
+    bool parseNumber(QVariant &number);
+    bool parseLiteral(const char *literal, const QVariant &value, QVariant &out);
+    bool skipValue(int depth = 0);
+    bool skipString();
+
+    bool parseMacros(QList<MacroConfig::Macro> &macros);
+    bool parsePageObject(MacroConfig::Snapshot &snapshot, int index, const Position &at);
+    bool capturePage(MacroConfig::Page &page);
+
+    bool parseMacro(MacroConfig::Macro &macro, int index, const Position &at);
+    bool parseStep(QVariantMap &step, const QString &where, const Position &at);
+    void validateStep(const QVariantMap &step, const QHash<QString, Position> &fields,
+                      const QString &where, const Position &at);
+
+    bool checkString(const QVariant &value, const Position &at, const QString &what);
+    bool checkInteger(const QVariant &value, const Position &at, const QString &what,
+                      qint64 min, qint64 max);
+
+    const char *m_pos;
+    const char *m_end;
+    const char *m_lineStart;
+    int m_line;
+    int m_columnOffset;     // Added to columns on the first line
+    QStringList m_errors;
+    const KeyboardLayout *m_layout;       // What built macros are compiled for
+    UnicodeInput::Method m_unicodeInput;
+};
+
+#endif // CONFIGPARSER_H
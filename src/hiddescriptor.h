@@ -0,0 +1,23 @@
+#ifndef HIDDESCRIPTOR_H
+#define HIDDESCRIPTOR_H
+
+#include <QByteArray>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief HID report descriptor shared by every transport
+ *
+ * The SDP record, the uhid device and the USB gadget all describe the
+ * same device, so the reports HidWriter sends mean the same everywhere.
+ */
+extern const uint8_t HID_REPORT_DESCRIPTOR[];
+extern const size_t HID_REPORT_DESCRIPTOR_SIZE;
+
+/**
+ * @brief The report descriptor as a byte array (no copy)
+ */
+QByteArray hidReportDescriptor();
+
+#endif // HIDDESCRIPTOR_H
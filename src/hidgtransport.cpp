@@ -0,0 +1,75 @@
+#include "hidgtransport.h"
+
+#include <QDebug>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+HidgTransport::HidgTransport(int fd)
+    : m_fd(fd)
+{
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+}
+
+HidgTransport::~HidgTransport()
+{
+    ::close(m_fd);
+}
+
+HidgTransport *HidgTransport::open(const QString &devicePath)
+{
+    int fd = ::open(devicePath.toLocal8Bit().constData(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "Cannot open" << devicePath << ":" << strerror(errno);
+        return nullptr;
+    }
+    return new HidgTransport(fd);
+}
+
+QString HidgTransport::name() const
+{
+    return QStringLiteral("usb");
+}
+
+QList<int> HidgTransport::descriptors() const
+{
+    return { m_fd };
+}
+
+int HidgTransport::reportFd() const
+{
+    return m_fd;
+}
+
+ssize_t HidgTransport::sendReport(const uint8_t *data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    
+    // The gadget takes the report without the HIDP header byte
+    ssize_t written = ::write(m_fd, data + 1, size - 1);
+    if (written < 0) {
+        return -1;
+    }
+    
+    rememberReport(data, size);
+    return written + 1;
+}
+
+HidTransport::InputResult HidgTransport::handleInput(int fd)
+{
+    uint8_t message[64];
+    ssize_t size = ::read(fd, message, sizeof(message));
+    
+    if (size == 0) {
+        return InputHungUp;
+    }
+    
+    // LED output report: report ID, LED bits
+    if (size >= 2 && message[0] == HID_KEYBOARD_REPORT_ID) {
+        return updateLeds(message[1]);
+    }
+    return InputHandled;
+}
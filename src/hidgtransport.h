@@ -0,0 +1,42 @@
+#ifndef HIDGTRANSPORT_H
+#define HIDGTRANSPORT_H
+
+#include "hidtransport.h"
+
+/**
+ * @brief HidgTransport - Wired HID through the USB gadget driver
+ *
+ * Writes reports to a /dev/hidgN device created through configfs (see
+ * scripts/setup-usb-gadget.sh) and reads the host's LED output reports
+ * back from it. A USB link has far lower and steadier latency than
+ * Bluetooth.
+ *
+ * The transport only sees a descriptor, so tests can pass one end of a
+ * socketpair instead of a gadget device.
+ */
+class HidgTransport : public HidTransport
+{
+public:
+    /**
+     * @brief Take ownership of an open gadget device (or stand-in)
+     */
+    explicit HidgTransport(int fd);
+    ~HidgTransport();
+
+    /**
+     * @brief Open a gadget device
+     * @return nullptr if it cannot be opened
+     */
+    static HidgTransport *open(const QString &devicePath);
+
+    QString name() const override;
+    QList<int> descriptors() const override;
+    int reportFd() const override;
+    ssize_t sendReport(const uint8_t *data, size_t size) override;
+    InputResult handleInput(int fd) override;
+
+private:
+    int m_fd;
+};
+
+#endif // HIDGTRANSPORT_H
@@ -0,0 +1,176 @@
+#ifndef HIDREPORT_H
+#define HIDREPORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <time.h>
+
+/**
+ * @brief Size of a keyboard input report on the HID interrupt channel
+ *
+ * Byte 0: HIDP header (0xA1 = DATA | INPUT)
+ * Byte 1: Report ID
+ * Byte 2: Modifier keys
+ * Byte 3: Reserved (0x00)
+ * Bytes 4-9: Key codes (up to 6 simultaneous keys)
+ */
+static const int HID_REPORT_SIZE = 10;
+
+/**
+ * @brief Size of a Consumer Control input report
+ *
+ * Byte 0: HIDP header (0xA1)
+ * Byte 1: Report ID
+ * Bytes 2-3: Usage, little endian (0 when nothing is pressed)
+ *
+ * Consumer and mouse reports travel in the same HID_REPORT_SIZE buffers as
+ * keyboard reports; only their first bytes are sent.
+ */
+static const int HID_CONSUMER_REPORT_SIZE = 4;
+
+/**
+ * @brief Size of a relative mouse input report
+ *
+ * Byte 0: HIDP header (0xA1)
+ * Byte 1: Report ID
+ * Byte 2: Buttons (bit 0 left, 1 right, 2 middle, 3 back, 4 forward)
+ * Bytes 3-4: X and Y movement, -127 to 127
+ * Byte 5: Vertical wheel, positive scrolls up
+ * Byte 6: Horizontal wheel (AC Pan), positive scrolls right
+ */
+static const int HID_MOUSE_REPORT_SIZE = 7;
+
+/**
+ * @brief Largest movement a single mouse report can carry on each axis
+ */
+static const int HID_MOUSE_MAX_DELTA = 127;
+
+/**
+ * @brief Report IDs of the collections in the report descriptor
+ */
+static const uint8_t HID_KEYBOARD_REPORT_ID = 0x01;
+static const uint8_t HID_CONSUMER_REPORT_ID = 0x02;
+static const uint8_t HID_MOUSE_REPORT_ID = 0x03;
+
+/**
+ * @brief Number of key slots in a keyboard report (6-key rollover)
+ */
+static const int HID_REPORT_KEY_SLOTS = 6;
+
+/**
+ * @brief Number of independent report streams the HID writer merges
+ *
+ * Voice 0 carries single keys, text and queued macros; macros run in
+ * parallel take the others.
+ */
+static const int HID_VOICES = 8;
+
+/**
+ * @brief A pre-built HID report together with the time it is due
+ *
+ * Reports are built on the GUI thread and handed to the HID writer thread
+ * through a lock-free ring, so this must stay trivially copyable.
+ */
+struct HidReport {
+    enum Flag : uint8_t {
+        NoFlags = 0x00,
+        MacroEnd = 0x01,  // Last report of a macro; writer signals once it is sent
+        PressStart = 0x02, // First report of a press; writer records its latency
+        Cancel = 0x04     // Drop what is queued for the voice and release its keys; data unused
+    };
+
+    int64_t deadlineNs;   // CLOCK_MONOTONIC time before which it must not be sent
+    uint8_t flags;
+    uint8_t voice;        // Stream it belongs to, below HID_VOICES
+    uint8_t data[HID_REPORT_SIZE];
+};
+
+/**
+ * @brief Current CLOCK_MONOTONIC time in nanoseconds
+ */
+inline int64_t monotonicNowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Fill a keyboard input report for a single key (or none)
+ */
+inline void buildKeyboardReport(uint8_t *data, uint8_t modifiers, uint8_t keyCode)
+{
+    std::memset(data, 0, HID_REPORT_SIZE);
+    data[0] = 0xA1;       // INPUT report
+    data[1] = HID_KEYBOARD_REPORT_ID;
+    data[2] = modifiers;  // Modifier keys
+    data[4] = keyCode;    // Key code
+}
+
+/**
+ * @brief Fill a keyboard input report with up to six pressed keys
+ */
+inline void buildKeyboardReport(uint8_t *data, uint8_t modifiers, const uint8_t *keyCodes, int count)
+{
+    buildKeyboardReport(data, modifiers, 0x00);
+    for (int i = 0; i < count && i < HID_REPORT_KEY_SLOTS; ++i) {
+        data[4 + i] = keyCodes[i];
+    }
+}
+
+/**
+ * @brief Fill a Consumer Control input report; usage 0 releases
+ */
+inline void buildConsumerReport(uint8_t *data, uint16_t usage)
+{
+    std::memset(data, 0, HID_REPORT_SIZE);
+    data[0] = 0xA1;
+    data[1] = HID_CONSUMER_REPORT_ID;
+    data[2] = static_cast<uint8_t>(usage & 0xFF);
+    data[3] = static_cast<uint8_t>(usage >> 8);
+}
+
+/**
+ * @brief Fill a mouse input report; deltas must be within HID_MOUSE_MAX_DELTA
+ */
+inline void buildMouseReport(uint8_t *data, uint8_t buttons, int x, int y, int wheel, int pan)
+{
+    std::memset(data, 0, HID_REPORT_SIZE);
+    data[0] = 0xA1;
+    data[1] = HID_MOUSE_REPORT_ID;
+    data[2] = buttons;
+    data[3] = static_cast<uint8_t>(static_cast<int8_t>(x));
+    data[4] = static_cast<uint8_t>(static_cast<int8_t>(y));
+    data[5] = static_cast<uint8_t>(static_cast<int8_t>(wheel));
+    data[6] = static_cast<uint8_t>(static_cast<int8_t>(pan));
+}
+
+/**
+ * @brief Bytes of a report on the wire, header included
+ */
+inline int hidReportSize(const uint8_t *data)
+{
+    switch (data[1]) {
+    case HID_CONSUMER_REPORT_ID:
+        return HID_CONSUMER_REPORT_SIZE;
+    case HID_MOUSE_REPORT_ID:
+        return HID_MOUSE_REPORT_SIZE;
+    default:
+        return HID_REPORT_SIZE;
+    }
+}
+
+/**
+ * @brief Build a keyboard input report for a single key (or none)
+ */
+inline HidReport makeKeyboardReport(uint8_t modifiers, uint8_t keyCode, int64_t deadlineNs, uint8_t voice = 0)
+{
+    HidReport report;
+    report.deadlineNs = deadlineNs;
+    report.flags = HidReport::NoFlags;
+    report.voice = voice;
+    buildKeyboardReport(report.data, modifiers, keyCode);
+    return report;
+}
+
+#endif // HIDREPORT_H
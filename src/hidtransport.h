@@ -0,0 +1,126 @@
+#ifndef HIDTRANSPORT_H
+#define HIDTRANSPORT_H
+
+#include <QList>
+#include <QString>
+
+#include <sys/types.h>
+
+#include "hidreport.h"
+
+/**
+ * @brief HidTransport - Link that carries keyboard reports to a host
+ *
+ * HidWriter paces and sends reports without knowing where they go. A
+ * transport wraps the descriptors of one link (Bluetooth L2CAP channels,
+ * a local loopback, a uhid virtual device...) and translates between the
+ * writer's HIDP-formatted reports and whatever the link expects.
+ *
+ * All methods except the constructor are called on the writer thread.
+ * Descriptors must be non-blocking; the writer multiplexes them with
+ * epoll and waits for reportFd() to become writable after EAGAIN.
+ */
+class HidTransport
+{
+public:
+    enum InputResult {
+        InputHandled,      // Consumed, nothing for the writer to do
+        InputLedsChanged,  // leds() has a new value
+        InputHungUp        // The host is gone; the transport is dead
+    };
+
+    HidTransport()
+        : m_leds(0)
+    {
+        buildKeyboardReport(m_lastReports[HID_KEYBOARD_REPORT_ID - 1], 0x00, 0x00);
+        buildConsumerReport(m_lastReports[HID_CONSUMER_REPORT_ID - 1], 0);
+        buildMouseReport(m_lastReports[HID_MOUSE_REPORT_ID - 1], 0x00, 0, 0, 0, 0);
+    }
+
+    virtual ~HidTransport() {}
+
+    /**
+     * @brief Short name for logs and the UI (e.g. "bluetooth")
+     */
+    virtual QString name() const = 0;
+
+    /**
+     * @brief Descriptors to watch for input and hang-up
+     *
+     * Must include reportFd().
+     */
+    virtual QList<int> descriptors() const = 0;
+
+    /**
+     * @brief Descriptor reports are written to
+     */
+    virtual int reportFd() const = 0;
+
+    /**
+     * @brief Write one report without blocking
+     * @param data Report in HIDP wire format, header byte first
+     * @return Bytes written, or -1 with errno set (EAGAIN when full)
+     */
+    virtual ssize_t sendReport(const uint8_t *data, size_t size) = 0;
+
+    /**
+     * @brief Handle pending input on one of descriptors()
+     */
+    virtual InputResult handleInput(int fd) = 0;
+
+    /**
+     * @brief Lock key LEDs last set by the host
+     */
+    int leds() const { return m_leds; }
+
+protected:
+    /**
+     * @brief Remember a report that went out, for hosts polling GET_REPORT
+     *
+     * The last report of each ID is kept. Pointer motion is not state, so
+     * a kept mouse report only holds the buttons.
+     */
+    void rememberReport(const uint8_t *data, size_t size)
+    {
+        if (size < 2 || data[1] == 0x00 || data[1] > HID_MOUSE_REPORT_ID) {
+            return;
+        }
+        uint8_t *last = m_lastReports[data[1] - 1];
+        memcpy(last, data, qMin(size, size_t(HID_REPORT_SIZE)));
+        if (data[1] == HID_MOUSE_REPORT_ID) {
+            memset(last + 3, 0, HID_MOUSE_REPORT_SIZE - 3);
+        }
+    }
+
+    /**
+     * @brief Last report sent with an ID, in HIDP wire format
+     *
+     * Before the first one it is the report with nothing held.
+     *
+     * @return nullptr if the descriptor has no such report
+     */
+    const uint8_t *lastReport(uint8_t reportId) const
+    {
+        if (reportId == 0x00 || reportId > HID_MOUSE_REPORT_ID) {
+            return nullptr;
+        }
+        return m_lastReports[reportId - 1];
+    }
+
+    /**
+     * @brief Store the LED state, reporting whether it changed
+     */
+    InputResult updateLeds(int leds)
+    {
+        if (m_leds == leds) {
+            return InputHandled;
+        }
+        m_leds = leds;
+        return InputLedsChanged;
+    }
+
+    int m_leds;
+    uint8_t m_lastReports[HID_MOUSE_REPORT_ID][HID_REPORT_SIZE];  // By report ID - 1
+};
+
+#endif // HIDTRANSPORT_H
@@ -0,0 +1,640 @@
+#include "hidwriter.h"
+
+#include "hidtransport.h"
+#include "latencymonitor.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// A write taking longer than this means the host is not keeping up
+static const int64_t SLOW_WRITE_NS = 4000000;
+
+// Consecutive fast writes before the interval is shortened again
+static const int FAST_WRITES_TO_SPEED_UP = 32;
+
+// Smallest interval used once the host has pushed back
+static const int64_t MIN_BACKOFF_NS = 1000000;
+
+static const uint32_t HANGUP_EVENTS = EPOLLHUP | EPOLLERR | EPOLLRDHUP;
+
+static bool holdsKeys(uint8_t modifiers, const uint8_t *keys)
+{
+    if (modifiers) {
+        return true;
+    }
+    for (int i = 0; i < HID_REPORT_KEY_SLOTS; ++i) {
+        if (keys[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HidWriter::HidWriter(QObject *parent)
+    : QThread(parent)
+    , m_stopping(false)
+    , m_drainWanted(false)
+    , m_transportPending(false)
+    , m_pendingTransport(nullptr)
+    , m_pendingTransportId(0)
+    , m_transport(nullptr)
+    , m_transportId(0)
+    , m_blocked(false)
+    , m_leds(0)
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , m_timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK))
+    , m_hostReportKnown(false)
+    , m_latency(nullptr)
+    , m_intervalNs(2000000)
+    , m_minIntervalNs(500000)
+    , m_maxIntervalNs(30000000)
+    , m_pollIntervalNs(0)
+    , m_lastWriteNs(0)
+    , m_fastWrites(0)
+{
+    // Voices start released, whether or not the event loop comes up
+    clearVoices();
+    
+    if (m_epollFd < 0 || m_wakeFd < 0 || m_timerFd < 0) {
+        qWarning() << "Failed to set up HID writer event loop, falling back to polling";
+        return;
+    }
+    
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event);
+    event.data.fd = m_timerFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &event);
+}
+
+HidWriter::~HidWriter()
+{
+    stop();
+    
+    delete m_pendingTransport;
+    dropTransport();
+    
+    if (m_epollFd >= 0) {
+        ::close(m_epollFd);
+    }
+    if (m_wakeFd >= 0) {
+        ::close(m_wakeFd);
+    }
+    if (m_timerFd >= 0) {
+        ::close(m_timerFd);
+    }
+}
+
+bool HidWriter::enqueue(const HidReport &report)
+{
+    if (!m_queue.push(report)) {
+        return false;
+    }
+    
+    // Always wake: the writer may have drained the ring after we looked
+    // at it but before our push, and would then sleep past this deadline.
+    // Extra wake-ups only collapse into one eventfd count.
+    wake();
+    return true;
+}
+
+int HidWriter::queueSpace() const
+{
+    return static_cast<int>(QueueCapacity - m_queue.size());
+}
+
+void HidWriter::requestQueueSpace()
+{
+    m_drainWanted.store(true);
+    wake();
+}
+
+void HidWriter::setTransport(HidTransport *transport, int id)
+{
+    {
+        QMutexLocker locker(&m_transportMutex);
+        
+        // Handed over before but never picked up by the writer
+        delete m_pendingTransport;
+        
+        m_pendingTransport = transport;
+        m_pendingTransportId = id;
+        m_transportPending = true;
+    }
+    wake();
+}
+
+void HidWriter::setLatencyMonitor(LatencyMonitor *latency)
+{
+    m_latency = latency;
+}
+
+int HidWriter::reportIntervalUs() const
+{
+    return static_cast<int>(m_intervalNs.load() / 1000);
+}
+
+void HidWriter::setReportInterval(int intervalUs, int minIntervalUs, int maxIntervalUs)
+{
+    const int64_t minNs = static_cast<int64_t>(minIntervalUs) * 1000;
+    const int64_t maxNs = qMax(minNs, static_cast<int64_t>(maxIntervalUs) * 1000);
+    
+    m_minIntervalNs.store(minNs);
+    m_maxIntervalNs.store(maxNs);
+    m_intervalNs.store(qBound(minNs, static_cast<int64_t>(intervalUs) * 1000, maxNs));
+}
+
+void HidWriter::setPollInterval(int intervalUs)
+{
+    m_pollIntervalNs.store(static_cast<int64_t>(qMax(0, intervalUs)) * 1000);
+}
+
+void HidWriter::stop()
+{
+    if (!isRunning()) {
+        return;
+    }
+    
+    m_stopping.store(true);
+    wake();
+    wait();
+}
+
+void HidWriter::run()
+{
+    while (!m_stopping.load(std::memory_order_relaxed)) {
+        adoptPendingTransport();
+        drainQueue();
+        
+        // The queue was just emptied into the voices
+        if (m_drainWanted.load(std::memory_order_relaxed) && m_drainWanted.exchange(false)) {
+            emit queueDrained();
+        }
+        
+        const int voice = nextVoice();
+        if (voice < 0) {
+            waitForEvents(0);
+            continue;
+        }
+        const HidReport *report = &m_voices[voice].pending.first();
+        
+        if (!m_transport) {
+            // Nobody to send to - drop what is left of the queue
+            finishReport(voice);
+            continue;
+        }
+        
+        if (m_blocked) {
+            // Channel is full: sleep until epoll reports it writable
+            waitForEvents(0);
+            continue;
+        }
+        
+        if (isSuperseded(voice)) {
+            finishReport(voice);
+            continue;
+        }
+        
+        // Never faster than the host tolerates
+        const int64_t deadline = report->deadlineNs + m_voices[voice].slipNs;
+        const int64_t paced = qMax(deadline, m_lastWriteNs + m_intervalNs.load(std::memory_order_relaxed));
+        const int64_t now = monotonicNowNs();
+        if (paced > now) {
+            waitForEvents(paced);
+            continue;
+        }
+        
+        // Running late: carry the delay forward instead of bunching up
+        // the voice's following reports; other voices keep their timing
+        m_voices[voice].slipNs += now - deadline;
+        
+        uint8_t merged[HID_REPORT_SIZE];
+        const uint8_t *data = mergeVoices(voice, report->data, merged);
+        if (isUnchanged(data)) {
+            finishReport(voice);
+            continue;
+        }
+        
+        ssize_t written = m_transport->sendReport(data, hidReportSize(data));
+        const int error = errno;  // The clock and logging below may overwrite it
+        const int64_t finished = monotonicNowNs();
+        m_lastWriteNs = finished;
+        
+        if (written < 0 && (error == EAGAIN || error == EWOULDBLOCK)) {
+            // Host is not draining the channel; retry this report once
+            // the channel is writable again, and pace slower from then on
+            slowDown(m_intervalNs.load() * 2);
+            setWritableInterest(true);
+            continue;
+        }
+        
+        if (written < 0) {
+            qWarning() << "Failed to send HID report:" << strerror(error);
+            emit writeFailed(error);
+            m_hostReportKnown = false;
+        } else {
+            if (data[1] == HID_KEYBOARD_REPORT_ID) {
+                memcpy(m_hostReport, data, HID_REPORT_SIZE);
+                m_hostReportKnown = true;
+            }
+            
+            if (finished - now > SLOW_WRITE_NS) {
+                const int64_t interval = m_intervalNs.load();
+                slowDown(interval + interval / 2);
+            } else {
+                speedUp();
+            }
+            
+            if (m_latency) {
+                recordLatency(*report, paced, now, finished);
+            }
+        }
+        
+        finishReport(voice);
+    }
+}
+
+void HidWriter::drainQueue()
+{
+    while (const HidReport *report = m_queue.front()) {
+        const int voice = report->voice < HID_VOICES ? report->voice : 0;
+        if (report->flags & HidReport::Cancel) {
+            cancelVoice(voice);
+        } else {
+            m_voices[voice].pending.append(*report);
+        }
+        m_queue.pop();
+    }
+}
+
+void HidWriter::cancelVoice(int voice)
+{
+    Voice &entry = m_voices[voice];
+    int finished = 0;
+    for (const HidReport &report : entry.pending) {
+        if (report.flags & HidReport::MacroEnd) {
+            ++finished;
+        }
+    }
+    entry.pending.clear();
+    entry.slipNs = 0;
+    
+    // Keys the voice pressed must not stay down on the host
+    if (holdsKeys(entry.modifiers, entry.keys)) {
+        entry.pending.append(makeKeyboardReport(0x00, 0x00, monotonicNowNs(), voice));
+    }
+    if (entry.usage) {
+        HidReport release = makeKeyboardReport(0x00, 0x00, monotonicNowNs(), voice);
+        buildConsumerReport(release.data, 0);
+        entry.pending.append(release);
+    }
+    if (entry.buttons) {
+        HidReport release = makeKeyboardReport(0x00, 0x00, monotonicNowNs(), voice);
+        buildMouseReport(release.data, 0x00, 0, 0, 0, 0);
+        entry.pending.append(release);
+    }
+    
+    for (int i = 0; i < finished; ++i) {
+        emit macroFinished(voice);
+    }
+}
+
+int HidWriter::nextVoice() const
+{
+    int next = -1;
+    int64_t nextDeadline = 0;
+    for (int voice = 0; voice < HID_VOICES; ++voice) {
+        const Voice &entry = m_voices[voice];
+        if (entry.pending.isEmpty()) {
+            continue;
+        }
+        const int64_t deadline = entry.pending.first().deadlineNs + entry.slipNs;
+        if (next < 0 || deadline < nextDeadline) {
+            next = voice;
+            nextDeadline = deadline;
+        }
+    }
+    return next;
+}
+
+bool HidWriter::isSuperseded(int voice) const
+{
+    const QList<HidReport> &pending = m_voices[voice].pending;
+    const int64_t pollNs = m_pollIntervalNs.load(std::memory_order_relaxed);
+    if (pollNs <= 0 || pending.size() < 2) {
+        return false;
+    }
+    
+    const HidReport &report = pending.at(0);
+    const HidReport &next = pending.at(1);
+    if (report.data[1] != HID_KEYBOARD_REPORT_ID || next.data[1] != HID_KEYBOARD_REPORT_ID
+        || (report.flags & HidReport::PressStart)
+        || next.deadlineNs - report.deadlineNs > pollNs) {
+        return false;
+    }
+    
+    // Compare the voice's state before (P), in (R) and after (N) the
+    // report. A modifier set in R alone would never be seen; one let go in
+    // R and set again in N may bounce, as it does between typed capitals.
+    const Voice &entry = m_voices[voice];
+    const uint8_t *keys = report.data + 4;
+    const uint8_t *nextKeys = next.data + 4;
+    if (report.data[2] & ~entry.modifiers & ~next.data[2]) {
+        return false;
+    }
+    
+    for (int i = 0; i < HID_REPORT_KEY_SLOTS; ++i) {
+        // A key pressed in R would go down together with N's, or not at all
+        if (keys[i] && !memchr(entry.keys, keys[i], HID_REPORT_KEY_SLOTS)) {
+            return false;
+        }
+        // A key let go in R and pressed again in N would not repeat
+        const uint8_t held = entry.keys[i];
+        if (held && !memchr(keys, held, HID_REPORT_KEY_SLOTS)
+            && memchr(nextKeys, held, HID_REPORT_KEY_SLOTS)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HidWriter::isUnchanged(const uint8_t *data) const
+{
+    return m_hostReportKnown && data[1] == HID_KEYBOARD_REPORT_ID
+        && memcmp(m_hostReport, data, HID_REPORT_SIZE) == 0;
+}
+
+const uint8_t *HidWriter::mergeVoices(int voice, const uint8_t *data, uint8_t *merged)
+{
+    Voice &own = m_voices[voice];
+    if (data[1] == HID_CONSUMER_REPORT_ID) {
+        own.usage = static_cast<uint16_t>(data[2] | (data[3] << 8));
+        return data;
+    }
+    if (data[1] == HID_MOUSE_REPORT_ID) {
+        own.buttons = data[2];
+        return data;
+    }
+    if (data[1] != HID_KEYBOARD_REPORT_ID) {
+        return data;
+    }
+    
+    own.modifiers = data[2];
+    memcpy(own.keys, data + 4, HID_REPORT_KEY_SLOTS);
+    
+    // The usual case: nothing else is held, send the report as built
+    bool alone = true;
+    for (int other = 0; other < HID_VOICES && alone; ++other) {
+        alone = other == voice || !holdsKeys(m_voices[other].modifiers, m_voices[other].keys);
+    }
+    if (alone) {
+        return data;
+    }
+    
+    // Keys beyond the sixth are left out until a slot frees up
+    memcpy(merged, data, HID_REPORT_SIZE);
+    merged[2] = 0x00;
+    memset(merged + 4, 0, HID_REPORT_KEY_SLOTS);
+    int count = 0;
+    for (const Voice &entry : m_voices) {
+        merged[2] |= entry.modifiers;
+        for (uint8_t key : entry.keys) {
+            if (key && count < HID_REPORT_KEY_SLOTS && !memchr(merged + 4, key, count)) {
+                merged[4 + count++] = key;
+            }
+        }
+    }
+    return merged;
+}
+
+void HidWriter::clearVoices()
+{
+    for (Voice &entry : m_voices) {
+        entry.modifiers = 0;
+        memset(entry.keys, 0, sizeof(entry.keys));
+        entry.usage = 0;
+        entry.buttons = 0;
+        entry.slipNs = 0;
+    }
+}
+
+void HidWriter::finishReport(int voice)
+{
+    QList<HidReport> &pending = m_voices[voice].pending;
+    const bool macroEnd = pending.first().flags & HidReport::MacroEnd;
+    pending.removeFirst();
+    
+    // Idle: the voice's next burst starts on its own schedule
+    if (pending.isEmpty()) {
+        m_voices[voice].slipNs = 0;
+    }
+    if (macroEnd) {
+        emit macroFinished(voice);
+    }
+}
+
+void HidWriter::recordLatency(const HidReport &report, int64_t dueNs, int64_t startNs, int64_t finishedNs)
+{
+    m_latency->record(LatencyMonitor::Wakeup, startNs - dueNs);
+    m_latency->record(LatencyMonitor::Write, finishedNs - startNs);
+    
+    if (report.flags & HidReport::PressStart) {
+        const int64_t pressNs = m_latency->takePress();
+        if (pressNs > 0) {
+            m_latency->record(LatencyMonitor::Total, finishedNs - pressNs);
+        }
+    }
+}
+
+void HidWriter::adoptPendingTransport()
+{
+    HidTransport *transport;
+    int id;
+    {
+        QMutexLocker locker(&m_transportMutex);
+        if (!m_transportPending) {
+            return;
+        }
+        transport = m_pendingTransport;
+        id = m_pendingTransportId;
+        m_pendingTransport = nullptr;
+        m_transportPending = false;
+    }
+    
+    dropTransport();
+    m_transport = transport;
+    m_transportId = id;
+    m_lastWriteNs = 0;
+    m_hostReportKnown = false;
+    
+    if (!m_transport) {
+        return;
+    }
+    
+    if (m_transport->leds() != m_leds) {
+        m_leds = m_transport->leds();
+        emit ledsChanged(m_leds);
+    }
+    
+    if (m_epollFd < 0) {
+        return;
+    }
+    
+    for (int fd : m_transport->descriptors()) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void HidWriter::dropTransport()
+{
+    if (!m_transport) {
+        return;
+    }
+    
+    if (m_epollFd >= 0) {
+        for (int fd : m_transport->descriptors()) {
+            epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+    
+    delete m_transport;
+    m_transport = nullptr;
+    m_blocked = false;
+    m_hostReportKnown = false;
+    
+    // A new host starts with every key up
+    clearVoices();
+}
+
+void HidWriter::hangUp()
+{
+    qDebug() << "HID host hung up on" << m_transport->name();
+    dropTransport();
+    emit hostDisconnected(m_transportId);
+}
+
+void HidWriter::setWritableInterest(bool enabled)
+{
+    m_blocked = enabled;
+    
+    if (m_epollFd < 0 || !m_transport) {
+        return;
+    }
+    
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | (enabled ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = m_transport->reportFd();
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, event.data.fd, &event);
+}
+
+void HidWriter::slowDown(int64_t intervalNs)
+{
+    m_fastWrites = 0;
+    m_intervalNs.store(qMin(qMax(intervalNs, MIN_BACKOFF_NS), m_maxIntervalNs.load()));
+}
+
+void HidWriter::speedUp()
+{
+    if (++m_fastWrites < FAST_WRITES_TO_SPEED_UP) {
+        return;
+    }
+    
+    m_fastWrites = 0;
+    const int64_t interval = m_intervalNs.load();
+    m_intervalNs.store(qMax(interval - interval / 8, m_minIntervalNs.load()));
+}
+
+void HidWriter::wake()
+{
+    if (m_wakeFd < 0) {
+        return;
+    }
+    
+    uint64_t one = 1;
+    ssize_t ignored = ::write(m_wakeFd, &one, sizeof(one));
+    Q_UNUSED(ignored);
+}
+
+void HidWriter::waitForEvents(int64_t deadlineNs)
+{
+    struct timespec deadline;
+    deadline.tv_sec = deadlineNs / 1000000000LL;
+    deadline.tv_nsec = deadlineNs % 1000000000LL;
+    
+    if (m_epollFd < 0 || m_wakeFd < 0 || m_timerFd < 0) {
+        // Degraded mode: cannot be woken early, so sleep in short slices
+        if (deadlineNs <= 0) {
+            QThread::msleep(1);
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+        }
+        m_blocked = false;
+        return;
+    }
+    
+    // Arm the timer for the next deadline, or disarm it when idle
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    if (deadlineNs > 0) {
+        timer.it_value = deadline;
+    }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &timer, nullptr);
+    
+    struct epoll_event events[4];
+    const int count = epoll_wait(m_epollFd, events, 4, -1);
+    
+    for (int i = 0; i < count; ++i) {
+        const int fd = events[i].data.fd;
+        const uint32_t flags = events[i].events;
+        
+        if (fd == m_wakeFd || fd == m_timerFd) {
+            uint64_t value;
+            ssize_t ignored = ::read(fd, &value, sizeof(value));
+            Q_UNUSED(ignored);
+            continue;
+        }
+        
+        // A hang-up earlier in this batch may already have dropped it
+        if (!m_transport || !m_transport->descriptors().contains(fd)) {
+            continue;
+        }
+        
+        if (flags & HANGUP_EVENTS) {
+            hangUp();
+            continue;
+        }
+        
+        if ((flags & EPOLLOUT) && fd == m_transport->reportFd()) {
+            setWritableInterest(false);
+        }
+        
+        if (flags & EPOLLIN) {
+            switch (m_transport->handleInput(fd)) {
+            case HidTransport::InputLedsChanged:
+                m_leds = m_transport->leds();
+                emit ledsChanged(m_leds);
+                break;
+            case HidTransport::InputHungUp:
+                hangUp();
+                break;
+            case HidTransport::InputHandled:
+                break;
+            }
+        }
+    }
+}
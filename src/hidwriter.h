@@ -0,0 +1,204 @@
+#ifndef HIDWRITER_H
+#define HIDWRITER_H
+
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+#include <atomic>
+
+#include "hidreport.h"
+#include "spscring.h"
+
+class HidTransport;
+class LatencyMonitor;
+
+/**
+ * @brief HidWriter - Dedicated thread that drives the HID transport
+ *
+ * The writer owns the transport to the host. The GUI thread only builds reports
+ * and pushes them into a lock-free ring; the writer sleeps until each
+ * report's deadline and performs the write, so neither socket I/O nor
+ * key timing ever stalls the UI.
+ *
+ * Deadlines are absolute CLOCK_MONOTONIC times. The writer sleeps on a
+ * timerfd armed with the next deadline, so wake-ups are not rounded to
+ * milliseconds. When a write runs late, the remaining deadlines of the
+ * burst are shifted by the same amount to keep the spacing between
+ * reports intact.
+ *
+ * Reports are also paced by a minimum interval that adapts to the host:
+ * it grows when the channel pushes back (EAGAIN) or writes get slow and
+ * shrinks again after a run of fast writes, within the configured range.
+ *
+ * The transport's descriptors are non-blocking and multiplexed with
+ * epoll together with the wake-up eventfd and the timerfd. A full link
+ * parks the queue until it becomes writable again, host requests are
+ * handled by the transport in place, and a hang-up is reported at once.
+ *
+ * Each report belongs to a voice. The writer moves queued reports into
+ * per-voice lists and always sends the voice that is due first, so a
+ * macro started in parallel does not wait behind a long one. Keyboard
+ * state is kept per voice and the report sent is their merge: modifiers
+ * ORed, keys united into the six slots. A Cancel report drops what is
+ * still queued for its voice and releases the keys it holds.
+ *
+ * Consumer Control and mouse reports are sent as built rather than
+ * merged: the former holds a single usage, and the latter's movement is
+ * relative. A Cancel releases the voice's usage and buttons as well.
+ * Neither is ever skipped, as a repeated move or scroll still moves.
+ *
+ * Keyboard reports that would not change what the host sees are not
+ * written. A report is also skipped when the next one of its voice is
+ * due within the host's poll interval and makes it redundant: the host
+ * would likely never have seen it, and skipping it neither loses a
+ * press nor changes the order keys go down in.
+ */
+class HidWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit HidWriter(QObject *parent = nullptr);
+    ~HidWriter();
+
+    /**
+     * @brief Queue a report for sending (GUI thread only)
+     * @return false if the queue is full
+     */
+    bool enqueue(const HidReport &report);
+
+    /**
+     * @brief Reports that can still be queued (GUI thread only)
+     */
+    int queueSpace() const;
+
+    /**
+     * @brief Ask for queueDrained() once the writer has taken the queue over
+     */
+    void requestQueueSpace();
+
+    /**
+     * @brief Hand a transport over to the writer
+     *
+     * The writer takes ownership and deletes the previous transport on
+     * its own thread. Pass nullptr to detach; reports still queued are
+     * then discarded.
+     *
+     * @param id Reported by hostDisconnected() if this transport hangs up
+     */
+    void setTransport(HidTransport *transport, int id = 0);
+
+    /**
+     * @brief Record wake-up, write and press-to-report latency
+     *
+     * Must be set before the thread is started.
+     */
+    void setLatencyMonitor(LatencyMonitor *latency);
+
+    /**
+     * @brief Current minimum time between two reports, in microseconds
+     */
+    int reportIntervalUs() const;
+
+    /**
+     * @brief Set the starting interval and the range it may adapt within
+     */
+    void setReportInterval(int intervalUs, int minIntervalUs, int maxIntervalUs);
+
+    /**
+     * @brief Set how often the host polls for reports; 0 disables coalescing
+     */
+    void setPollInterval(int intervalUs);
+
+    /**
+     * @brief Stop the thread and wait for it to exit
+     */
+    void stop();
+
+signals:
+    void writeFailed(int errorCode);
+
+    /**
+     * @brief A MacroEnd report of the voice was sent, or dropped
+     *
+     * Emitted once per MacroEnd report, in queue order within the voice.
+     */
+    void macroFinished(int voice);
+
+    /**
+     * @brief The queue is empty again after requestQueueSpace()
+     */
+    void queueDrained();
+    /**
+     * @brief The host of the transport handed over with id hung up
+     */
+    void hostDisconnected(int id);
+    void ledsChanged(int leds);
+
+protected:
+    void run() override;
+
+private:
+    static const size_t QueueCapacity = 4096;
+
+    struct Voice {
+        QList<HidReport> pending;          // Due in order
+        uint8_t modifiers;                 // Keyboard state after its last sent report
+        uint8_t keys[HID_REPORT_KEY_SLOTS];
+        uint16_t usage;                    // Consumer Control usage it holds down
+        uint8_t buttons;                   // Mouse buttons it holds down
+        int64_t slipNs;                    // How late it runs; cleared when it goes idle
+    };
+
+    void drainQueue();
+    void cancelVoice(int voice);
+    int nextVoice() const;
+    bool isSuperseded(int voice) const;
+    bool isUnchanged(const uint8_t *data) const;
+    const uint8_t *mergeVoices(int voice, const uint8_t *data, uint8_t *merged);
+    void clearVoices();
+    void finishReport(int voice);
+    void adoptPendingTransport();
+    void dropTransport();
+    void hangUp();
+    void wake();
+    void waitForEvents(int64_t deadlineNs);
+    void setWritableInterest(bool enabled);
+    void recordLatency(const HidReport &report, int64_t dueNs, int64_t startNs, int64_t finishedNs);
+    void slowDown(int64_t intervalNs);
+    void speedUp();
+
+    SpscRing<HidReport, QueueCapacity> m_queue;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_drainWanted;
+    Voice m_voices[HID_VOICES];          // Owned by the writer thread
+
+    // Transport hand-over from the GUI thread; rare, so a mutex is fine
+    QMutex m_transportMutex;
+    bool m_transportPending;
+    HidTransport *m_pendingTransport;
+    int m_pendingTransportId;
+
+    // Owned by the writer thread
+    HidTransport *m_transport;
+    int m_transportId;
+    bool m_blocked;
+    int m_leds;
+    int m_epollFd;
+    int m_wakeFd;
+    int m_timerFd;
+    uint8_t m_hostReport[HID_REPORT_SIZE];  // Last keyboard report written
+    bool m_hostReportKnown;
+    LatencyMonitor *m_latency;
+
+    // Adaptive pacing; the range is set from the GUI thread
+    std::atomic<int64_t> m_intervalNs;
+    std::atomic<int64_t> m_minIntervalNs;
+    std::atomic<int64_t> m_maxIntervalNs;
+    std::atomic<int64_t> m_pollIntervalNs;
+    int64_t m_lastWriteNs;
+    int m_fastWrites;
+};
+
+#endif // HIDWRITER_H
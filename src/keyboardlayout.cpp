@@ -0,0 +1,221 @@
+#include "keyboardlayout.h"
+
+#include <atomic>
+
+typedef KeyboardLayout::AsciiTable AsciiTable;
+typedef KeyboardLayout::Mapping Mapping;
+
+static constexpr uint8_t SHIFT = 0x02;
+static constexpr uint8_t ALTGR = 0x40;      // Right Alt
+static constexpr uint8_t DEAD = KeyboardLayout::DeadKey;
+
+// Key codes of the keys outside the letter and digit blocks, named after
+// what they type on a US keyboard
+static constexpr uint8_t KEY_ENTER = 0x28;
+static constexpr uint8_t KEY_TAB = 0x2B;
+static constexpr uint8_t KEY_SPACE = 0x2C;
+static constexpr uint8_t KEY_MINUS = 0x2D;
+static constexpr uint8_t KEY_EQUAL = 0x2E;
+static constexpr uint8_t KEY_LEFT_BRACKET = 0x2F;
+static constexpr uint8_t KEY_RIGHT_BRACKET = 0x30;
+static constexpr uint8_t KEY_BACKSLASH = 0x31;
+static constexpr uint8_t KEY_NON_US_HASH = 0x32;      // Left of Enter on ISO keyboards
+static constexpr uint8_t KEY_SEMICOLON = 0x33;
+static constexpr uint8_t KEY_QUOTE = 0x34;
+static constexpr uint8_t KEY_GRAVE = 0x35;
+static constexpr uint8_t KEY_COMMA = 0x36;
+static constexpr uint8_t KEY_PERIOD = 0x37;
+static constexpr uint8_t KEY_SLASH = 0x38;
+static constexpr uint8_t KEY_NON_US_BACKSLASH = 0x64; // Right of left Shift on ISO keyboards
+
+static constexpr uint8_t letter(char c)
+{
+    return 0x04 + (c - 'a');
+}
+
+static constexpr uint8_t digit(char c)
+{
+    return c == '0' ? 0x27 : 0x1E + (c - '1');
+}
+
+static constexpr Mapping key(char16_t character, uint8_t keyCode, uint8_t modifiers = 0, uint8_t flags = 0)
+{
+    return Mapping{ character, { keyCode, modifiers, flags } };
+}
+
+static constexpr Mapping US_KEYS[] = {
+    key('\t', KEY_TAB), key('\n', KEY_ENTER), key('\r', KEY_ENTER), key(' ', KEY_SPACE),
+    key('!', digit('1'), SHIFT), key('@', digit('2'), SHIFT), key('#', digit('3'), SHIFT),
+    key('$', digit('4'), SHIFT), key('%', digit('5'), SHIFT), key('^', digit('6'), SHIFT),
+    key('&', digit('7'), SHIFT), key('*', digit('8'), SHIFT), key('(', digit('9'), SHIFT),
+    key(')', digit('0'), SHIFT),
+    key('-', KEY_MINUS), key('_', KEY_MINUS, SHIFT), key('=', KEY_EQUAL), key('+', KEY_EQUAL, SHIFT),
+    key('[', KEY_LEFT_BRACKET), key('{', KEY_LEFT_BRACKET, SHIFT),
+    key(']', KEY_RIGHT_BRACKET), key('}', KEY_RIGHT_BRACKET, SHIFT),
+    key('\\', KEY_BACKSLASH), key('|', KEY_BACKSLASH, SHIFT),
+    key(';', KEY_SEMICOLON), key(':', KEY_SEMICOLON, SHIFT),
+    key('\'', KEY_QUOTE), key('"', KEY_QUOTE, SHIFT), key('`', KEY_GRAVE), key('~', KEY_GRAVE, SHIFT),
+    key(',', KEY_COMMA), key('<', KEY_COMMA, SHIFT), key('.', KEY_PERIOD), key('>', KEY_PERIOD, SHIFT),
+    key('/', KEY_SLASH), key('?', KEY_SLASH, SHIFT)
+};
+
+static constexpr Mapping UK_KEYS[] = {
+    key('"', digit('2'), SHIFT), key('@', KEY_QUOTE, SHIFT),
+    key('#', KEY_NON_US_HASH), key('~', KEY_NON_US_HASH, SHIFT),
+    key('\\', KEY_NON_US_BACKSLASH), key('|', KEY_NON_US_BACKSLASH, SHIFT)
+};
+
+static constexpr Mapping UK_EXTRA[] = {
+    key(u'£', digit('3'), SHIFT), key(u'¬', KEY_GRAVE, SHIFT), key(u'€', digit('4'), ALTGR)
+};
+
+// QWERTZ
+static constexpr Mapping DE_KEYS[] = {
+    key('y', letter('z')), key('Y', letter('z'), SHIFT), key('z', letter('y')), key('Z', letter('y'), SHIFT),
+    key('"', digit('2'), SHIFT), key('&', digit('6'), SHIFT), key('/', digit('7'), SHIFT),
+    key('(', digit('8'), SHIFT), key(')', digit('9'), SHIFT), key('=', digit('0'), SHIFT),
+    key('{', digit('7'), ALTGR), key('[', digit('8'), ALTGR), key(']', digit('9'), ALTGR),
+    key('}', digit('0'), ALTGR), key('@', letter('q'), ALTGR),
+    key('?', KEY_MINUS, SHIFT), key('\\', KEY_MINUS, ALTGR), key('`', KEY_EQUAL, SHIFT, DEAD),
+    key('+', KEY_RIGHT_BRACKET), key('*', KEY_RIGHT_BRACKET, SHIFT), key('~', KEY_RIGHT_BRACKET, ALTGR),
+    key('#', KEY_NON_US_HASH), key('\'', KEY_NON_US_HASH, SHIFT), key('^', KEY_GRAVE, 0, DEAD),
+    key(',', KEY_COMMA), key(';', KEY_COMMA, SHIFT), key('.', KEY_PERIOD), key(':', KEY_PERIOD, SHIFT),
+    key('-', KEY_SLASH), key('_', KEY_SLASH, SHIFT),
+    key('<', KEY_NON_US_BACKSLASH), key('>', KEY_NON_US_BACKSLASH, SHIFT), key('|', KEY_NON_US_BACKSLASH, ALTGR)
+};
+
+static constexpr Mapping DE_EXTRA[] = {
+    key(u'ä', KEY_QUOTE), key(u'Ä', KEY_QUOTE, SHIFT), key(u'ö', KEY_SEMICOLON), key(u'Ö', KEY_SEMICOLON, SHIFT),
+    key(u'ü', KEY_LEFT_BRACKET), key(u'Ü', KEY_LEFT_BRACKET, SHIFT), key(u'ß', KEY_MINUS),
+    key(u'§', digit('3'), SHIFT), key(u'°', KEY_GRAVE, SHIFT), key(u'²', digit('2'), ALTGR),
+    key(u'³', digit('3'), ALTGR), key(u'€', letter('e'), ALTGR), key(u'µ', letter('m'), ALTGR),
+    key(u'´', KEY_EQUAL, 0, DEAD)
+};
+
+// AZERTY: digits are shifted, the unshifted number row types symbols
+static constexpr Mapping FR_KEYS[] = {
+    key('a', letter('q')), key('A', letter('q'), SHIFT), key('q', letter('a')), key('Q', letter('a'), SHIFT),
+    key('z', letter('w')), key('Z', letter('w'), SHIFT), key('w', letter('z')), key('W', letter('z'), SHIFT),
+    key('m', KEY_SEMICOLON), key('M', KEY_SEMICOLON, SHIFT),
+    key('1', digit('1'), SHIFT), key('2', digit('2'), SHIFT), key('3', digit('3'), SHIFT),
+    key('4', digit('4'), SHIFT), key('5', digit('5'), SHIFT), key('6', digit('6'), SHIFT),
+    key('7', digit('7'), SHIFT), key('8', digit('8'), SHIFT), key('9', digit('9'), SHIFT),
+    key('0', digit('0'), SHIFT),
+    key('&', digit('1')), key('"', digit('3')), key('\'', digit('4')), key('(', digit('5')),
+    key('-', digit('6')), key('_', digit('8')),
+    key('~', digit('2'), ALTGR, DEAD), key('#', digit('3'), ALTGR), key('{', digit('4'), ALTGR),
+    key('[', digit('5'), ALTGR), key('|', digit('6'), ALTGR), key('`', digit('7'), ALTGR, DEAD),
+    key('\\', digit('8'), ALTGR), key('^', digit('9'), ALTGR), key('@', digit('0'), ALTGR),
+    key(')', KEY_MINUS), key(']', KEY_MINUS, ALTGR), key('=', KEY_EQUAL), key('+', KEY_EQUAL, SHIFT),
+    key('}', KEY_EQUAL, ALTGR), key('$', KEY_RIGHT_BRACKET), key('*', KEY_NON_US_HASH),
+    key('%', KEY_QUOTE, SHIFT), key(',', letter('m')), key('?', letter('m'), SHIFT),
+    key(';', KEY_COMMA), key('.', KEY_COMMA, SHIFT), key(':', KEY_PERIOD), key('/', KEY_PERIOD, SHIFT),
+    key('!', KEY_SLASH), key('<', KEY_NON_US_BACKSLASH), key('>', KEY_NON_US_BACKSLASH, SHIFT)
+};
+
+static constexpr Mapping FR_EXTRA[] = {
+    key(u'é', digit('2')), key(u'è', digit('7')), key(u'ç', digit('9')), key(u'à', digit('0')),
+    key(u'ù', KEY_QUOTE), key(u'°', KEY_MINUS, SHIFT), key(u'£', KEY_RIGHT_BRACKET, SHIFT),
+    key(u'µ', KEY_NON_US_HASH, SHIFT), key(u'§', KEY_SLASH, SHIFT), key(u'²', KEY_GRAVE),
+    key(u'€', letter('e'), ALTGR), key(u'¨', KEY_LEFT_BRACKET, SHIFT, DEAD)
+};
+
+template <size_t N>
+static constexpr AsciiTable withKeys(AsciiTable table, const Mapping (&keys)[N])
+{
+    for (const Mapping &mapping : keys) {
+        table[mapping.character] = mapping.stroke;
+    }
+    return table;
+}
+
+static constexpr AsciiTable usTable()
+{
+    AsciiTable table = {};
+    for (char c = 'a'; c <= 'z'; ++c) {
+        table[c] = { letter(c), 0, 0 };
+        table[c - 'a' + 'A'] = { letter(c), SHIFT, 0 };
+    }
+    for (char c = '0'; c <= '9'; ++c) {
+        table[c] = { digit(c), 0, 0 };
+    }
+    return withKeys(table, US_KEYS);
+}
+
+static constexpr AsciiTable US_ASCII = usTable();
+static constexpr AsciiTable UK_ASCII = withKeys(US_ASCII, UK_KEYS);
+static constexpr AsciiTable DE_ASCII = withKeys(US_ASCII, DE_KEYS);
+static constexpr AsciiTable FR_ASCII = withKeys(US_ASCII, FR_KEYS);
+
+static_assert(US_ASCII['?'].keyCode == KEY_SLASH && US_ASCII['?'].modifiers == SHIFT, "US table");
+static_assert(DE_ASCII['z'].keyCode == letter('y') && DE_ASCII['@'].modifiers == ALTGR, "DE table");
+static_assert(FR_ASCII['1'].modifiers == SHIFT && FR_ASCII['a'].keyCode == letter('q'), "FR table");
+
+// In Id order
+static constexpr KeyboardLayout LAYOUTS[] = {
+    KeyboardLayout(KeyboardLayout::Us, "us", US_ASCII, nullptr, 0),
+    KeyboardLayout(KeyboardLayout::Uk, "uk", UK_ASCII, UK_EXTRA, sizeof(UK_EXTRA) / sizeof(Mapping)),
+    KeyboardLayout(KeyboardLayout::De, "de", DE_ASCII, DE_EXTRA, sizeof(DE_EXTRA) / sizeof(Mapping)),
+    KeyboardLayout(KeyboardLayout::Fr, "fr", FR_ASCII, FR_EXTRA, sizeof(FR_EXTRA) / sizeof(Mapping))
+};
+
+static std::atomic<const KeyboardLayout *> s_current(&LAYOUTS[KeyboardLayout::Us]);
+
+const KeyboardLayout &KeyboardLayout::layout(Id id)
+{
+    return LAYOUTS[id];
+}
+
+const KeyboardLayout *KeyboardLayout::find(const QString &name)
+{
+    for (const KeyboardLayout &layout : LAYOUTS) {
+        if (name.compare(QLatin1String(layout.m_name), Qt::CaseInsensitive) == 0) {
+            return &layout;
+        }
+    }
+    return nullptr;
+}
+
+QStringList KeyboardLayout::names()
+{
+    QStringList names;
+    for (const KeyboardLayout &layout : LAYOUTS) {
+        names.append(layout.name());
+    }
+    return names;
+}
+
+const KeyboardLayout &KeyboardLayout::current()
+{
+    return *s_current.load(std::memory_order_acquire);
+}
+
+void KeyboardLayout::setCurrent(const KeyboardLayout &layout)
+{
+    s_current.store(&layout, std::memory_order_release);
+}
+
+KeyboardLayout::Id KeyboardLayout::id() const
+{
+    return m_id;
+}
+
+QString KeyboardLayout::name() const
+{
+    return QLatin1String(m_name);
+}
+
+KeyboardLayout::KeyStroke KeyboardLayout::keyStroke(QChar c) const
+{
+    const char16_t character = c.unicode();
+    if (character < m_ascii.size()) {
+        return m_ascii[character];
+    }
+    
+    for (size_t i = 0; i < m_extraCount; ++i) {
+        if (m_extra[i].character == character) {
+            return m_extra[i].stroke;
+        }
+    }
+    return KeyStroke{ 0x00, 0x00, NoFlags };
+}
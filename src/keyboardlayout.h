@@ -0,0 +1,112 @@
+#ifndef KEYBOARDLAYOUT_H
+#define KEYBOARDLAYOUT_H
+
+#include <QChar>
+#include <QString>
+#include <QStringList>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief KeyboardLayout - How the host turns key codes into characters
+ *
+ * A HID keyboard sends key positions, not characters; what a position
+ * types depends on the layout the host has selected. Typing text means
+ * looking up, for each character, the key and modifiers that produce it
+ * on that layout.
+ *
+ * Every layout has a table of all 128 ASCII characters, generated at
+ * compile time from the US layout plus the keys that differ, so
+ * encoding a character is one array lookup. A short list per layout
+ * adds the non-ASCII characters printed on its keys (£, ä, é, ...).
+ * Characters a layout cannot type map to key code 0.
+ *
+ * Some characters are typed with a dead key (^ on German and French
+ * keyboards), which only produces the character once it is followed
+ * by Space; those strokes are flagged with DeadKey.
+ */
+class KeyboardLayout
+{
+public:
+    enum Id : uint8_t {
+        Us,
+        Uk,
+        De,
+        Fr
+    };
+
+    enum Flag : uint8_t {
+        NoFlags = 0x00,
+        DeadKey = 0x01      // Follow with Space to get the character
+    };
+
+    struct KeyStroke {
+        uint8_t keyCode;
+        uint8_t modifiers;
+        uint8_t flags;
+    };
+
+    struct Mapping {
+        char16_t character;
+        KeyStroke stroke;
+    };
+
+    typedef std::array<KeyStroke, 128> AsciiTable;
+
+    /**
+     * @brief Built-in layout by id
+     */
+    static const KeyboardLayout &layout(Id id);
+
+    /**
+     * @brief Built-in layout by name ("us", "uk", "de", "fr")
+     * @return nullptr if there is no such layout
+     */
+    static const KeyboardLayout *find(const QString &name);
+
+    /**
+     * @brief Names of the built-in layouts
+     */
+    static QStringList names();
+
+    /**
+     * @brief Layout text is compiled for; US until set
+     */
+    static const KeyboardLayout &current();
+
+    /**
+     * @brief Change the layout text is compiled for (any thread)
+     *
+     * Programs compiled before keep typing for the old layout.
+     */
+    static void setCurrent(const KeyboardLayout &layout);
+
+    constexpr KeyboardLayout(Id id, const char *name, const AsciiTable &ascii,
+                             const Mapping *extra, size_t extraCount)
+        : m_id(id)
+        , m_name(name)
+        , m_ascii(ascii)
+        , m_extra(extra)
+        , m_extraCount(extraCount)
+    {
+    }
+
+    Id id() const;
+    QString name() const;
+
+    /**
+     * @brief Key and modifiers that type a character
+     */
+    KeyStroke keyStroke(QChar c) const;
+
+private:
+    Id m_id;
+    const char *m_name;
+    const AsciiTable &m_ascii;
+    const Mapping *m_extra;
+    size_t m_extraCount;
+};
+
+#endif // KEYBOARDLAYOUT_H
@@ -0,0 +1,102 @@
+#include "keyboardstate.h"
+
+#include <cstring>
+
+KeyboardState::KeyboardState()
+    : m_modifiers(0)
+    , m_keyCount(0)
+{
+    memset(m_keys, 0, sizeof(m_keys));
+}
+
+uint8_t KeyboardState::modifiers() const
+{
+    return m_modifiers;
+}
+
+int KeyboardState::keyCount() const
+{
+    return m_keyCount;
+}
+
+bool KeyboardState::isPressed(uint8_t keyCode) const
+{
+    return keyCode != 0x00 && memchr(m_keys, keyCode, m_keyCount) != nullptr;
+}
+
+bool KeyboardState::isReleased() const
+{
+    return m_modifiers == 0 && m_keyCount == 0;
+}
+
+uint8_t KeyboardState::key(int index) const
+{
+    return index >= 0 && index < m_keyCount ? m_keys[index] : 0x00;
+}
+
+int KeyboardState::freeSlots() const
+{
+    return HID_REPORT_KEY_SLOTS - m_keyCount;
+}
+
+bool KeyboardState::press(uint8_t keyCode, uint8_t modifiers)
+{
+    return press(&keyCode, 1, modifiers);
+}
+
+bool KeyboardState::press(const uint8_t *keyCodes, int count, uint8_t modifiers)
+{
+    bool changed = (m_modifiers | modifiers) != m_modifiers;
+    m_modifiers |= modifiers;
+    
+    for (int i = 0; i < count; ++i) {
+        const uint8_t keyCode = keyCodes[i];
+        if (keyCode == 0x00 || isPressed(keyCode) || m_keyCount == HID_REPORT_KEY_SLOTS) {
+            continue;
+        }
+        m_keys[m_keyCount++] = keyCode;
+        changed = true;
+    }
+    return changed;
+}
+
+bool KeyboardState::release(uint8_t keyCode, uint8_t modifiers)
+{
+    return release(&keyCode, 1, modifiers);
+}
+
+bool KeyboardState::release(const uint8_t *keyCodes, int count, uint8_t modifiers)
+{
+    bool changed = (m_modifiers & modifiers) != 0;
+    m_modifiers &= ~modifiers;
+    
+    for (int i = 0; i < count; ++i) {
+        uint8_t *slot = static_cast<uint8_t *>(memchr(m_keys, keyCodes[i], m_keyCount));
+        if (keyCodes[i] == 0x00 || !slot) {
+            continue;
+        }
+        
+        // Keep the slots packed in press order
+        memmove(slot, slot + 1, m_keys + m_keyCount - slot - 1);
+        m_keys[--m_keyCount] = 0x00;
+        changed = true;
+    }
+    return changed;
+}
+
+bool KeyboardState::releaseAll()
+{
+    if (isReleased()) {
+        return false;
+    }
+    
+    m_modifiers = 0;
+    memset(m_keys, 0, sizeof(m_keys));
+    m_keyCount = 0;
+    return true;
+}
+
+void KeyboardState::writeReport(uint8_t *data) const
+{
+    buildKeyboardReport(data, m_modifiers, m_keys, m_keyCount);
+}
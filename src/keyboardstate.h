@@ -0,0 +1,85 @@
+#ifndef KEYBOARDSTATE_H
+#define KEYBOARDSTATE_H
+
+#include <cstdint>
+
+#include "hidreport.h"
+
+/**
+ * @brief KeyboardState - Keys a keyboard report says are down
+ *
+ * Tracks the eight modifier bits and the six key slots of a boot
+ * keyboard report. Every operation tells whether it changed anything,
+ * so callers only send a report when the host would see a difference.
+ * Keys keep the order they were pressed in; releasing one closes the gap.
+ */
+class KeyboardState
+{
+public:
+    KeyboardState();
+
+    uint8_t modifiers() const;
+    int keyCount() const;
+    bool isPressed(uint8_t keyCode) const;
+
+    /**
+     * @brief Key in slot index, counting in press order from 0
+     */
+    uint8_t key(int index) const;
+
+    /**
+     * @brief True if neither a modifier nor a key is down
+     */
+    bool isReleased() const;
+
+    /**
+     * @brief Key slots not in use
+     */
+    int freeSlots() const;
+
+    /**
+     * @brief Press modifiers and a key; 0 presses modifiers only
+     * @return true if the state changed
+     */
+    bool press(uint8_t keyCode, uint8_t modifiers = 0);
+
+    /**
+     * @brief Press modifiers and several keys at once
+     *
+     * Keys that are already down are skipped, as are keys that find no
+     * free slot.
+     *
+     * @return true if the state changed
+     */
+    bool press(const uint8_t *keyCodes, int count, uint8_t modifiers = 0);
+
+    /**
+     * @brief Release modifiers and a key; 0 releases modifiers only
+     * @return true if the state changed
+     */
+    bool release(uint8_t keyCode, uint8_t modifiers = 0);
+
+    /**
+     * @brief Release modifiers and several keys at once
+     * @return true if the state changed
+     */
+    bool release(const uint8_t *keyCodes, int count, uint8_t modifiers = 0);
+
+    /**
+     * @brief Release everything
+     * @return true if anything was down
+     */
+    bool releaseAll();
+
+    /**
+     * @brief Fill a keyboard input report with the current state
+     */
+    void writeReport(uint8_t *data) const;
+
+private:
+    uint8_t m_modifiers;
+    uint8_t m_keys[HID_REPORT_KEY_SLOTS];
+    int m_keyCount;
+};
+
+#endif // KEYBOARDSTATE_H
@@ -0,0 +1,167 @@
+#include "l2captransport.h"
+
+#include <QDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// HIDP transaction types (high nibble of the header byte)
+static const uint8_t HIDP_HANDSHAKE = 0x00;
+static const uint8_t HIDP_HID_CONTROL = 0x10;
+static const uint8_t HIDP_GET_REPORT = 0x40;
+static const uint8_t HIDP_SET_REPORT = 0x50;
+static const uint8_t HIDP_GET_PROTOCOL = 0x60;
+static const uint8_t HIDP_SET_PROTOCOL = 0x70;
+static const uint8_t HIDP_DATA = 0xA0;
+
+// HIDP parameters (low nibble of the header byte)
+static const uint8_t HIDP_HANDSHAKE_SUCCESSFUL = 0x00;
+static const uint8_t HIDP_HANDSHAKE_ERR_INVALID_REPORT_ID = 0x02;
+static const uint8_t HIDP_HANDSHAKE_ERR_UNSUPPORTED_REQUEST = 0x03;
+static const uint8_t HIDP_CONTROL_VIRTUAL_CABLE_UNPLUG = 0x05;
+static const uint8_t HIDP_REPORT_TYPE_MASK = 0x03;
+static const uint8_t HIDP_REPORT_TYPE_INPUT = 0x01;
+static const uint8_t HIDP_REPORT_TYPE_OUTPUT = 0x02;
+static const uint8_t HIDP_PROTOCOL_REPORT = 0x01;
+
+L2capTransport::L2capTransport(int controlFd, int interruptFd)
+    : m_controlFd(controlFd)
+    , m_interruptFd(interruptFd)
+{
+    for (int fd : { m_controlFd, m_interruptFd }) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+L2capTransport::~L2capTransport()
+{
+    ::close(m_controlFd);
+    ::close(m_interruptFd);
+}
+
+QString L2capTransport::name() const
+{
+    return QStringLiteral("bluetooth");
+}
+
+QList<int> L2capTransport::descriptors() const
+{
+    return { m_controlFd, m_interruptFd };
+}
+
+int L2capTransport::reportFd() const
+{
+    return m_interruptFd;
+}
+
+ssize_t L2capTransport::sendReport(const uint8_t *data, size_t size)
+{
+    ssize_t written = ::send(m_interruptFd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (written >= 0) {
+        rememberReport(data, size);
+    }
+    return written;
+}
+
+HidTransport::InputResult L2capTransport::handleInput(int fd)
+{
+    return fd == m_controlFd ? handleControlMessage() : handleInterruptMessage();
+}
+
+HidTransport::InputResult L2capTransport::handleControlMessage()
+{
+    uint8_t message[64];
+    ssize_t size = ::recv(m_controlFd, message, sizeof(message), MSG_DONTWAIT);
+    
+    if (size == 0) {
+        return InputHungUp;
+    }
+    if (size < 0) {
+        return InputHandled;
+    }
+    
+    const uint8_t type = message[0] & 0xF0;
+    const uint8_t param = message[0] & 0x0F;
+    InputResult result = InputHandled;
+    
+    switch (type) {
+    case HIDP_HID_CONTROL:
+        // No reply expected; an unplug means the host dropped us
+        return param == HIDP_CONTROL_VIRTUAL_CABLE_UNPLUG ? InputHungUp : InputHandled;
+    
+    case HIDP_SET_REPORT: {
+        // Output report carries the keyboard LEDs (Num/Caps/Scroll Lock)
+        if ((param & HIDP_REPORT_TYPE_MASK) == HIDP_REPORT_TYPE_OUTPUT
+            && size >= 3 && message[1] == HID_KEYBOARD_REPORT_ID) {
+            result = updateLeds(message[2]);
+        }
+        const uint8_t reply = HIDP_HANDSHAKE | HIDP_HANDSHAKE_SUCCESSFUL;
+        sendControl(&reply, 1);
+        return result;
+    }
+    
+    case HIDP_GET_REPORT: {
+        if ((param & HIDP_REPORT_TYPE_MASK) != HIDP_REPORT_TYPE_INPUT) {
+            break;
+        }
+        
+        // Our reports carry IDs, so the host names the one it wants; the
+        // last report sent with that ID is its current state
+        const uint8_t *report = size >= 2 ? lastReport(message[1]) : nullptr;
+        if (!report) {
+            const uint8_t reply = HIDP_HANDSHAKE | HIDP_HANDSHAKE_ERR_INVALID_REPORT_ID;
+            sendControl(&reply, 1);
+            return InputHandled;
+        }
+        sendControl(report, hidReportSize(report));
+        return InputHandled;
+    }
+    
+    case HIDP_GET_PROTOCOL: {
+        const uint8_t reply[2] = { HIDP_DATA, HIDP_PROTOCOL_REPORT };
+        sendControl(reply, sizeof(reply));
+        return InputHandled;
+    }
+    
+    case HIDP_SET_PROTOCOL:
+        // Reports always carry an ID, so boot protocol cannot be honoured
+        if ((param & HIDP_PROTOCOL_REPORT) == HIDP_PROTOCOL_REPORT) {
+            const uint8_t reply = HIDP_HANDSHAKE | HIDP_HANDSHAKE_SUCCESSFUL;
+            sendControl(&reply, 1);
+            return InputHandled;
+        }
+        break;
+    
+    default:
+        break;
+    }
+    
+    const uint8_t reply = HIDP_HANDSHAKE | HIDP_HANDSHAKE_ERR_UNSUPPORTED_REQUEST;
+    sendControl(&reply, 1);
+    return InputHandled;
+}
+
+HidTransport::InputResult L2capTransport::handleInterruptMessage()
+{
+    uint8_t message[64];
+    ssize_t size = ::recv(m_interruptFd, message, sizeof(message), MSG_DONTWAIT);
+    
+    if (size == 0) {
+        return InputHungUp;
+    }
+    
+    // Hosts may also send the LED output report on the interrupt channel
+    if (size >= 3 && message[0] == (HIDP_DATA | HIDP_REPORT_TYPE_OUTPUT)
+        && message[1] == HID_KEYBOARD_REPORT_ID) {
+        return updateLeds(message[2]);
+    }
+    return InputHandled;
+}
+
+void L2capTransport::sendControl(const uint8_t *data, size_t size)
+{
+    if (::send(m_controlFd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        qWarning() << "Failed to answer HID control request";
+    }
+}
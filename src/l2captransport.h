@@ -0,0 +1,37 @@
+#ifndef L2CAPTRANSPORT_H
+#define L2CAPTRANSPORT_H
+
+#include "hidtransport.h"
+
+/**
+ * @brief L2capTransport - Bluetooth HID over the two HIDP L2CAP channels
+ *
+ * Reports go out on the interrupt channel. Requests from the host on the
+ * control channel (SET_REPORT, GET_REPORT, protocol changes) are answered
+ * in place; a virtual cable unplug or a closed channel hangs up.
+ */
+class L2capTransport : public HidTransport
+{
+public:
+    /**
+     * @brief Take ownership of an accepted pair of HIDP channels
+     */
+    L2capTransport(int controlFd, int interruptFd);
+    ~L2capTransport();
+
+    QString name() const override;
+    QList<int> descriptors() const override;
+    int reportFd() const override;
+    ssize_t sendReport(const uint8_t *data, size_t size) override;
+    InputResult handleInput(int fd) override;
+
+private:
+    InputResult handleControlMessage();
+    InputResult handleInterruptMessage();
+    void sendControl(const uint8_t *data, size_t size);
+
+    int m_controlFd;
+    int m_interruptFd;
+};
+
+#endif // L2CAPTRANSPORT_H
@@ -0,0 +1,104 @@
+#include "latencyhistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+    : m_total(0)
+    , m_max(0)
+{
+    for (std::atomic<uint64_t> &count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(int64_t valueNs)
+{
+    const uint64_t value = valueNs > 0 ? static_cast<uint64_t>(valueNs) : 0;
+    
+    m_counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_total.fetch_add(1, std::memory_order_relaxed);
+    
+    int64_t max = m_max.load(std::memory_order_relaxed);
+    while (static_cast<int64_t>(value) > max
+           && !m_max.compare_exchange_weak(max, static_cast<int64_t>(value), std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return m_total.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::maxNs() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::percentileNs(double percentile) const
+{
+    const uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    
+    // Rank of the requested value, 1-based
+    const double share = qBound(0.0, percentile, 100.0) / 100.0;
+    const uint64_t rank = qMax<uint64_t>(1, static_cast<uint64_t>(share * total + 0.5));
+    
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // Never report more than what was actually seen
+            return qMin(bucketUpperBound(i), maxNs());
+        }
+    }
+    return maxNs();
+}
+
+QList<QPair<int64_t, uint64_t>> LatencyHistogram::buckets() const
+{
+    QList<QPair<int64_t, uint64_t>> result;
+    for (int i = 0; i < BucketCount; ++i) {
+        const uint64_t count = m_counts[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            result.append(qMakePair(bucketUpperBound(i), count));
+        }
+    }
+    return result;
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<uint64_t> &count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_total.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+    // Small values get a bucket each
+    if (value < 2 * SubBucketCount) {
+        return static_cast<int>(value);
+    }
+    
+    // Otherwise keep the top SubBucketBits + 1 bits of the value
+    const int msb = 63 - __builtin_clzll(value);
+    const int shift = msb - SubBucketBits;
+    const int subBucket = static_cast<int>(value >> shift) - SubBucketCount;
+    return (shift + 1) * SubBucketCount + subBucket;
+}
+
+int64_t LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < 2 * SubBucketCount) {
+        return index;
+    }
+    
+    const int shift = index / SubBucketCount - 1;
+    const uint64_t top = static_cast<uint64_t>(index % SubBucketCount + SubBucketCount) + 1;
+    if (shift >= 63 - SubBucketBits) {
+        return INT64_MAX;
+    }
+    return static_cast<int64_t>((top << shift) - 1);
+}
@@ -0,0 +1,69 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QList>
+#include <QPair>
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief LatencyHistogram - Lock-free log-linear histogram of durations
+ *
+ * HDR-style bucketing: every power of two is split into 16 linear
+ * sub-buckets, so any recorded value is known to within about 6% from a
+ * few nanoseconds up to minutes, in a fixed table of about 8 KB.
+ *
+ * record() is lock-free and may be called from any thread; readers see
+ * a consistent-enough snapshot for statistics without stopping writers.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /**
+     * @brief Add one duration in nanoseconds (negative counts as 0)
+     */
+    void record(int64_t valueNs);
+
+    /**
+     * @brief Number of recorded values
+     */
+    uint64_t count() const;
+
+    /**
+     * @brief Largest recorded value, exact
+     */
+    int64_t maxNs() const;
+
+    /**
+     * @brief Value at or below which the given share of values fall
+     * @param percentile 0 to 100
+     */
+    int64_t percentileNs(double percentile) const;
+
+    /**
+     * @brief Non-empty buckets as (upper bound in ns, count), ascending
+     */
+    QList<QPair<int64_t, uint64_t>> buckets() const;
+
+    /**
+     * @brief Drop all recorded values
+     */
+    void reset();
+
+private:
+    static const int SubBucketBits = 4;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    static int bucketIndex(uint64_t value);
+    static int64_t bucketUpperBound(int index);
+
+    std::atomic<uint64_t> m_counts[BucketCount];
+    std::atomic<uint64_t> m_total;
+    std::atomic<int64_t> m_max;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,119 @@
+#include "latencymonitor.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QVariantMap>
+
+static double toMicroseconds(int64_t ns)
+{
+    return ns / 1000.0;
+}
+
+LatencyMonitor::LatencyMonitor()
+    : m_pressNs(0)
+{
+}
+
+void LatencyMonitor::record(Stage stage, int64_t durationNs)
+{
+    m_histograms[stage].record(durationNs);
+}
+
+void LatencyMonitor::markPress(int64_t timestampNs)
+{
+    m_pressNs.store(timestampNs, std::memory_order_relaxed);
+}
+
+int64_t LatencyMonitor::pressTime() const
+{
+    return m_pressNs.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyMonitor::takePress()
+{
+    return m_pressNs.exchange(0, std::memory_order_relaxed);
+}
+
+const LatencyHistogram &LatencyMonitor::histogram(Stage stage) const
+{
+    return m_histograms[stage];
+}
+
+QVariantList LatencyMonitor::summary() const
+{
+    QVariantList stages;
+    for (int i = 0; i < StageCount; ++i) {
+        const LatencyHistogram &histogram = m_histograms[i];
+        
+        QVariantMap stage;
+        stage["name"] = stageName(static_cast<Stage>(i));
+        stage["count"] = static_cast<qulonglong>(histogram.count());
+        stage["p50Us"] = toMicroseconds(histogram.percentileNs(50));
+        stage["p99Us"] = toMicroseconds(histogram.percentileNs(99));
+        stage["maxUs"] = toMicroseconds(histogram.maxNs());
+        stages.append(stage);
+    }
+    return stages;
+}
+
+bool LatencyMonitor::dump(const QString &filePath) const
+{
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Cannot write latency dump:" << filePath;
+        return false;
+    }
+    
+    QTextStream out(&file);
+    
+    out << "stage,count,p50_us,p90_us,p99_us,p999_us,max_us\n";
+    for (int i = 0; i < StageCount; ++i) {
+        const LatencyHistogram &histogram = m_histograms[i];
+        out << stageName(static_cast<Stage>(i)) << ','
+            << histogram.count() << ','
+            << toMicroseconds(histogram.percentileNs(50)) << ','
+            << toMicroseconds(histogram.percentileNs(90)) << ','
+            << toMicroseconds(histogram.percentileNs(99)) << ','
+            << toMicroseconds(histogram.percentileNs(99.9)) << ','
+            << toMicroseconds(histogram.maxNs()) << '\n';
+    }
+    
+    // Full distributions, for plotting or merging dumps from several runs
+    out << "\nstage,bucket_upper_us,count\n";
+    for (int i = 0; i < StageCount; ++i) {
+        const auto buckets = m_histograms[i].buckets();
+        for (const auto &bucket : buckets) {
+            out << stageName(static_cast<Stage>(i)) << ','
+                << toMicroseconds(bucket.first) << ','
+                << bucket.second << '\n';
+        }
+    }
+    
+    return true;
+}
+
+void LatencyMonitor::reset()
+{
+    for (LatencyHistogram &histogram : m_histograms) {
+        histogram.reset();
+    }
+    m_pressNs.store(0, std::memory_order_relaxed);
+}
+
+QString LatencyMonitor::stageName(Stage stage)
+{
+    switch (stage) {
+    case Click: return "click";
+    case Lookup: return "lookup";
+    case Schedule: return "schedule";
+    case Wakeup: return "wakeup";
+    case Write: return "write";
+    case Total: return "total";
+    default: return QString();
+    }
+}
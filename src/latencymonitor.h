@@ -0,0 +1,86 @@
+#ifndef LATENCYMONITOR_H
+#define LATENCYMONITOR_H
+
+#include <QString>
+#include <QVariantList>
+
+#include <atomic>
+
+#include "latencyhistogram.h"
+
+/**
+ * @brief LatencyMonitor - Where the time goes between a touch and the host
+ *
+ * Each stage of the press-to-report path feeds its own histogram:
+ *
+ *   click     QML click handler to MacroController::executeMacro
+ *   lookup    Compiled program lookup in MacroConfig
+ *   schedule  Expanding the program into the writer queue
+ *   wakeup    Writer waking up later than the report was due
+ *   write     Time spent in the transport's write call
+ *   total     Click (or executeMacro) to the first report written
+ *
+ * Stages are recorded from the GUI and the writer thread without locks.
+ */
+class LatencyMonitor
+{
+public:
+    enum Stage {
+        Click,
+        Lookup,
+        Schedule,
+        Wakeup,
+        Write,
+        Total,
+        StageCount
+    };
+
+    LatencyMonitor();
+
+    /**
+     * @brief Record one duration for a stage
+     */
+    void record(Stage stage, int64_t durationNs);
+
+    /**
+     * @brief Remember when a press started; consumed by takePress()
+     */
+    void markPress(int64_t timestampNs);
+
+    /**
+     * @brief Press time left by markPress(), or 0 if there is none
+     */
+    int64_t pressTime() const;
+
+    /**
+     * @brief Press time left by markPress(), clearing it
+     */
+    int64_t takePress();
+
+    const LatencyHistogram &histogram(Stage stage) const;
+
+    /**
+     * @brief Per-stage summary for the UI
+     *
+     * One map per stage with name, count, p50Us, p99Us and maxUs.
+     */
+    QVariantList summary() const;
+
+    /**
+     * @brief Write summaries and full distributions as CSV
+     */
+    bool dump(const QString &filePath) const;
+
+    /**
+     * @brief Clear all histograms
+     */
+    void reset();
+
+    static QString stageName(Stage stage);
+
+private:
+    LatencyHistogram m_histograms[StageCount];
+    std::atomic<int64_t> m_pressNs;
+};
+
+#endif // LATENCYMONITOR_H
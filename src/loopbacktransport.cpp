@@ -0,0 +1,105 @@
+#include "loopbacktransport.h"
+
+#include <QDebug>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Keyboard LED output report: DATA|OUTPUT, report ID, LED bits
+static const uint8_t HIDP_DATA_OUTPUT = 0xA2;
+
+LoopbackTransport::LoopbackTransport()
+    : m_deviceFd(-1)
+    , m_hostFd(-1)
+{
+    // SEQPACKET keeps report boundaries, like the L2CAP channels
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        qWarning() << "Failed to create loopback HID transport";
+        return;
+    }
+    m_deviceFd = fds[0];
+    m_hostFd = fds[1];
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    if (m_deviceFd >= 0) {
+        ::close(m_deviceFd);
+    }
+    if (m_hostFd >= 0) {
+        ::close(m_hostFd);
+    }
+}
+
+bool LoopbackTransport::isValid() const
+{
+    return m_deviceFd >= 0;
+}
+
+QString LoopbackTransport::name() const
+{
+    return QStringLiteral("loopback");
+}
+
+QList<int> LoopbackTransport::descriptors() const
+{
+    return { m_deviceFd };
+}
+
+int LoopbackTransport::reportFd() const
+{
+    return m_deviceFd;
+}
+
+ssize_t LoopbackTransport::sendReport(const uint8_t *data, size_t size)
+{
+    LoopbackRecord record;
+    record.sentNs = monotonicNowNs();
+    memset(record.data, 0, sizeof(record.data));
+    memcpy(record.data, data, qMin(size, sizeof(record.data)));
+    
+    if (::send(m_deviceFd, &record, sizeof(record), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        return -1;
+    }
+    
+    rememberReport(data, size);
+    return static_cast<ssize_t>(size);
+}
+
+HidTransport::InputResult LoopbackTransport::handleInput(int fd)
+{
+    uint8_t message[64];
+    ssize_t size = ::recv(fd, message, sizeof(message), MSG_DONTWAIT);
+    
+    if (size == 0) {
+        return InputHungUp;
+    }
+    if (size >= 3 && message[0] == HIDP_DATA_OUTPUT && message[1] == HID_KEYBOARD_REPORT_ID) {
+        return updateLeds(message[2]);
+    }
+    return InputHandled;
+}
+
+int LoopbackTransport::hostFd() const
+{
+    return m_hostFd;
+}
+
+int LoopbackTransport::readRecords(QList<LoopbackRecord> &records)
+{
+    int count = 0;
+    LoopbackRecord record;
+    
+    while (::recv(m_hostFd, &record, sizeof(record), MSG_DONTWAIT) == sizeof(record)) {
+        records.append(record);
+        ++count;
+    }
+    return count;
+}
+
+bool LoopbackTransport::sendLeds(uint8_t leds)
+{
+    const uint8_t report[3] = { HIDP_DATA_OUTPUT, HID_KEYBOARD_REPORT_ID, leds };
+    return ::send(m_hostFd, report, sizeof(report), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(report);
+}
@@ -0,0 +1,64 @@
+#ifndef LOOPBACKTRANSPORT_H
+#define LOOPBACKTRANSPORT_H
+
+#include "hidtransport.h"
+
+/**
+ * @brief One report as seen by the loopback host
+ */
+struct LoopbackRecord {
+    int64_t sentNs;   // CLOCK_MONOTONIC time the writer sent it
+    uint8_t data[HID_REPORT_SIZE];
+};
+
+/**
+ * @brief LoopbackTransport - In-process host for tests and benchmarks
+ *
+ * Reports are written into one end of a socketpair, stamped with the
+ * time they were sent; the other end plays the host. This runs the full
+ * writer path (pacing, EAGAIN back-off, LED reports) on any Linux box,
+ * without a radio.
+ *
+ * The host-side methods may be called from any thread but the writer's.
+ * The transport belongs to the writer once handed over, so keep it only
+ * as long as it stays attached.
+ */
+class LoopbackTransport : public HidTransport
+{
+public:
+    LoopbackTransport();
+    ~LoopbackTransport();
+
+    /**
+     * @brief Whether the socketpair could be created
+     */
+    bool isValid() const;
+
+    QString name() const override;
+    QList<int> descriptors() const override;
+    int reportFd() const override;
+    ssize_t sendReport(const uint8_t *data, size_t size) override;
+    InputResult handleInput(int fd) override;
+
+    /**
+     * @brief Host end of the loopback, readable when reports are waiting
+     */
+    int hostFd() const;
+
+    /**
+     * @brief Append every report received so far to records
+     * @return Number of reports read
+     */
+    int readRecords(QList<LoopbackRecord> &records);
+
+    /**
+     * @brief Send an LED output report from the host side
+     */
+    bool sendLeds(uint8_t leds);
+
+private:
+    int m_deviceFd;
+    int m_hostFd;
+};
+
+#endif // LOOPBACKTRANSPORT_H
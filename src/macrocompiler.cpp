@@ -0,0 +1,576 @@
+#include "macrocompiler.h"
+#include "bluetoothhid.h"
+
+#include <QCache>
+#include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cstring>
+
+// Largest pointer move per report; small steps at the writer's report
+// rate look smooth and still cross the screen in a fraction of a second
+static const int MOUSE_MOVE_STEP = 16;
+
+// Reports of recently typed texts, costed by instruction count (16 bytes each)
+static const int TEXT_CACHE_INSTRUCTIONS = 65536;
+
+static QMutex s_textCacheMutex;
+static QCache<QString, MacroProgram> s_textCache(TEXT_CACHE_INSTRUCTIONS);
+
+MacroCompiler::MacroCompiler(int stepGapMs, const KeyboardLayout &layout, UnicodeInput::Method unicodeInput)
+    : m_layout(&layout)
+    , m_unicodeInput(unicodeInput)
+    , m_textCacheEnabled(true)
+    , m_stepGapUs(static_cast<uint32_t>(qMax(0, stepGapMs)) * 1000)
+    , m_pendingDelayUs(0)
+    , m_endsWithDelay(false)
+    , m_taken(false)
+{
+}
+
+MacroProgram MacroCompiler::compile(const QVariantList &sequence, int stepGapMs,
+                                    const KeyboardLayout &layout, UnicodeInput::Method unicodeInput)
+{
+    // Streamed text can be far too big to compile ahead
+    for (const QVariant &step : sequence) {
+        if (isStreamed(step.toMap())) {
+            MacroInstruction instruction;
+            memset(&instruction, 0, sizeof(instruction));
+            instruction.opcode = MacroInstruction::OpStream;
+            return MacroProgram { instruction };
+        }
+    }
+    
+    MacroCompiler compiler(stepGapMs, layout, unicodeInput);
+    for (const QVariant &step : sequence) {
+        compiler.addStep(step.toMap());
+    }
+    return compiler.finish();
+}
+
+bool MacroCompiler::isStreamed(const QVariantMap &step)
+{
+    return step.value("type").toString() == "text"
+        && (step.contains("file") || step.value("stream", false).toBool());
+}
+
+bool MacroCompiler::streams(const MacroProgram &program)
+{
+    return program.size() == 1 && program.first().opcode == MacroInstruction::OpStream;
+}
+
+bool MacroCompiler::addStep(const QVariantMap &step)
+{
+    QString type = step.value("type").toString();
+    
+    if (type == "consumer") {
+        uint16_t usage = static_cast<uint16_t>(step.value("usage").toUInt());
+        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
+        addConsumer(usage, modifiers);
+    } else if (type == "mouse_move") {
+        addMouseMove(step.value("x", 0).toInt(), step.value("y", 0).toInt());
+    } else if (type == "click") {
+        // Buttons are numbered from 1 (left), bits from 0
+        const int button = qBound(1, step.value("button", 1).toInt(), 5);
+        addClick(static_cast<uint8_t>(1 << (button - 1)), step.value("count", 1).toInt());
+    } else if (type == "scroll") {
+        addScroll(step.value("y", 0).toInt(), step.value("x", 0).toInt());
+    } else if (type == "key") {
+        uint8_t keyCode = static_cast<uint8_t>(step.value("keyCode").toUInt());
+        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
+        addKey(keyCode, modifiers);
+    } else if (type == "text") {
+        if (step.contains("file")) {
+            qWarning() << "Text from a file is only typed when streamed";
+            return false;
+        }
+        addText(step.value("text").toString(), step.value("packed", false).toBool());
+    } else if (type == "delay") {
+        addDelay(step.value("ms", 100).toInt());
+        return true;  // No extra gap after a delay
+    } else if (type == "combo") {
+        QVariantList keys = step.value("keys").toList();
+        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
+        addCombo(keys, modifiers);
+    } else if (type == "press") {
+        uint8_t keyCode = static_cast<uint8_t>(step.value("keyCode", 0).toUInt());
+        uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
+        addPress(keyCode, modifiers);
+    } else if (type == "release") {
+        // Without a key or modifiers it lets go of everything
+        if (!step.contains("keyCode") && !step.contains("modifiers")) {
+            addReleaseAll();
+        } else {
+            uint8_t keyCode = static_cast<uint8_t>(step.value("keyCode", 0).toUInt());
+            uint8_t modifiers = static_cast<uint8_t>(step.value("modifiers", 0).toUInt());
+            addRelease(keyCode, modifiers);
+        }
+    } else {
+        qWarning() << "Unknown macro step type:" << type;
+        return false;
+    }
+    
+    endStep();
+    return true;
+}
+
+void MacroCompiler::addKey(uint8_t keyCode, uint8_t modifiers)
+{
+    using KeyCode = BluetoothHID::KeyCode;
+    using ConsumerUsage = BluetoothHID::ConsumerUsage;
+    
+    switch (static_cast<KeyCode>(keyCode)) {
+    case KeyCode::KEY_VOLUME_MUTE:
+        addConsumer(static_cast<uint16_t>(ConsumerUsage::MUTE), modifiers);
+        return;
+    case KeyCode::KEY_VOLUME_UP:
+        addConsumer(static_cast<uint16_t>(ConsumerUsage::VOLUME_UP), modifiers);
+        return;
+    case KeyCode::KEY_VOLUME_DOWN:
+        addConsumer(static_cast<uint16_t>(ConsumerUsage::VOLUME_DOWN), modifiers);
+        return;
+    default:
+        break;
+    }
+    
+    addTap(&keyCode, 1, modifiers);
+}
+
+void MacroCompiler::addConsumer(uint16_t usage, uint8_t modifiers)
+{
+    const uint8_t added = modifiers & ~m_keyboard.modifiers();
+    if (added) {
+        addPress(0x00, added);
+    }
+    
+    addConsumerReport(usage);
+    addConsumerReport(0);
+    
+    if (added) {
+        addRelease(0x00, added);
+    }
+}
+
+void MacroCompiler::addMouseMove(int x, int y)
+{
+    addMouseMotion(x, y, 0, 0, MOUSE_MOVE_STEP);
+}
+
+void MacroCompiler::addClick(uint8_t buttons, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        addMouseReport(buttons, 0, 0, 0, 0);
+        addMouseReport(0x00, 0, 0, 0, 0);
+    }
+}
+
+void MacroCompiler::addScroll(int y, int x)
+{
+    addMouseMotion(0, 0, y, x, HID_MOUSE_MAX_DELTA);
+}
+
+void MacroCompiler::addMouseMotion(int x, int y, int wheel, int pan, int maxDelta)
+{
+    const int largest = qMax(qMax(qAbs(x), qAbs(y)), qMax(qAbs(wheel), qAbs(pan)));
+    const int steps = (largest + maxDelta - 1) / maxDelta;
+    
+    // Each report takes its share of the remaining distance, so the steps
+    // differ by at most one count and add up exactly
+    for (int i = 1; i <= steps; ++i) {
+        auto share = [&](int total) {
+            return total * i / steps - total * (i - 1) / steps;
+        };
+        addMouseReport(0x00, share(x), share(y), share(wheel), share(pan));
+    }
+}
+
+void MacroCompiler::addCombo(const QVariantList &keyCodes, uint8_t modifiers)
+{
+    uint8_t keys[HID_REPORT_KEY_SLOTS];
+    int count = 0;
+    for (const QVariant &keyVar : keyCodes) {
+        if (count < HID_REPORT_KEY_SLOTS) {
+            keys[count++] = static_cast<uint8_t>(keyVar.toUInt());
+        }
+    }
+    addTap(keys, count, modifiers);
+}
+
+void MacroCompiler::addPress(uint8_t keyCode, uint8_t modifiers)
+{
+    if (m_keyboard.press(keyCode, modifiers)) {
+        addReport();
+    }
+}
+
+void MacroCompiler::addRelease(uint8_t keyCode, uint8_t modifiers)
+{
+    if (m_keyboard.release(keyCode, modifiers)) {
+        addReport();
+    }
+}
+
+void MacroCompiler::addReleaseAll()
+{
+    if (m_keyboard.releaseAll()) {
+        addReport();
+    }
+}
+
+void MacroCompiler::addTap(const uint8_t *keyCodes, int count, uint8_t modifiers)
+{
+    // Held keys in the tap go up first, or the host would see no new press
+    bool held = false;
+    for (int i = 0; i < count; ++i) {
+        held = held || m_keyboard.isPressed(keyCodes[i]);
+    }
+    if (held) {
+        m_keyboard.release(keyCodes, count);
+        addReport();
+    }
+    
+    // Keys held by press steps may fill every slot. The last of them
+    // make room and go down again after the tap, so no key is dropped.
+    int needed = 0;
+    for (int i = 0; i < count; ++i) {
+        if (keyCodes[i] != 0x00 && !memchr(keyCodes, keyCodes[i], i)) {
+            ++needed;
+        }
+    }
+    uint8_t lent[HID_REPORT_KEY_SLOTS];
+    const int lentCount = qMax(0, needed - m_keyboard.freeSlots());
+    for (int i = 0; i < lentCount; ++i) {
+        lent[i] = m_keyboard.key(m_keyboard.keyCount() - lentCount + i);
+    }
+    if (lentCount > 0) {
+        m_keyboard.release(lent, lentCount);
+        addReport();
+    }
+    
+    // Press, then release; HidWriter spaces the two reports at the rate
+    // the host accepts. Modifiers that were held stay down.
+    const uint8_t added = modifiers & ~m_keyboard.modifiers();
+    if (m_keyboard.press(keyCodes, count, modifiers)) {
+        addReport();
+    }
+    if (m_keyboard.release(keyCodes, count, added)) {
+        addReport();
+    }
+    
+    if (lentCount > 0 && m_keyboard.press(lent, lentCount)) {
+        addReport();
+    }
+}
+
+void MacroCompiler::addText(const QString &text, bool packed)
+{
+    // Typed from a released keyboard, the reports only depend on the text
+    // and on how the host types it, so long snippets are encoded once
+    if (!m_textCacheEnabled || !m_keyboard.isReleased()) {
+        encodeText(text, packed);
+        return;
+    }
+    
+    // Layout, input method and packing pick the encoding
+    const ushort mode = (m_layout->id() << 8) | (m_unicodeInput << 1) | (packed ? 1 : 0);
+    const QString key = QChar(mode) + text;
+    {
+        QMutexLocker locker(&s_textCacheMutex);
+        if (const MacroProgram *cached = s_textCache.object(key)) {
+            appendFragment(*cached);
+            return;
+        }
+    }
+    
+    const int start = m_program.size();
+    encodeText(text, packed);
+    if (m_program.size() == start) {
+        return;
+    }
+    
+    // Stored without the pause before the first report, which belongs to
+    // whatever came before the text
+    MacroProgram *fragment = new MacroProgram(m_program.mid(start));
+    fragment->first().delayUs = 0;
+    
+    QMutexLocker locker(&s_textCacheMutex);
+    s_textCache.insert(key, fragment, fragment->size());
+}
+
+void MacroCompiler::encodeText(const QString &text, bool packed)
+{
+    if (packed) {
+        addPackedText(text);
+        return;
+    }
+    
+    for (int i = 0; i < text.size(); ++i) {
+        const KeyboardLayout::KeyStroke stroke = m_layout->keyStroke(text.at(i));
+        if (stroke.flags & KeyboardLayout::DeadKey) {
+            addDeadKey(stroke);
+        } else if (stroke.keyCode != 0x00) {
+            addKey(stroke.keyCode, stroke.modifiers);
+        } else {
+            addUnicode(text, i);
+        }
+    }
+}
+
+void MacroCompiler::appendFragment(const MacroProgram &fragment)
+{
+    const int start = m_program.size();
+    m_program.append(fragment);
+    m_program[start].delayUs = m_pendingDelayUs;
+    m_pendingDelayUs = 0;
+    m_endsWithDelay = false;
+}
+
+void MacroCompiler::addUnicode(const QString &text, int &index)
+{
+    const QChar c = text.at(index);
+    char32_t codePoint = c.unicode();
+    if (c.isHighSurrogate() && index + 1 < text.size() && text.at(index + 1).isLowSurrogate()) {
+        codePoint = QChar::surrogateToUcs4(c, text.at(++index));
+    }
+    
+    // Control characters and broken surrogates have nothing to type
+    if (m_unicodeInput == UnicodeInput::None || codePoint < 0x20 || (codePoint >= 0x7F && codePoint < 0xA0)
+        || QChar::isSurrogate(codePoint)) {
+        return;
+    }
+    
+    using Modifier = BluetoothHID::Modifier;
+    const uint8_t alt = static_cast<uint8_t>(Modifier::LEFT_ALT);
+    
+    // An Alt already held by a press step stays down for that step to release
+    const bool pressAlt = !(m_keyboard.modifiers() & alt);
+    
+    // Windows and macOS read UTF-16 code units
+    char16_t units[2];
+    int unitCount = 1;
+    if (QChar::requiresSurrogates(codePoint)) {
+        units[0] = QChar::highSurrogate(codePoint);
+        units[1] = QChar::lowSurrogate(codePoint);
+        unitCount = 2;
+    } else {
+        units[0] = static_cast<char16_t>(codePoint);
+    }
+    
+    switch (m_unicodeInput) {
+    case UnicodeInput::Linux: {
+        const uint8_t ctrlShift = static_cast<uint8_t>(Modifier::LEFT_CTRL) | static_cast<uint8_t>(Modifier::LEFT_SHIFT);
+        addKey(m_layout->keyStroke(QChar('u')).keyCode, ctrlShift);
+        addHex(codePoint, 1, *m_layout, false);
+        const KeyboardLayout::KeyStroke space = m_layout->keyStroke(QChar(' '));
+        addKey(space.keyCode, space.modifiers);
+        break;
+    }
+    case UnicodeInput::Windows:
+        for (int i = 0; i < unitCount; ++i) {
+            if (pressAlt) {
+                addPress(0x00, alt);
+            }
+            addKey(static_cast<uint8_t>(BluetoothHID::KeyCode::KEY_KEYPAD_PLUS), 0x00);
+            addHex(units[i], 1, *m_layout, true);
+            if (pressAlt) {
+                addRelease(0x00, alt);
+            }
+        }
+        break;
+    case UnicodeInput::MacOs:
+        // Unicode Hex Input is a layout of its own, with US key positions
+        if (pressAlt) {
+            addPress(0x00, alt);
+        }
+        for (int i = 0; i < unitCount; ++i) {
+            addHex(units[i], 4, KeyboardLayout::layout(KeyboardLayout::Us), false);
+        }
+        if (pressAlt) {
+            addRelease(0x00, alt);
+        }
+        break;
+    case UnicodeInput::None:
+        break;
+    }
+}
+
+void MacroCompiler::addHex(uint32_t value, int minDigits, const KeyboardLayout &layout, bool keypad)
+{
+    char digits[8];
+    int count = 0;
+    do {
+        digits[count++] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    } while (value != 0 || count < minDigits);
+    
+    while (count > 0) {
+        const char digit = digits[--count];
+        if (keypad && digit >= '1' && digit <= '9') {
+            addKey(static_cast<uint8_t>(BluetoothHID::KeyCode::KEY_KEYPAD_1) + (digit - '1'), 0x00);
+        } else if (keypad && digit == '0') {
+            addKey(static_cast<uint8_t>(BluetoothHID::KeyCode::KEY_KEYPAD_0), 0x00);
+        } else {
+            const KeyboardLayout::KeyStroke stroke = layout.keyStroke(QChar(digit));
+            addKey(stroke.keyCode, stroke.modifiers);
+        }
+    }
+}
+
+void MacroCompiler::addDeadKey(const KeyboardLayout::KeyStroke &stroke)
+{
+    // The dead key alone only arms the accent; Space turns it into the character
+    const KeyboardLayout::KeyStroke space = m_layout->keyStroke(QChar(' '));
+    addKey(stroke.keyCode, stroke.modifiers);
+    addKey(space.keyCode, space.modifiers);
+}
+
+void MacroCompiler::addPackedText(const QString &text)
+{
+    uint8_t keys[HID_REPORT_KEY_SLOTS];
+    int count = 0;
+    uint8_t modifiers = 0;
+    
+    // Press the batch in one report, then release it
+    auto flush = [&]() {
+        if (count > 0) {
+            addTap(keys, count, modifiers);
+            count = 0;
+        }
+    };
+    
+    for (int i = 0; i < text.size(); ++i) {
+        const KeyboardLayout::KeyStroke stroke = m_layout->keyStroke(text.at(i));
+        if (stroke.keyCode == 0x00) {
+            if (m_unicodeInput != UnicodeInput::None) {
+                flush();
+                addUnicode(text, i);
+            }
+            continue;
+        }
+        
+        // Dead keys need their own Space, which would not survive packing
+        if (stroke.flags & KeyboardLayout::DeadKey) {
+            flush();
+            addDeadKey(stroke);
+            continue;
+        }
+        
+        const uint8_t keyCode = stroke.keyCode;
+        const uint8_t keyModifiers = stroke.modifiers;
+        
+        // A key that is already down would not register twice
+        bool repeated = m_keyboard.isPressed(keyCode);
+        for (int i = 0; i < count; ++i) {
+            repeated = repeated || keys[i] == keyCode;
+        }
+        
+        // Keys held by a press step take slots too; with none left,
+        // addTap() lends one per key
+        const int slots = qMax(1, m_keyboard.freeSlots());
+        if (count == slots || repeated || (count > 0 && keyModifiers != modifiers)) {
+            flush();
+        }
+        
+        modifiers = keyModifiers;
+        keys[count++] = keyCode;
+    }
+    
+    flush();
+}
+
+void MacroCompiler::addDelay(int milliseconds)
+{
+    if (milliseconds > 0) {
+        addGap(static_cast<uint32_t>(milliseconds) * 1000);
+        m_endsWithDelay = true;
+    }
+}
+
+void MacroCompiler::endStep()
+{
+    addGap(m_stepGapUs);
+}
+
+void MacroCompiler::setTextCacheEnabled(bool enabled)
+{
+    m_textCacheEnabled = enabled;
+}
+
+MacroProgram MacroCompiler::take()
+{
+    MacroProgram program = m_program;
+    m_program.clear();
+    m_taken = m_taken || !program.isEmpty();
+    return program;
+}
+
+MacroProgram MacroCompiler::finish()
+{
+    // A macro never leaves keys down on the host
+    addReleaseAll();
+    
+    // A trailing delay step still has to elapse before the macro counts
+    // as done; the gap left behind by the last regular step does not.
+    if (m_endsWithDelay && (!m_program.isEmpty() || m_taken)) {
+        MacroInstruction instruction;
+        instruction.delayUs = m_pendingDelayUs;
+        instruction.opcode = MacroInstruction::OpDelay;
+        instruction.reserved = 0;
+        buildKeyboardReport(instruction.report, 0x00, 0x00);
+        m_program.append(instruction);
+    }
+    
+    MacroProgram program = m_program;
+    m_program.clear();
+    m_pendingDelayUs = 0;
+    m_endsWithDelay = false;
+    m_taken = false;
+    
+    program.squeeze();
+    return program;
+}
+
+void MacroCompiler::addReport()
+{
+    MacroInstruction instruction;
+    instruction.delayUs = m_pendingDelayUs;
+    instruction.opcode = MacroInstruction::OpReport;
+    instruction.reserved = 0;
+    m_keyboard.writeReport(instruction.report);
+    
+    m_program.append(instruction);
+    m_pendingDelayUs = 0;
+    m_endsWithDelay = false;
+}
+
+void MacroCompiler::addConsumerReport(uint16_t usage)
+{
+    MacroInstruction instruction;
+    instruction.delayUs = m_pendingDelayUs;
+    instruction.opcode = MacroInstruction::OpReport;
+    instruction.reserved = 0;
+    buildConsumerReport(instruction.report, usage);
+    
+    m_program.append(instruction);
+    m_pendingDelayUs = 0;
+    m_endsWithDelay = false;
+}
+
+void MacroCompiler::addMouseReport(uint8_t buttons, int x, int y, int wheel, int pan)
+{
+    MacroInstruction instruction;
+    instruction.delayUs = m_pendingDelayUs;
+    instruction.opcode = MacroInstruction::OpReport;
+    instruction.reserved = 0;
+    buildMouseReport(instruction.report, buttons, x, y, wheel, pan);
+    
+    m_program.append(instruction);
+    m_pendingDelayUs = 0;
+    m_endsWithDelay = false;
+}
+
+void MacroCompiler::addGap(uint32_t delayUs)
+{
+    m_pendingDelayUs += delayUs;
+}
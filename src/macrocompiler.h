@@ -0,0 +1,208 @@
+#ifndef MACROCOMPILER_H
+#define MACROCOMPILER_H
+
+#include <QString>
+#include <QVariantList>
+#include <QVariantMap>
+
+#include "keyboardlayout.h"
+#include "keyboardstate.h"
+#include "macroprogram.h"
+#include "unicodeinput.h"
+
+/**
+ * @brief MacroCompiler - Turns macro sequences into pre-encoded programs
+ *
+ * Macro steps are stored as QVariantMaps for editing and saving. Before a
+ * macro can run, the compiler resolves every step into HID reports with
+ * their timing, once, so pressing a button only walks a flat array.
+ *
+ * Only deliberate pauses (delay steps and the gap between steps) are
+ * encoded; the spacing of individual key reports is left to HidWriter,
+ * which adapts it to what the connected host accepts.
+ *
+ * Reports are derived from a KeyboardState, and one is only emitted when
+ * that state changes. Keys pressed by a press step stay down across the
+ * following steps (typed text, taps and combos are pressed on top of
+ * them) until a release step, or the end of the macro, lets them go.
+ * When held keys take every report slot, the most recent of them are
+ * let go for the length of a tap and pressed again after it.
+ *
+ * Text is typed for the KeyboardLayout and UnicodeInput method the
+ * compiler is created with, the current ones unless given.
+ */
+class MacroCompiler
+{
+public:
+    /**
+     * @brief Default pause between two macro steps
+     */
+    static const int DefaultStepGapMs = 30;
+
+    explicit MacroCompiler(int stepGapMs = DefaultStepGapMs,
+                           const KeyboardLayout &layout = KeyboardLayout::current(),
+                           UnicodeInput::Method unicodeInput = UnicodeInput::current());
+
+    /**
+     * @brief Compile a whole macro sequence
+     *
+     * A sequence with a streamed step compiles to a single OpStream
+     * instruction; it is played by TextPaster instead.
+     *
+     * @param stepGapMs Pause inserted between steps; 0 runs them back to back
+     * @param layout, unicodeInput How text is typed
+     */
+    static MacroProgram compile(const QVariantList &sequence, int stepGapMs = DefaultStepGapMs,
+                                const KeyboardLayout &layout = KeyboardLayout::current(),
+                                UnicodeInput::Method unicodeInput = UnicodeInput::current());
+
+    /**
+     * @brief True for a text step that is typed as it streams
+     *
+     * That is a step with "stream" set, or one reading a "file".
+     */
+    static bool isStreamed(const QVariantMap &step);
+
+    /**
+     * @brief True if program stands for a sequence with streamed steps
+     */
+    static bool streams(const MacroProgram &program);
+
+    /**
+     * @brief Append one step in its QVariantMap form
+     * @return false if the step type is unknown
+     */
+    bool addStep(const QVariantMap &step);
+
+    /**
+     * @brief Append a single key press and release
+     *
+     * A key that is already held is let go instead, as pressing it again
+     * would not register. The keyboard volume keys, which most hosts
+     * ignore, are sent as their Consumer Control usages.
+     */
+    void addKey(uint8_t keyCode, uint8_t modifiers);
+
+    /**
+     * @brief Append tapping a Consumer Control usage (a media key)
+     *
+     * Modifiers not yet held are pressed on the keyboard around it.
+     */
+    void addConsumer(uint16_t usage, uint8_t modifiers = 0);
+
+    /**
+     * @brief Append moving the mouse pointer by x, y counts
+     *
+     * Large moves are split into evenly sized small reports that the
+     * writer sends at its report rate, so the pointer glides along a
+     * straight line instead of jumping.
+     */
+    void addMouseMove(int x, int y);
+
+    /**
+     * @brief Append clicking mouse buttons count times (2 double-clicks)
+     */
+    void addClick(uint8_t buttons, int count = 1);
+
+    /**
+     * @brief Append scrolling by wheel notches; positive y up, positive x right
+     */
+    void addScroll(int y, int x = 0);
+
+    /**
+     * @brief Append a key combination: all keys go down in one report
+     */
+    void addCombo(const QVariantList &keyCodes, uint8_t modifiers);
+
+    /**
+     * @brief Append pressing a key and modifiers, keeping them down
+     */
+    void addPress(uint8_t keyCode, uint8_t modifiers);
+
+    /**
+     * @brief Append releasing a key and modifiers held by addPress()
+     */
+    void addRelease(uint8_t keyCode, uint8_t modifiers);
+
+    /**
+     * @brief Append releasing everything that is held
+     */
+    void addReleaseAll();
+
+    /**
+     * @brief Append a string of text as keyboard input
+     *
+     * In packed mode up to six consecutive distinct keys that share the
+     * same modifiers go out in a single report, with a release only when
+     * a key repeats, the modifiers change or all six slots are used. This
+     * relies on the host handling keys in report slot order, which all
+     * common hosts do, and types several times faster.
+     *
+     * Characters the layout has no key for are entered through the
+     * UnicodeInput method, or skipped if there is none. The reports of
+     * a text typed with no key held are cached across compilers, so
+     * compiling a long snippet again is a copy.
+     */
+    void addText(const QString &text, bool packed = false);
+
+    /**
+     * @brief Append a pause
+     */
+    void addDelay(int milliseconds);
+
+    /**
+     * @brief Append the pause between two steps
+     *
+     * addStep() does this itself; call it after a step built from other
+     * calls.
+     */
+    void endStep();
+
+    /**
+     * @brief Whether addText() may use and fill the shared text cache
+     *
+     * On by default. Turn it off for text that will not be typed again.
+     */
+    void setTextCacheEnabled(bool enabled);
+
+    /**
+     * @brief Return what was compiled so far, keeping keys held
+     *
+     * For programs that are played piece by piece while they are being
+     * compiled; a pause not yet followed by a report stays pending.
+     */
+    MacroProgram take();
+
+    /**
+     * @brief Return the compiled program and reset the compiler
+     *
+     * Keys still held are released first.
+     */
+    MacroProgram finish();
+
+private:
+    void addTap(const uint8_t *keyCodes, int count, uint8_t modifiers);
+    void addDeadKey(const KeyboardLayout::KeyStroke &stroke);
+    void addUnicode(const QString &text, int &index);
+    void addHex(uint32_t value, int minDigits, const KeyboardLayout &layout, bool keypad);
+    void encodeText(const QString &text, bool packed);
+    void appendFragment(const MacroProgram &fragment);
+    void addReport();
+    void addConsumerReport(uint16_t usage);
+    void addMouseMotion(int x, int y, int wheel, int pan, int maxDelta);
+    void addMouseReport(uint8_t buttons, int x, int y, int wheel, int pan);
+    void addPackedText(const QString &text);
+    void addGap(uint32_t delayUs);
+
+    MacroProgram m_program;
+    KeyboardState m_keyboard;
+    const KeyboardLayout *m_layout;
+    UnicodeInput::Method m_unicodeInput;
+    bool m_textCacheEnabled;
+    uint32_t m_stepGapUs;
+    uint32_t m_pendingDelayUs;
+    bool m_endsWithDelay;
+    bool m_taken;                 // take() has handed out reports
+};
+
+#endif // MACROCOMPILER_H
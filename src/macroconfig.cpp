@@ -1,29 +1,292 @@
 #include "macroconfig.h"
+#include "configcache.h"
+#include "configparser.h"
+#include "macrocompiler.h"
 
 #include <QFile>
 #include <QDir>
+#include <QSaveFile>
+#include <QSet>
 #include <QStandardPaths>
 #include <QDebug>
 
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Quiet period after the last edit before a requested save starts
+static const int SAVE_DEBOUNCE_MS = 500;
+
+// Editors and provisioning tools may write in several steps; wait for quiet
+static const int RELOAD_DEBOUNCE_MS = 200;
+
+// Decoded pages kept besides the current one
+static const int PAGE_CACHE_SIZE = 8;
+
 MacroConfig::MacroConfig(QObject *parent)
     : QObject(parent)
     , m_columns(4)
     , m_rows(3)
+    , m_currentPage(0)
+    , m_pageEdited(false)
+    , m_savesInFlight(0)
+    , m_configHash(0)
 {
     // Default config path
     QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
     m_configPath = configDir + "/macropad/macros.json";
+    m_pages.append(Page { QString(), QByteArray(), false, 1, 1 });
+    m_pageCache.setMaxCost(PAGE_CACHE_SIZE);
+    
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SAVE_DEBOUNCE_MS);
+    connect(&m_saveTimer, &QTimer::timeout, this, &MacroConfig::startSave);
+    
+    m_reloadTimer.setSingleShot(true);
+    m_reloadTimer.setInterval(RELOAD_DEBOUNCE_MS);
+    connect(&m_reloadTimer, &QTimer::timeout, this, &MacroConfig::startReload);
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &MacroConfig::onConfigFileChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &MacroConfig::onConfigFileChanged);
+    
+    m_ioThread.setMaxThreadCount(1);
+}
+
+MacroConfig::~MacroConfig()
+{
+    flushSave();
+}
+
+static QJsonArray macrosToJson(const QList<MacroConfig::Macro> &macros)
+{
+    QJsonArray macrosArray;
+    for (const MacroConfig::Macro &macro : macros) {
+        QJsonObject obj;
+        obj["id"] = macro.id;
+        obj["name"] = macro.name;
+        obj["icon"] = macro.icon;
+        obj["color"] = macro.color;
+        obj["stepGapMs"] = macro.stepGapMs;
+        if (macro.policy != ExecutionPolicy::Queue) {
+            obj["policy"] = MacroConfig::policyName(macro.policy);
+        }
+        
+        if (!macro.sequenceJson.isEmpty()) {
+            obj["sequence"] = QJsonDocument::fromJson(macro.sequenceJson).array();
+        } else {
+            QJsonArray seqArray;
+            for (const QVariant &step : macro.sequence) {
+                seqArray.append(QJsonObject::fromVariantMap(step.toMap()));
+            }
+            obj["sequence"] = seqArray;
+        }
+        
+        macrosArray.append(obj);
+    }
+    return macrosArray;
+}
+
+static bool serializeConfig(const MacroConfig::Snapshot &snapshot, QByteArray &json, QString *errorString)
+{
+    QJsonObject root;
+    root["columns"] = snapshot.columns;
+    root["rows"] = snapshot.rows;
+    
+    QJsonArray pagesArray;
+    for (int i = 0; i < snapshot.pages.size(); ++i) {
+        const MacroConfig::Page &page = snapshot.pages[i];
+        QJsonArray macrosArray;
+        if (i == snapshot.currentPage) {
+            macrosArray = macrosToJson(snapshot.macros);
+        } else if (page.compiled) {
+            QList<MacroConfig::Macro> macros;
+            if (!MacroConfig::decodePage(page, macros, errorString)) {
+                return false;
+            }
+            macrosArray = macrosToJson(macros);
+        } else {
+            // Never shown, so still exactly as it was read
+            macrosArray = QJsonDocument::fromJson(page.source).array();
+        }
+        
+        QJsonObject obj;
+        obj["name"] = page.name;
+        obj["macros"] = macrosArray;
+        pagesArray.append(obj);
+    }
+    
+    // A single unnamed page keeps the layout from before pages
+    if (pagesArray.size() == 1 && snapshot.pages.first().name.isEmpty()) {
+        root["macros"] = pagesArray.first().toObject().value("macros");
+    } else {
+        root["pages"] = pagesArray;
+    }
+    json = QJsonDocument(root).toJson(QJsonDocument::Indented);
+    return true;
+}
+
+/**
+ * Replace the config file atomically: QSaveFile writes a temporary file,
+ * syncs it and renames it over the old one; syncing the directory then
+ * makes the rename itself survive a power cut.
+ */
+static bool writeConfigFile(const QString &path, const MacroConfig::Snapshot &snapshot,
+                            uint64_t *hash, QString *errorString)
+{
+    // Ensure directory exists
+    QFileInfo fileInfo(path);
+    QDir dir = fileInfo.dir();
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+    
+    QByteArray json;
+    if (!serializeConfig(snapshot, json, errorString)) {
+        return false;
+    }
+    
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+    file.write(json);
+    if (!file.commit()) {
+        *errorString = file.errorString();
+        return false;
+    }
+    
+    const int dirFd = ::open(QFile::encodeName(dir.absolutePath()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    
+    *hash = ConfigCache::hash(json);
+    ConfigCache::save(path, json, snapshot);
+    return true;
+}
+
+static QString uniqueIdIn(const QString &id, const QSet<QString> &ids)
+{
+    QString candidate = id;
+    for (int suffix = 2; ids.contains(candidate); ++suffix) {
+        candidate = id + "_" + QString::number(suffix);
+    }
+    return candidate;
+}
+
+static QString formatErrors(QStringList errors)
+{
+    // Enough to fix the file; the rest are usually the same mistake
+    const int shown = 10;
+    if (errors.size() > shown) {
+        const int more = errors.size() - shown;
+        errors = errors.mid(0, shown);
+        errors.append(QString("and %1 more").arg(more));
+    }
+    return errors.join('\n');
+}
+
+// Ids only need to be unique within a page
+static void renameDuplicates(QList<MacroConfig::Macro> &macros)
+{
+    QSet<QString> ids;
+    for (MacroConfig::Macro &macro : macros) {
+        if (ids.contains(macro.id)) {
+            qWarning() << "Duplicate macro id" << macro.id << "in config, renaming";
+            macro.id = uniqueIdIn(macro.id, ids);
+        }
+        ids.insert(macro.id);
+    }
+}
+
+/**
+ * Parse a config file, building and compiling only the page at
+ * snapshot.currentPage, or the first page if the file has no such page.
+ * Touches no MacroConfig state, so it may run on the I/O thread;
+ * snapshot's grid size is kept if the file does not set one, and its
+ * layout and Unicode input method pick how text is compiled.
+ */
+static bool parseConfig(const QByteArray &data, MacroConfig::Snapshot &snapshot, QString *errorString)
+{
+    ConfigParser parser(data);
+    if (!parser.parse(snapshot)) {
+        *errorString = formatErrors(parser.errors());
+        return false;
+    }
+    
+    if (snapshot.currentPage >= snapshot.pages.size()) {
+        snapshot.currentPage = 0;
+        if (!MacroConfig::decodePage(snapshot.pages.first(), snapshot.macros, errorString,
+                                     snapshot.layout, snapshot.unicodeInput)) {
+            return false;
+        }
+    }
+    renameDuplicates(snapshot.macros);
+    return true;
+}
+
+QString MacroConfig::policyName(ExecutionPolicy policy)
+{
+    switch (policy) {
+    case ExecutionPolicy::Preempt:
+        return "preempt";
+    case ExecutionPolicy::Parallel:
+        return "parallel";
+    case ExecutionPolicy::Queue:
+        break;
+    }
+    return "queue";
 }
 
-QVariantList MacroConfig::macros() const
+ExecutionPolicy MacroConfig::policyFromName(const QString &name, bool *ok)
 {
-    QVariantList result;
-    for (const Macro &macro : m_macros) {
-        result.append(macroToVariantMap(macro));
+    if (ok) {
+        *ok = true;
+    }
+    if (name == "preempt") {
+        return ExecutionPolicy::Preempt;
     }
-    return result;
+    if (name == "parallel") {
+        return ExecutionPolicy::Parallel;
+    }
+    if (ok && name != "queue") {
+        *ok = false;
+    }
+    return ExecutionPolicy::Queue;
 }
 
+bool MacroConfig::decodePage(const Page &page, QList<Macro> &macros, QString *errorString,
+                             KeyboardLayout::Id layout, UnicodeInput::Method unicodeInput)
+{
+    if (page.compiled) {
+        if (!ConfigCache::decodePage(page.source, macros)) {
+            if (errorString) {
+                *errorString = "the config cache is damaged";
+            }
+            return false;
+        }
+        return true;
+    }
+    
+    ConfigParser parser(page.source, page.line, page.column);
+    if (!parser.parsePage(macros, KeyboardLayout::layout(layout), unicodeInput)) {
+        if (errorString) {
+            *errorString = formatErrors(parser.errors());
+        }
+        return false;
+    }
+    renameDuplicates(macros);
+    return true;
+}
+
+// A handle is the slot index with the slot's generation above it, kept
+// within a positive int so QML can pass it around as a plain number
+static const int HANDLE_SLOT_BITS = 20;
+static const int HANDLE_SLOT_MASK = (1 << HANDLE_SLOT_BITS) - 1;
+static const int HANDLE_GENERATION_MASK = (1 << (31 - HANDLE_SLOT_BITS)) - 1;
+
 int MacroConfig::columns() const
 {
     return m_columns;
@@ -50,67 +313,133 @@ void MacroConfig::setRows(int rows)
     }
 }
 
+int MacroConfig::currentPage() const
+{
+    return m_currentPage;
+}
+
+QStringList MacroConfig::pageNames() const
+{
+    QStringList names;
+    names.reserve(m_pages.size());
+    for (const Page &page : m_pages) {
+        names.append(page.name);
+    }
+    return names;
+}
+
+void MacroConfig::setCurrentPage(int page)
+{
+    if (page == m_currentPage || page < 0 || page >= m_pages.size()) {
+        return;
+    }
+    
+    QList<Macro> macros;
+    if (QList<Macro> *cached = m_pageCache.take(page)) {
+        macros = *cached;
+        delete cached;
+        if (m_stalePages.remove(page)) {
+            recompileMacros(macros);
+        }
+    } else {
+        QString errorString;
+        if (!decodePage(m_pages[page], macros, &errorString)) {
+            emit error(QString("Failed to load page %1: %2").arg(page + 1).arg(errorString));
+            return;
+        }
+    }
+    
+    stashCurrentPage();
+    m_currentPage = page;
+    loadMacros(macros);
+    emit currentPageChanged();
+}
+
+int MacroConfig::count() const
+{
+    return m_order.size();
+}
+
+const MacroConfig::Macro *MacroConfig::macroAtRow(int row) const
+{
+    if (row < 0 || row >= m_order.size()) {
+        return nullptr;
+    }
+    return &m_slots[m_order[row]].macro;
+}
+
+int MacroConfig::handleAtRow(int row) const
+{
+    if (row < 0 || row >= m_order.size()) {
+        return InvalidHandle;
+    }
+    return handleOf(m_order[row]);
+}
+
+int MacroConfig::rowOf(int handle) const
+{
+    const int slot = slotOf(handle);
+    return slot < 0 ? -1 : m_order.indexOf(slot);
+}
+
 bool MacroConfig::loadConfig(const QString &filePath)
 {
     QString path = filePath.isEmpty() ? m_configPath : filePath;
     
+    // Unsaved edits would otherwise be lost, or land after the reload
+    flushSave();
+    watchConfig(path);
+    
     QFile file(path);
     if (!file.exists()) {
         qDebug() << "Config file not found, creating defaults";
+        emit macrosAboutToBeReset();
         createDefaultMacros();
+        emit macrosReset();
+        emit pagesChanged();
+        emit currentPageChanged();
         saveConfig(path);
         return true;
     }
     
-    if (!file.open(QIODevice::ReadOnly)) {
-        emit error("Failed to open config file: " + file.errorString());
-        return false;
-    }
-    
-    QByteArray data = file.readAll();
-    file.close();
-    
-    QJsonParseError parseError;
-    QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
-    
-    if (parseError.error != QJsonParseError::NoError) {
-        emit error("Failed to parse config file: " + parseError.errorString());
-        return false;
-    }
-    
-    QJsonObject root = doc.object();
-    
-    // Load grid settings
-    if (root.contains("columns")) {
-        m_columns = root["columns"].toInt(4);
-    }
-    if (root.contains("rows")) {
-        m_rows = root["rows"].toInt(3);
-    }
-    
-    // Load macros
-    m_macros.clear();
-    QJsonArray macrosArray = root["macros"].toArray();
-    
-    for (const QJsonValue &value : macrosArray) {
-        QJsonObject obj = value.toObject();
-        Macro macro;
-        macro.id = obj["id"].toString();
-        macro.name = obj["name"].toString();
-        macro.icon = obj["icon"].toString();
-        macro.color = obj["color"].toString();
+    // The compiled cache skips parsing and compiling while the JSON is unchanged
+    Snapshot loaded;
+    loaded.currentPage = 0;
+    if (!ConfigCache::load(path, loaded, &m_configHash)) {
+        if (!file.open(QIODevice::ReadOnly)) {
+            emit error("Failed to open config file: " + file.errorString());
+            return false;
+        }
         
-        QJsonArray seqArray = obj["sequence"].toArray();
-        for (const QJsonValue &seqVal : seqArray) {
-            macro.sequence.append(seqVal.toObject().toVariantMap());
+        QByteArray data = file.readAll();
+        file.close();
+        
+        QString errorString;
+        loaded.columns = m_columns;
+        loaded.rows = m_rows;
+        if (!parseConfig(data, loaded, &errorString)) {
+            emit error("Failed to parse config file: " + errorString);
+            return false;
         }
         
-        m_macros.append(macro);
+        m_configHash = ConfigCache::hash(data);
+        
+        // Writing the cache compiles every other page; keep that off startup
+        m_ioThread.start([path, data, loaded]() {
+            ConfigCache::save(path, data, loaded);
+        });
     }
     
-    emit macrosChanged();
+    m_columns = loaded.columns;
+    m_rows = loaded.rows;
+    setPages(loaded.pages);
+    m_currentPage = loaded.currentPage;
+    loadMacros(loaded.macros);
+    
     emit columnsChanged();
     emit rowsChanged();
+    emit pagesChanged();
+    emit currentPageChanged();
     emit configLoaded();
     
     return true;
@@ -120,69 +449,69 @@ bool MacroConfig::saveConfig(const QString &filePath)
 {
     QString path = filePath.isEmpty() ? m_configPath : filePath;
     
-    // Ensure directory exists
-    QFileInfo fileInfo(path);
-    QDir dir = fileInfo.dir();
-    if (!dir.exists()) {
-        dir.mkpath(".");
-    }
-    
-    QJsonObject root;
-    root["columns"] = m_columns;
-    root["rows"] = m_rows;
+    // This save covers any requested one; let a running one land first
+    m_saveTimer.stop();
+    m_ioThread.waitForDone();
     
-    QJsonArray macrosArray;
-    for (const Macro &macro : m_macros) {
-        QJsonObject obj;
-        obj["id"] = macro.id;
-        obj["name"] = macro.name;
-        obj["icon"] = macro.icon;
-        obj["color"] = macro.color;
-        
-        QJsonArray seqArray;
-        for (const QVariant &step : macro.sequence) {
-            seqArray.append(QJsonObject::fromVariantMap(step.toMap()));
-        }
-        obj["sequence"] = seqArray;
-        
-        macrosArray.append(obj);
-    }
-    
-    root["macros"] = macrosArray;
-    
-    QJsonDocument doc(root);
-    
-    QFile file(path);
-    if (!file.open(QIODevice::WriteOnly)) {
-        emit error("Failed to save config file: " + file.errorString());
+    QString errorString;
+    uint64_t hash;
+    if (!writeConfigFile(path, snapshot(), &hash, &errorString)) {
+        emit error("Failed to save config file: " + errorString);
         return false;
     }
     
-    file.write(doc.toJson(QJsonDocument::Indented));
-    file.close();
-    
+    if (path == m_watchedPath) {
+        m_configHash = hash;
+    }
     emit configSaved();
     return true;
 }
 
+void MacroConfig::requestSave()
+{
+    m_saveTimer.start();
+}
+
+void MacroConfig::flushSave()
+{
+    if (m_saveTimer.isActive()) {
+        m_saveTimer.stop();
+        startSave();
+    }
+    m_ioThread.waitForDone();
+}
+
 QVariantMap MacroConfig::getMacro(const QString &id) const
 {
-    for (const Macro &macro : m_macros) {
-        if (macro.id == id) {
-            return macroToVariantMap(macro);
-        }
+    const int slot = m_index.value(id, -1);
+    if (slot < 0) {
+        return QVariantMap();
     }
-    return QVariantMap();
+    return macroToVariantMap(slot);
 }
 
 QVariantList MacroConfig::getMacroSequence(const QString &id) const
 {
-    for (const Macro &macro : m_macros) {
-        if (macro.id == id) {
-            return macro.sequence;
-        }
-    }
-    return QVariantList();
+    const int slot = m_index.value(id, -1);
+    return slot < 0 ? QVariantList() : sequenceOf(slot);
+}
+
+MacroProgram MacroConfig::getMacroProgram(const QString &id) const
+{
+    const int slot = m_index.value(id, -1);
+    return slot < 0 ? MacroProgram() : m_slots[slot].macro.program;
+}
+
+int MacroConfig::macroHandle(const QString &id) const
+{
+    const int slot = m_index.value(id, -1);
+    return slot < 0 ? InvalidHandle : handleOf(slot);
+}
+
+const MacroConfig::Macro *MacroConfig::macroAt(int handle) const
+{
+    const int slot = slotOf(handle);
+    return slot < 0 ? nullptr : &m_slots[slot].macro;
 }
 
 void MacroConfig::addMacro(const QVariantMap &macroMap)
@@ -191,40 +520,82 @@ void MacroConfig::addMacro(const QVariantMap &macroMap)
     
     // Generate ID if not provided
     if (macro.id.isEmpty()) {
-        macro.id = "macro_" + QString::number(m_macros.size() + 1);
+        macro.id = uniqueId("macro_" + QString::number(m_order.size() + 1));
+    } else if (m_index.contains(macro.id)) {
+        macro.id = uniqueId(macro.id);
     }
     
-    m_macros.append(macro);
-    emit macrosChanged();
+    const int row = m_order.size();
+    emit macroAboutToBeInserted(row);
+    insertMacro(macro, row);
+    emit macroInserted(row);
+    m_pageEdited = true;
 }
 
 void MacroConfig::updateMacro(const QString &id, const QVariantMap &macroMap)
 {
-    for (int i = 0; i < m_macros.size(); ++i) {
-        if (m_macros[i].id == id) {
-            m_macros[i] = variantMapToMacro(macroMap);
-            m_macros[i].id = id;  // Preserve the ID
-            emit macrosChanged();
-            return;
-        }
+    const int slot = m_index.value(id, -1);
+    if (slot < 0) {
+        return;
     }
+    
+    Macro &macro = m_slots[slot].macro;
+    const QString internedId = macro.id;
+    macro = variantMapToMacro(macroMap);
+    macro.id = internedId;  // Preserve the ID
+    emit macroUpdated(m_order.indexOf(slot));
+    m_pageEdited = true;
 }
 
 void MacroConfig::removeMacro(const QString &id)
 {
-    for (int i = 0; i < m_macros.size(); ++i) {
-        if (m_macros[i].id == id) {
-            m_macros.removeAt(i);
-            emit macrosChanged();
-            return;
+    const int slot = m_index.value(id, -1);
+    if (slot < 0) {
+        return;
+    }
+    
+    removeRow(m_order.indexOf(slot));
+    m_pageEdited = true;
+}
+
+int MacroConfig::addPage(const QString &name)
+{
+    m_pages.append(Page { name, QByteArray("[]"), false, 1, 1 });
+    emit pagesChanged();
+    return m_pages.size() - 1;
+}
+
+void MacroConfig::removePage(int page)
+{
+    if (page < 0 || page >= m_pages.size() || m_pages.size() == 1) {
+        return;
+    }
+    
+    if (page == m_currentPage) {
+        setCurrentPage(page == 0 ? 1 : page - 1);
+        if (page == m_currentPage) {
+            return;  // The neighbour failed to load; keep what is shown
         }
     }
+    
+    // Cached pages are keyed by index, which shifts
+    m_pages.removeAt(page);
+    m_pageCache.clear();
+    m_stalePages.clear();
+    if (page < m_currentPage) {
+        --m_currentPage;
+        emit currentPageChanged();
+    }
+    emit pagesChanged();
 }
 
 void MacroConfig::resetToDefaults()
 {
+    emit macrosAboutToBeReset();
     createDefaultMacros();
-    emit macrosChanged();
+    emit macrosReset();
+    emit pagesChanged();
+    emit currentPageChanged();
 }
 
 QVariantMap MacroConfig::createKeyAction(int keyCode, int modifiers)
@@ -236,11 +607,14 @@ QVariantMap MacroConfig::createKeyAction(int keyCode, int modifiers)
     return action;
 }
 
-QVariantMap MacroConfig::createTextAction(const QString &text)
+QVariantMap MacroConfig::createTextAction(const QString &text, bool packed)
 {
     QVariantMap action;
     action["type"] = "text";
     action["text"] = text;
+    if (packed) {
+        action["packed"] = true;
+    }
     return action;
 }
 
@@ -261,9 +635,65 @@ QVariantMap MacroConfig::createComboAction(const QVariantList &keys, int modifie
     return action;
 }
 
+QVariantMap MacroConfig::createConsumerAction(int usage, int modifiers)
+{
+    QVariantMap action;
+    action["type"] = "consumer";
+    action["usage"] = usage;
+    action["modifiers"] = modifiers;
+    return action;
+}
+
+QVariantMap MacroConfig::createMouseMoveAction(int x, int y)
+{
+    QVariantMap action;
+    action["type"] = "mouse_move";
+    action["x"] = x;
+    action["y"] = y;
+    return action;
+}
+
+QVariantMap MacroConfig::createClickAction(int button, int count)
+{
+    QVariantMap action;
+    action["type"] = "click";
+    action["button"] = button;
+    action["count"] = count;
+    return action;
+}
+
+QVariantMap MacroConfig::createScrollAction(int y, int x)
+{
+    QVariantMap action;
+    action["type"] = "scroll";
+    action["y"] = y;
+    action["x"] = x;
+    return action;
+}
+
+QVariantMap MacroConfig::createPressAction(int keyCode, int modifiers)
+{
+    QVariantMap action;
+    action["type"] = "press";
+    action["keyCode"] = keyCode;
+    action["modifiers"] = modifiers;
+    return action;
+}
+
+QVariantMap MacroConfig::createReleaseAction(int keyCode, int modifiers)
+{
+    QVariantMap action;
+    action["type"] = "release";
+    if (keyCode != 0 || modifiers != 0) {
+        action["keyCode"] = keyCode;
+        action["modifiers"] = modifiers;
+    }
+    return action;
+}
+
 void MacroConfig::createDefaultMacros()
 {
-    m_macros.clear();
+    QList<Macro> macros;
     m_columns = 4;
     m_rows = 3;
     
@@ -276,7 +706,7 @@ void MacroConfig::createDefaultMacros()
     copy.icon = "📋";
     copy.color = "#4CAF50";
     copy.sequence.append(createKeyAction(0x06, 0x01));  // C with Ctrl
-    m_macros.append(copy);
+    macros.append(copy);
     
     // Paste (Ctrl+V)
     Macro paste;
@@ -285,7 +715,7 @@ void MacroConfig::createDefaultMacros()
     paste.icon = "📄";
     paste.color = "#2196F3";
     paste.sequence.append(createKeyAction(0x19, 0x01));  // V with Ctrl
-    m_macros.append(paste);
+    macros.append(paste);
     
     // Cut (Ctrl+X)
     Macro cut;
@@ -294,7 +724,7 @@ void MacroConfig::createDefaultMacros()
     cut.icon = "✂️";
     cut.color = "#FF9800";
     cut.sequence.append(createKeyAction(0x1B, 0x01));  // X with Ctrl
-    m_macros.append(cut);
+    macros.append(cut);
     
     // Undo (Ctrl+Z)
     Macro undo;
@@ -303,7 +733,7 @@ void MacroConfig::createDefaultMacros()
     undo.icon = "↩️";
     undo.color = "#9C27B0";
     undo.sequence.append(createKeyAction(0x1D, 0x01));  // Z with Ctrl
-    m_macros.append(undo);
+    macros.append(undo);
     
     // Redo (Ctrl+Y)
     Macro redo;
@@ -312,7 +742,7 @@ void MacroConfig::createDefaultMacros()
     redo.icon = "↪️";
     redo.color = "#E91E63";
     redo.sequence.append(createKeyAction(0x1C, 0x01));  // Y with Ctrl
-    m_macros.append(redo);
+    macros.append(redo);
     
     // Save (Ctrl+S)
     Macro save;
@@ -321,7 +751,7 @@ void MacroConfig::createDefaultMacros()
     save.icon = "💾";
     save.color = "#00BCD4";
     save.sequence.append(createKeyAction(0x16, 0x01));  // S with Ctrl
-    m_macros.append(save);
+    macros.append(save);
     
     // Select All (Ctrl+A)
     Macro selectAll;
@@ -330,7 +760,7 @@ void MacroConfig::createDefaultMacros()
     selectAll.icon = "🔲";
     selectAll.color = "#607D8B";
     selectAll.sequence.append(createKeyAction(0x04, 0x01));  // A with Ctrl
-    m_macros.append(selectAll);
+    macros.append(selectAll);
     
     // Find (Ctrl+F)
     Macro find;
@@ -339,7 +769,7 @@ void MacroConfig::createDefaultMacros()
     find.icon = "🔍";
     find.color = "#795548";
     find.sequence.append(createKeyAction(0x09, 0x01));  // F with Ctrl
-    m_macros.append(find);
+    macros.append(find);
     
     // New Tab (Ctrl+T)
     Macro newTab;
@@ -348,7 +778,7 @@ void MacroConfig::createDefaultMacros()
     newTab.icon = "➕";
     newTab.color = "#3F51B5";
     newTab.sequence.append(createKeyAction(0x17, 0x01));  // T with Ctrl
-    m_macros.append(newTab);
+    macros.append(newTab);
     
     // Close Tab (Ctrl+W)
     Macro closeTab;
@@ -357,7 +787,7 @@ void MacroConfig::createDefaultMacros()
     closeTab.icon = "❌";
     closeTab.color = "#F44336";
     closeTab.sequence.append(createKeyAction(0x1A, 0x01));  // W with Ctrl
-    m_macros.append(closeTab);
+    macros.append(closeTab);
     
     // Mute
     Macro mute;
@@ -365,8 +795,8 @@ void MacroConfig::createDefaultMacros()
     mute.name = "Mute";
     mute.icon = "🔇";
     mute.color = "#9E9E9E";
-    mute.sequence.append(createKeyAction(0x7F, 0x00));  // Volume Mute
-    m_macros.append(mute);
+    mute.sequence.append(createConsumerAction(0xE2));  // Mute
+    macros.append(mute);
     
     // Play/Pause (Media key)
     Macro playPause;
@@ -374,18 +804,31 @@ void MacroConfig::createDefaultMacros()
     playPause.name = "Play/Pause";
     playPause.icon = "⏯️";
     playPause.color = "#8BC34A";
-    playPause.sequence.append(createKeyAction(0xCD, 0x00));  // Media Play/Pause
-    m_macros.append(playPause);
+    playPause.sequence.append(createConsumerAction(0xCD));  // Play/Pause
+    macros.append(playPause);
+    
+    setPages(QList<Page> { Page { QString(), QByteArray(), false, 1, 1 } });
+    m_currentPage = 0;
+    clearMacros();
+    for (Macro &macro : macros) {
+        macro.program = MacroCompiler::compile(macro.sequence, macro.stepGapMs);
+        insertMacro(macro, m_order.size());
+    }
 }
 
-QVariantMap MacroConfig::macroToVariantMap(const Macro &macro) const
+QVariantMap MacroConfig::macroToVariantMap(int slot) const
 {
+    const Macro &macro = m_slots[slot].macro;
+    
     QVariantMap map;
     map["id"] = macro.id;
+    map["handle"] = handleOf(slot);
     map["name"] = macro.name;
     map["icon"] = macro.icon;
     map["color"] = macro.color;
-    map["sequence"] = macro.sequence;
+    map["stepGapMs"] = macro.stepGapMs;
+    map["policy"] = policyName(macro.policy);
+    map["sequence"] = sequenceOf(slot);
     return map;
 }
 
@@ -396,6 +839,402 @@ MacroConfig::Macro MacroConfig::variantMapToMacro(const QVariantMap &map) const
     macro.name = map.value("name").toString();
     macro.icon = map.value("icon").toString();
     macro.color = map.value("color", "#666666").toString();
+    macro.stepGapMs = map.value("stepGapMs", MacroCompiler::DefaultStepGapMs).toInt();
+    macro.policy = policyFromName(map.value("policy").toString());
     macro.sequence = map.value("sequence").toList();
+    macro.program = MacroCompiler::compile(macro.sequence, macro.stepGapMs);
     return macro;
 }
+
+QString MacroConfig::uniqueId(const QString &id) const
+{
+    QString candidate = id;
+    for (int suffix = 2; m_index.contains(candidate); ++suffix) {
+        candidate = id + "_" + QString::number(suffix);
+    }
+    return candidate;
+}
+
+const QVariantList &MacroConfig::sequenceOf(int slot) const
+{
+    // Sequences from the cache are only needed for editing and saving
+    Macro &macro = m_slots[slot].macro;
+    if (!macro.sequenceJson.isEmpty()) {
+        macro.sequence = QJsonDocument::fromJson(macro.sequenceJson).array().toVariantList();
+        macro.sequenceJson.clear();
+    }
+    return macro.sequence;
+}
+
+void MacroConfig::loadMacros(const QList<Macro> &macros)
+{
+    emit macrosAboutToBeReset();
+    clearMacros();
+    for (const Macro &macro : macros) {
+        insertMacro(macro, m_order.size());
+    }
+    emit macrosReset();
+}
+
+void MacroConfig::setPages(const QList<Page> &pages)
+{
+    m_pages = pages;
+    m_pageCache.clear();
+    m_stalePages.clear();
+    m_pageEdited = false;
+}
+
+void MacroConfig::recompile()
+{
+    for (int slot : m_order) {
+        Macro &macro = m_slots[slot].macro;
+        macro.program = MacroCompiler::compile(sequenceOf(slot), macro.stepGapMs);
+    }
+    m_pageEdited = true;
+    
+    // Cache records hold programs too; JSON pages compile when decoded
+    for (int index = 0; index < m_pages.size(); ++index) {
+        Page &page = m_pages[index];
+        if (index == m_currentPage || !page.compiled) {
+            continue;
+        }
+        QList<Macro> macros;
+        if (!ConfigCache::decodePage(page.source, macros)) {
+            continue;  // Reported when the page is shown
+        }
+        recompileMacros(macros);
+        page.source = ConfigCache::encodePage(macros);
+    }
+    
+    // Looking entries up would reorder the cache, so mark them instead
+    const QList<int> cached = m_pageCache.keys();
+    m_stalePages = QSet<int>(cached.begin(), cached.end());
+}
+
+void MacroConfig::recompileMacros(QList<Macro> &macros)
+{
+    for (Macro &macro : macros) {
+        if (!macro.sequenceJson.isEmpty()) {
+            macro.sequence = QJsonDocument::fromJson(macro.sequenceJson).array().toVariantList();
+            macro.sequenceJson.clear();
+        }
+        macro.program = MacroCompiler::compile(macro.sequence, macro.stepGapMs);
+    }
+}
+
+void MacroConfig::stashCurrentPage()
+{
+    QList<Macro> *macros = new QList<Macro>();
+    macros->reserve(m_order.size());
+    for (int slot : m_order) {
+        macros->append(m_slots[slot].macro);
+    }
+    
+    // The cache record decodes without parsing or compiling again
+    Page &page = m_pages[m_currentPage];
+    if (m_pageEdited || page.source.isEmpty()) {
+        page.source = ConfigCache::encodePage(*macros);
+        page.compiled = true;
+        m_pageEdited = false;
+    }
+    m_pageCache.insert(m_currentPage, macros);
+}
+
+MacroConfig::Snapshot MacroConfig::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.columns = m_columns;
+    snapshot.rows = m_rows;
+    snapshot.currentPage = m_currentPage;
+    snapshot.pages = m_pages;
+    snapshot.macros.reserve(m_order.size());
+    for (int slot : m_order) {
+        snapshot.macros.append(m_slots[slot].macro);
+    }
+    return snapshot;
+}
+
+void MacroConfig::startSave()
+{
+    // Serializing and writing only touch the snapshot, so they can run on
+    // the save thread while the UI keeps editing
+    const QString path = m_configPath;
+    const Snapshot saved = snapshot();
+    ++m_savesInFlight;
+    
+    m_ioThread.start([this, path, saved]() {
+        QString errorString;
+        uint64_t hash = 0;
+        const bool ok = writeConfigFile(path, saved, &hash, &errorString);
+        QMetaObject::invokeMethod(this, [this, path, ok, hash, errorString]() {
+            onSaveFinished(path, ok, hash, errorString);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MacroConfig::onSaveFinished(const QString &path, bool saved, uint64_t hash, const QString &errorString)
+{
+    --m_savesInFlight;
+    if (!saved) {
+        emit error("Failed to save config file: " + errorString);
+        return;
+    }
+    
+    // Our own write shows up in the watcher too; the hash makes it a no-op
+    if (path == m_watchedPath) {
+        m_configHash = hash;
+    }
+    emit configSaved();
+}
+
+void MacroConfig::watchConfig(const QString &path)
+{
+    if (path == m_watchedPath) {
+        return;
+    }
+    
+    if (!m_watcher.files().isEmpty()) {
+        m_watcher.removePaths(m_watcher.files());
+    }
+    if (!m_watcher.directories().isEmpty()) {
+        m_watcher.removePaths(m_watcher.directories());
+    }
+    
+    // Atomic replacement renames a new file over the old one, which ends
+    // a file watch; the directory watch notices and the file is re-added
+    m_watchedPath = path;
+    const QString dirPath = QFileInfo(path).absolutePath();
+    QDir().mkpath(dirPath);
+    m_watcher.addPath(dirPath);
+    if (QFile::exists(path)) {
+        m_watcher.addPath(path);
+    }
+}
+
+void MacroConfig::onConfigFileChanged()
+{
+    if (!m_watcher.files().contains(m_watchedPath) && QFile::exists(m_watchedPath)) {
+        m_watcher.addPath(m_watchedPath);
+    }
+    m_reloadTimer.start();
+}
+
+void MacroConfig::startReload()
+{
+    const QString path = m_watchedPath;
+    const uint64_t currentHash = m_configHash;
+    Snapshot base;
+    base.columns = m_columns;
+    base.rows = m_rows;
+    base.currentPage = m_currentPage;
+    
+    // Reading, hashing, parsing and compiling all happen on the I/O thread,
+    // after any save already queued there
+    m_ioThread.start([this, path, currentHash, base]() {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        const QByteArray data = file.readAll();
+        const uint64_t hash = ConfigCache::hash(data);
+        if (hash == currentHash) {
+            return;
+        }
+        
+        Snapshot parsed = base;
+        QString errorString;
+        const bool ok = parseConfig(data, parsed, &errorString);
+        if (ok) {
+            ConfigCache::save(path, data, parsed);
+            
+            // Every page gets a source, in case another page is shown by now
+            Page &page = parsed.pages[parsed.currentPage];
+            page.source = ConfigCache::encodePage(parsed.macros);
+            page.compiled = true;
+        }
+        
+        QMetaObject::invokeMethod(this, [this, path, ok, hash, parsed, errorString]() {
+            applyReload(path, ok, hash, parsed, errorString);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void MacroConfig::applyReload(const QString &path, bool parsed, uint64_t hash,
+                              const Snapshot &incoming, const QString &errorString)
+{
+    if (path != m_watchedPath || hash == m_configHash) {
+        return;
+    }
+    if (!parsed) {
+        emit error("Failed to parse config file: " + errorString);
+        return;
+    }
+    
+    // Text was compiled for a layout or input method changed since
+    if (incoming.layout != KeyboardLayout::current().id() || incoming.unicodeInput != UnicodeInput::current()) {
+        startReload();
+        return;
+    }
+    
+    // A local save is about to overwrite the file anyway; last writer wins
+    if (m_saveTimer.isActive() || m_savesInFlight > 0) {
+        qWarning() << "Config file changed while local edits are pending, keeping local edits";
+        return;
+    }
+    
+    qDebug() << "Config file changed, applying differences";
+    m_configHash = hash;
+    setColumns(incoming.columns);
+    setRows(incoming.rows);
+    
+    // Stay on the page shown now if the file still has it; the user may
+    // have flipped pages since the parse started
+    int page = m_currentPage < incoming.pages.size() ? m_currentPage : 0;
+    QList<Macro> macros = incoming.macros;
+    if (page != incoming.currentPage) {
+        QString pageError;
+        if (!decodePage(incoming.pages[page], macros, &pageError)) {
+            emit error(QString("Failed to load page %1: %2").arg(page + 1).arg(pageError));
+            page = incoming.currentPage;
+            macros = incoming.macros;
+        }
+    }
+    
+    const QStringList names = pageNames();
+    setPages(incoming.pages);
+    if (pageNames() != names) {
+        emit pagesChanged();
+    }
+    
+    if (page != m_currentPage) {
+        m_currentPage = page;
+        loadMacros(macros);
+        emit currentPageChanged();
+        emit configLoaded();
+        return;
+    }
+    
+    // Drop macros that are gone, from the bottom so rows stay valid
+    QSet<QString> incomingIds;
+    for (const Macro &macro : macros) {
+        incomingIds.insert(macro.id);
+    }
+    for (int row = m_order.size() - 1; row >= 0; --row) {
+        if (!incomingIds.contains(m_slots[m_order[row]].macro.id)) {
+            removeRow(row);
+        }
+    }
+    
+    // Everything above row already matches the new file
+    for (int row = 0; row < macros.size(); ++row) {
+        const Macro &macro = macros[row];
+        const int slot = m_index.value(macro.id, -1);
+        
+        if (slot < 0) {
+            emit macroAboutToBeInserted(row);
+            insertMacro(macro, row);
+            emit macroInserted(row);
+            continue;
+        }
+        
+        const int current = m_order.indexOf(slot, row);
+        if (current != row) {
+            emit macroAboutToBeMoved(current, row);
+            m_order.move(current, row);
+            emit macroMoved(current, row);
+        }
+        
+        if (!sameMacro(slot, macro)) {
+            Macro &existing = m_slots[slot].macro;
+            const QString internedId = existing.id;
+            existing = macro;
+            existing.id = internedId;
+            emit macroUpdated(row);
+        }
+    }
+    emit configLoaded();
+}
+
+bool MacroConfig::sameMacro(int slot, const Macro &other) const
+{
+    const Macro &macro = m_slots[slot].macro;
+    return macro.name == other.name
+        && macro.icon == other.icon
+        && macro.color == other.color
+        && macro.stepGapMs == other.stepGapMs
+        && macro.policy == other.policy
+        && macro.program.size() == other.program.size()
+        && memcmp(macro.program.constData(), other.program.constData(),
+                  macro.program.size() * sizeof(MacroInstruction)) == 0
+        && sequenceOf(slot) == other.sequence;
+}
+
+int MacroConfig::handleOf(int slot) const
+{
+    return (m_slots[slot].generation << HANDLE_SLOT_BITS) | slot;
+}
+
+int MacroConfig::slotOf(int handle) const
+{
+    if (handle < 0) {
+        return -1;
+    }
+    
+    const int slot = handle & HANDLE_SLOT_MASK;
+    if (slot >= m_slots.size() || !m_slots[slot].used
+        || m_slots[slot].generation != (handle >> HANDLE_SLOT_BITS)) {
+        return -1;
+    }
+    return slot;
+}
+
+int MacroConfig::insertMacro(const Macro &macro, int row)
+{
+    int slot;
+    if (!m_freeSlots.isEmpty()) {
+        slot = m_freeSlots.takeLast();
+    } else {
+        slot = m_slots.size();
+        m_slots.append(Slot { Macro(), 0, false });
+    }
+    
+    Slot &entry = m_slots[slot];
+    entry.macro = macro;
+    entry.used = true;
+    
+    // The index key and Macro::id share one string buffer
+    m_index.insert(entry.macro.id, slot);
+    m_order.insert(row, slot);
+    return slot;
+}
+
+void MacroConfig::removeRow(int row)
+{
+    const int slot = m_order[row];
+    
+    emit macroAboutToBeRemoved(row);
+    m_index.remove(m_slots[slot].macro.id);
+    m_order.removeAt(row);
+    releaseSlot(slot);
+    emit macroRemoved(row);
+}
+
+void MacroConfig::clearMacros()
+{
+    // Keep the slots so handles from before the reload go stale instead
+    // of pointing at whatever macro lands in the same slot
+    for (int slot : m_order) {
+        releaseSlot(slot);
+    }
+    m_order.clear();
+    m_index.clear();
+}
+
+void MacroConfig::releaseSlot(int slot)
+{
+    Slot &entry = m_slots[slot];
+    entry.macro = Macro();
+    entry.generation = (entry.generation + 1) & HANDLE_GENERATION_MASK;
+    entry.used = false;
+    m_freeSlots.append(slot);
+}
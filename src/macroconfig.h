@@ -1,29 +1,67 @@
 #ifndef MACROCONFIG_H
 #define MACROCONFIG_H
 
+#include <QCache>
+#include <QFileSystemWatcher>
+#include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QVariantList>
 #include <QVariantMap>
 #include <QString>
+#include <QStringList>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
+#include <QThreadPool>
+#include <QTimer>
+
+#include "macrocompiler.h"
+#include "macroprogram.h"
 
 /**
  * @brief MacroConfig - Manages macro button configurations
  * 
  * This class handles loading, saving, and managing macro configurations.
  * Macros are stored as JSON and can be customized by the user.
+ *
+ * Macros live in slots indexed by an id hash, so lookups by id or handle
+ * take constant time however many macros a layout has. A handle stays
+ * valid until its macro is removed; a stale handle never resolves to the
+ * macro that reused its slot.
+ *
+ * Edits from the UI go through requestSave(): a burst of changes turns
+ * into one save, serialized and written on a background thread, and the
+ * file is replaced atomically so a power cut leaves either the old or
+ * the new config.
+ *
+ * The loaded file is watched. When something else rewrites it, the new
+ * version is parsed and compiled on the I/O thread, then only the
+ * macros that were added, removed, moved or changed are applied, with
+ * per-row signals, so a pushed config updates the grid in place.
+ *
+ * A layout is split into pages of one grid each. Only the current page
+ * is materialized into slots; every other page stays in the form it was
+ * read in (a slice of the JSON or a record of the compiled cache) and is
+ * decoded when it is shown. Recently shown pages are kept decoded in a
+ * small LRU, so flipping back and forth does not decode again.
  */
 class MacroConfig : public QObject
 {
     Q_OBJECT
-    Q_PROPERTY(QVariantList macros READ macros NOTIFY macrosChanged)
     Q_PROPERTY(int columns READ columns WRITE setColumns NOTIFY columnsChanged)
     Q_PROPERTY(int rows READ rows WRITE setRows NOTIFY rowsChanged)
+    Q_PROPERTY(int currentPage READ currentPage WRITE setCurrentPage NOTIFY currentPageChanged)
+    Q_PROPERTY(QStringList pageNames READ pageNames NOTIFY pagesChanged)
 
 public:
     explicit MacroConfig(QObject *parent = nullptr);
+    ~MacroConfig();
+
+    /**
+     * @brief Handle value that never refers to a macro
+     */
+    static const int InvalidHandle = -1;
 
     /**
      * @brief Structure representing a single macro
@@ -34,15 +72,104 @@ public:
         QString icon;
         QString color;
         QVariantList sequence;  // List of actions
+        QByteArray sequenceJson; // Sequence not yet decoded from the cache
+        int stepGapMs = MacroCompiler::DefaultStepGapMs;  // Pause between actions, may be 0
+        ExecutionPolicy policy = ExecutionPolicy::Queue;  // When started during another macro
+        MacroProgram program;   // Compiled form of sequence
     };
 
-    QVariantList macros() const;
+    /**
+     * @brief A page of macros in its stored form
+     */
+    struct Page {
+        QString name;
+        QByteArray source;      // The page's macros: JSON array or cache record
+        bool compiled;          // source is a cache record
+        int line;               // Where JSON source starts in the file, for messages
+        int column;
+    };
+
+    /**
+     * @brief Copy of the whole configuration; cheap, as all members are shared
+     *
+     * macros holds the decoded current page; that page's source may be stale.
+     * Every program in it, and every page compiled from it, types text for
+     * layout and unicodeInput.
+     */
+    struct Snapshot {
+        int columns;
+        int rows;
+        int currentPage;
+        QList<Page> pages;
+        QList<Macro> macros;
+        KeyboardLayout::Id layout = KeyboardLayout::current().id();
+        UnicodeInput::Method unicodeInput = UnicodeInput::current();
+    };
+
+    /**
+     * @brief Name of a policy in the config: "queue", "preempt" or "parallel"
+     */
+    static QString policyName(ExecutionPolicy policy);
+
+    /**
+     * @brief Policy for a name from the config
+     * @param ok Set to false for an unknown name, which gives Queue
+     */
+    static ExecutionPolicy policyFromName(const QString &name, bool *ok = nullptr);
+
+    /**
+     * @brief Decode the macros of a page that is not materialized
+     *
+     * Touches no MacroConfig state, so it may run on the I/O thread.
+     * A JSON page is compiled for layout and unicodeInput; a cache
+     * record keeps the programs it was encoded with.
+     */
+    static bool decodePage(const Page &page, QList<Macro> &macros, QString *errorString = nullptr,
+                           KeyboardLayout::Id layout = KeyboardLayout::current().id(),
+                           UnicodeInput::Method unicodeInput = UnicodeInput::current());
+
     int columns() const;
     int rows() const;
 
     void setColumns(int columns);
     void setRows(int rows);
 
+    int currentPage() const;
+    QStringList pageNames() const;
+
+    /**
+     * @brief Show another page, decoding it unless it is in the LRU
+     */
+    void setCurrentPage(int page);
+
+    /**
+     * @brief Number of macros on the current page
+     */
+    int count() const;
+
+    /**
+     * @brief Macro at a display position, or nullptr if out of range
+     */
+    const Macro *macroAtRow(int row) const;
+
+    /**
+     * @brief Handle of the macro at a display position, or InvalidHandle
+     */
+    int handleAtRow(int row) const;
+
+    /**
+     * @brief Display position of a macro, or -1; linear in the macro count
+     */
+    int rowOf(int handle) const;
+
+    /**
+     * @brief Compile every macro again for the current keyboard layout and Unicode input
+     *
+     * The current page and the decoded pages stay where they are; pages not
+     * decoded yet are compiled again when they are next shown.
+     */
+    void recompile();
+
 public slots:
     /**
      * @brief Load macros from the configuration file
@@ -54,6 +181,18 @@ public slots:
      */
     bool saveConfig(const QString &filePath = QString());
 
+    /**
+     * @brief Save to the configuration file soon, off the GUI thread
+     *
+     * Calls within the debounce interval of each other share one save.
+     */
+    void requestSave();
+
+    /**
+     * @brief Finish any requested or running save before returning
+     */
+    void flushSave();
+
     /**
      * @brief Get a macro by ID
      */
@@ -64,6 +203,26 @@ public slots:
      */
     QVariantList getMacroSequence(const QString &id) const;
 
+    /**
+     * @brief Get the compiled program of a macro by ID
+     */
+    MacroProgram getMacroProgram(const QString &id) const;
+
+    /**
+     * @brief Stable handle of a macro, or InvalidHandle
+     *
+     * Each map from getMacro() carries its handle as "handle" too.
+     */
+    int macroHandle(const QString &id) const;
+
+    /**
+     * @brief Macro behind a handle, or nullptr if it was removed
+     *
+     * Does not allocate. The pointer is only valid until the next change
+     * to the configuration.
+     */
+    const Macro *macroAt(int handle) const;
+
     /**
      * @brief Add a new macro
      */
@@ -79,6 +238,17 @@ public slots:
      */
     void removeMacro(const QString &id);
 
+    /**
+     * @brief Append an empty page
+     * @return Index of the new page
+     */
+    int addPage(const QString &name);
+
+    /**
+     * @brief Remove a page; the last page left cannot be removed
+     */
+    void removePage(int page);
+
     /**
      * @brief Reset to default configuration
      */
@@ -92,7 +262,7 @@ public slots:
     /**
      * @brief Create a text typing action
      */
-    static QVariantMap createTextAction(const QString &text);
+    static QVariantMap createTextAction(const QString &text, bool packed = false);
 
     /**
      * @brief Create a delay action
@@ -104,23 +274,109 @@ public slots:
      */
     static QVariantMap createComboAction(const QVariantList &keys, int modifiers);
 
+    /**
+     * @brief Create a media key action (a Consumer Control usage)
+     */
+    static QVariantMap createConsumerAction(int usage, int modifiers = 0);
+
+    /**
+     * @brief Create an action that moves the mouse pointer
+     */
+    static QVariantMap createMouseMoveAction(int x, int y);
+
+    /**
+     * @brief Create a mouse click action; button 1 is left, 2 right, 3 middle
+     */
+    static QVariantMap createClickAction(int button = 1, int count = 1);
+
+    /**
+     * @brief Create a scroll action, in wheel notches
+     */
+    static QVariantMap createScrollAction(int y, int x = 0);
+
+    /**
+     * @brief Create an action that holds a key and modifiers down
+     */
+    static QVariantMap createPressAction(int keyCode, int modifiers = 0);
+
+    /**
+     * @brief Create an action that lets go of held keys
+     *
+     * With neither a key nor modifiers, everything held is released.
+     */
+    static QVariantMap createReleaseAction(int keyCode = 0, int modifiers = 0);
+
 signals:
-    void macrosChanged();
+    // Per-row notifications for models, emitted around each change the
+    // same way QAbstractItemModel's begin/end calls are paired
+    void macroAboutToBeInserted(int row);
+    void macroInserted(int row);
+    void macroAboutToBeRemoved(int row);
+    void macroRemoved(int row);
+    void macroAboutToBeMoved(int from, int to);
+    void macroMoved(int from, int to);
+    void macroUpdated(int row);
+    void macrosAboutToBeReset();
+    void macrosReset();
     void columnsChanged();
     void rowsChanged();
+    void currentPageChanged();
+    void pagesChanged();
     void configLoaded();
     void configSaved();
     void error(const QString &message);
 
 private:
     void createDefaultMacros();
-    QVariantMap macroToVariantMap(const Macro &macro) const;
+    QVariantMap macroToVariantMap(int slot) const;
+    const QVariantList &sequenceOf(int slot) const;
+    void loadMacros(const QList<Macro> &macros);
+    void setPages(const QList<Page> &pages);
+    void stashCurrentPage();
+    static void recompileMacros(QList<Macro> &macros);
+    Snapshot snapshot() const;
+    void startSave();
+    void onSaveFinished(const QString &path, bool saved, uint64_t hash, const QString &errorString);
+    void watchConfig(const QString &path);
+    void onConfigFileChanged();
+    void startReload();
+    void applyReload(const QString &path, bool parsed, uint64_t hash,
+                     const Snapshot &incoming, const QString &errorString);
+    bool sameMacro(int slot, const Macro &other) const;
     Macro variantMapToMacro(const QVariantMap &map) const;
+    QString uniqueId(const QString &id) const;
+    int handleOf(int slot) const;
+    int slotOf(int handle) const;
+    int insertMacro(const Macro &macro, int row);
+    void removeRow(int row);
+    void clearMacros();
+    void releaseSlot(int slot);
+
+    struct Slot {
+        Macro macro;
+        int generation;  // Bumped on removal, invalidating old handles
+        bool used;
+    };
 
-    QList<Macro> m_macros;
+    mutable QList<Slot> m_slots;   // Mutable for decoding sequences on first use
+    QList<int> m_freeSlots;
+    QList<int> m_order;            // Slots in display order
+    QHash<QString, int> m_index;   // Macro id to slot; keys share Macro::id's buffer
     int m_columns;
     int m_rows;
+    QList<Page> m_pages;
+    int m_currentPage;
+    bool m_pageEdited;             // Current page changed since it was decoded
+    QCache<int, QList<Macro>> m_pageCache;  // Decoded pages by index, least recently shown evicted first
+    QSet<int> m_stalePages;        // Cached pages compiled for an earlier layout
     QString m_configPath;
+    QTimer m_saveTimer;
+    int m_savesInFlight;
+    QFileSystemWatcher m_watcher;
+    QString m_watchedPath;
+    uint64_t m_configHash;         // Of the file as last loaded or saved by us
+    QTimer m_reloadTimer;
+    QThreadPool m_ioThread;        // One thread, so saves and reloads stay in order
 };
 
 #endif // MACROCONFIG_H
@@ -1,11 +1,22 @@
 #include "macrocontroller.h"
+#include "keyboardlayout.h"
+#include "unicodeinput.h"
 
+#include <QDateTime>
 #include <QDebug>
+#include <QSettings>
+#include <QStandardPaths>
+
+// A click older than this did not lead to the macro being executed
+static const int64_t STALE_CLICK_NS = 1000000000LL;
 
 MacroController::MacroController(QObject *parent)
     : QObject(parent)
     , m_bluetooth(new BluetoothHID(this))
     , m_config(new MacroConfig(this))
+    , m_model(new MacroListModel(m_config, this))
+    , m_paster(new TextPaster(m_bluetooth, this))
+    , m_paste { MacroConfig::InvalidHandle, QString() }
 {
     // Connect Bluetooth signals
     connect(m_bluetooth, &BluetoothHID::connectedChanged,
@@ -20,16 +31,28 @@ MacroController::MacroController(QObject *parent)
             this, &MacroController::onBluetoothError);
     connect(m_bluetooth, &BluetoothHID::macroComplete,
             this, &MacroController::onMacroComplete);
+    connect(m_bluetooth, &BluetoothHID::typingRateChanged,
+            this, &MacroController::typingRateChanged);
+    connect(m_bluetooth, &BluetoothHID::maxTypingRateChanged,
+            this, &MacroController::maxTypingRateChanged);
     
     // Connect config signals
-    connect(m_config, &MacroConfig::macrosChanged,
-            this, &MacroController::macrosChanged);
     connect(m_config, &MacroConfig::columnsChanged,
             this, &MacroController::columnsChanged);
     connect(m_config, &MacroConfig::rowsChanged,
             this, &MacroController::rowsChanged);
+    connect(m_config, &MacroConfig::currentPageChanged,
+            this, &MacroController::currentPageChanged);
+    connect(m_config, &MacroConfig::pagesChanged,
+            this, &MacroController::pagesChanged);
     connect(m_config, &MacroConfig::error,
             this, &MacroController::onConfigError);
+    
+    // Connect paster signals
+    connect(m_paster, &TextPaster::error,
+            this, &MacroController::error);
+    connect(m_paster, &TextPaster::finished,
+            this, &MacroController::onPasteFinished);
 }
 
 MacroController::~MacroController()
@@ -56,9 +79,14 @@ QString MacroController::deviceName() const
     return m_bluetooth->deviceName();
 }
 
-QVariantList MacroController::macros() const
+MacroListModel *MacroController::macroModel() const
+{
+    return m_model;
+}
+
+TextPaster *MacroController::paster() const
 {
-    return m_config->macros();
+    return m_paster;
 }
 
 int MacroController::columns() const
@@ -71,6 +99,26 @@ int MacroController::rows() const
     return m_config->rows();
 }
 
+int MacroController::currentPage() const
+{
+    return m_config->currentPage();
+}
+
+QStringList MacroController::pageNames() const
+{
+    return m_config->pageNames();
+}
+
+int MacroController::typingRate() const
+{
+    return m_bluetooth->typingRate();
+}
+
+int MacroController::maxTypingRate() const
+{
+    return m_bluetooth->maxTypingRate();
+}
+
 void MacroController::setDiscoverable(bool discoverable)
 {
     m_bluetooth->setDiscoverable(discoverable);
@@ -81,10 +129,77 @@ void MacroController::setDeviceName(const QString &name)
     m_bluetooth->setDeviceName(name);
 }
 
+void MacroController::setCurrentPage(int page)
+{
+    m_config->setCurrentPage(page);
+}
+
+void MacroController::setMaxTypingRate(int charsPerSecond)
+{
+    m_bluetooth->setMaxTypingRate(charsPerSecond);
+}
+
+QString MacroController::keyboardLayout() const
+{
+    return KeyboardLayout::current().name();
+}
+
+QStringList MacroController::keyboardLayouts() const
+{
+    return KeyboardLayout::names();
+}
+
+void MacroController::setKeyboardLayout(const QString &name)
+{
+    const KeyboardLayout *layout = KeyboardLayout::find(name);
+    if (!layout || layout == &KeyboardLayout::current()) {
+        return;
+    }
+    
+    KeyboardLayout::setCurrent(*layout);
+    QSettings().setValue("typing/layout", layout->name());
+    
+    // Programs type characters through the layout, so build them again
+    m_config->recompile();
+    emit keyboardLayoutChanged();
+}
+
+QString MacroController::unicodeInput() const
+{
+    return UnicodeInput::name(UnicodeInput::current());
+}
+
+QStringList MacroController::unicodeInputs() const
+{
+    return UnicodeInput::names();
+}
+
+void MacroController::setUnicodeInput(const QString &name)
+{
+    bool ok = false;
+    const UnicodeInput::Method method = UnicodeInput::fromName(name, &ok);
+    if (!ok || method == UnicodeInput::current()) {
+        return;
+    }
+    
+    UnicodeInput::setCurrent(method);
+    QSettings().setValue("typing/unicode", UnicodeInput::name(method));
+    
+    m_config->recompile();
+    emit unicodeInputChanged();
+}
+
 bool MacroController::initialize()
 {
     qDebug() << "Initializing MacroController...";
     
+    // Text in the config is compiled for the host's layout
+    const KeyboardLayout *layout = KeyboardLayout::find(QSettings().value("typing/layout", "us").toString());
+    if (layout) {
+        KeyboardLayout::setCurrent(*layout);
+    }
+    UnicodeInput::setCurrent(UnicodeInput::fromName(QSettings().value("typing/unicode", "none").toString()));
+    
     // Load macro configuration
     if (!m_config->loadConfig()) {
         qWarning() << "Failed to load macro configuration, using defaults";
@@ -101,22 +216,164 @@ bool MacroController::initialize()
 
 void MacroController::executeMacro(const QString &macroId)
 {
-    qDebug() << "Executing macro:" << macroId;
+    if (!beginPress()) {
+        return;
+    }
+    
+    const int64_t lookupStartNs = monotonicNowNs();
+    const int handle = m_config->macroHandle(macroId);
+    if (handle == MacroConfig::InvalidHandle) {
+        m_bluetooth->latencyMonitor()->takePress();
+        emit error("Macro not found: " + macroId);
+        return;
+    }
+    
+    runMacro(handle, lookupStartNs);
+}
+
+void MacroController::executeMacroHandle(int handle)
+{
+    if (!beginPress()) {
+        return;
+    }
+    
+    runMacro(handle, monotonicNowNs());
+}
+
+bool MacroController::beginPress()
+{
+    LatencyMonitor *latency = m_bluetooth->latencyMonitor();
+    const int64_t startNs = monotonicNowNs();
+    const int64_t clickNs = latency->pressTime();
+    
+    if (clickNs > 0 && startNs - clickNs < STALE_CLICK_NS) {
+        latency->record(LatencyMonitor::Click, startNs - clickNs);
+    } else {
+        latency->markPress(startNs);
+    }
     
     if (!m_bluetooth->isConnected()) {
+        latency->takePress();
         emit error("Not connected to any device. Please pair first.");
+        return false;
+    }
+    return true;
+}
+
+void MacroController::runMacro(int handle, int64_t lookupStartNs)
+{
+    LatencyMonitor *latency = m_bluetooth->latencyMonitor();
+    
+    const MacroConfig::Macro *macro = m_config->macroAt(handle);
+    latency->record(LatencyMonitor::Lookup, monotonicNowNs() - lookupStartNs);
+    
+    if (!macro) {
+        latency->takePress();
+        emit error("Macro not found");
         return;
     }
     
-    QVariantList sequence = m_config->getMacroSequence(macroId);
+    // A paste queues only a few chunks ahead, so a queued macro, or
+    // another paste, waits for it to end instead of typing into it
+    const bool streams = MacroCompiler::streams(macro->program);
+    if (m_paster->isActive() && (streams || macro->policy == ExecutionPolicy::Queue)) {
+        latency->takePress();
+        m_held.enqueue(handle);
+        m_model->setExecuting(handle, true);
+        return;
+    }
     
-    if (sequence.isEmpty()) {
-        emit error("Macro not found: " + macroId);
+    qDebug() << "Executing macro:" << macro->id;
+    
+    // Macros with streamed text are encoded while they play
+    if (streams) {
+        latency->takePress();
+        if (m_paster->start(m_config->getMacroSequence(macro->id), macro->stepGapMs)) {
+            m_paste = Run { handle, macro->id };
+            m_model->setExecuting(handle, true);
+        }
         return;
     }
     
-    m_currentMacroId = macroId;
-    m_bluetooth->executeMacro(sequence);
+    // An empty macro still runs, so it completes like any other; its only
+    // report is the closing release, which measures no press
+    if (macro->program.isEmpty()) {
+        latency->takePress();
+    }
+    
+    const int64_t stageNs = monotonicNowNs();
+    const int run = m_bluetooth->executeProgram(macro->program, macro->policy);
+    latency->record(LatencyMonitor::Schedule, monotonicNowNs() - stageNs);
+    
+    if (run >= 0) {
+        m_runs.insert(run, Run { handle, macro->id });
+        m_model->setExecuting(handle, true);
+    }
+}
+
+void MacroController::pasteText(const QString &text, bool packed)
+{
+    m_paster->pasteText(text, packed);
+}
+
+void MacroController::pasteFile(const QString &path, bool packed)
+{
+    m_paster->pasteFile(path, packed);
+}
+
+void MacroController::cancelPaste()
+{
+    m_paster->cancel();
+}
+
+void MacroController::onPasteFinished(bool completed)
+{
+    const Run finished = m_paste;
+    m_paste = Run { MacroConfig::InvalidHandle, QString() };
+    if (!finished.macroId.isEmpty()) {
+        if (completed) {
+            emit macroExecuted(finished.macroId);
+        }
+        m_model->setExecuting(finished.handle, false);
+    }
+    
+    // Held macros run in order once the paste is through, until one of
+    // them starts a paste again; an unfinished paste drops them, as
+    // cancelling it preempts whatever was queued behind it
+    while (!m_held.isEmpty() && !m_paster->isActive()) {
+        const int handle = m_held.dequeue();
+        m_model->setExecuting(handle, false);
+        if (completed) {
+            runMacro(handle, monotonicNowNs());
+        }
+    }
+}
+
+void MacroController::markClick()
+{
+    m_bluetooth->latencyMonitor()->markPress(monotonicNowNs());
+}
+
+QVariantList MacroController::latencyStats() const
+{
+    return m_bluetooth->latencyMonitor()->summary();
+}
+
+QString MacroController::dumpLatency()
+{
+    QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QString path = dataDir + "/latency-" + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + ".csv";
+    
+    if (!m_bluetooth->latencyMonitor()->dump(path)) {
+        emit error("Failed to write latency statistics");
+        return QString();
+    }
+    return path;
+}
+
+void MacroController::resetLatency()
+{
+    m_bluetooth->latencyMonitor()->reset();
 }
 
 void MacroController::startPairing()
@@ -142,26 +399,38 @@ void MacroController::saveConfig()
 void MacroController::addMacro(const QVariantMap &macro)
 {
     m_config->addMacro(macro);
-    m_config->saveConfig();
+    m_config->requestSave();
 }
 
 void MacroController::updateMacro(const QString &id, const QVariantMap &macro)
 {
     m_config->updateMacro(id, macro);
-    m_config->saveConfig();
+    m_config->requestSave();
 }
 
 void MacroController::removeMacro(const QString &id)
 {
     m_config->removeMacro(id);
-    m_config->saveConfig();
+    m_config->requestSave();
 }
 
 void MacroController::setGridLayout(int columns, int rows)
 {
     m_config->setColumns(columns);
     m_config->setRows(rows);
-    m_config->saveConfig();
+    m_config->requestSave();
+}
+
+void MacroController::addPage(const QString &name)
+{
+    m_config->setCurrentPage(m_config->addPage(name));
+    m_config->requestSave();
+}
+
+void MacroController::removePage(int page)
+{
+    m_config->removePage(page);
+    m_config->requestSave();
 }
 
 void MacroController::onBluetoothError(const QString &message)
@@ -170,11 +439,16 @@ void MacroController::onBluetoothError(const QString &message)
     emit error(message);
 }
 
-void MacroController::onMacroComplete()
+void MacroController::onMacroComplete(int run)
 {
-    qDebug() << "Macro completed:" << m_currentMacroId;
-    emit macroExecuted(m_currentMacroId);
-    m_currentMacroId.clear();
+    const Run finished = m_runs.take(run);
+    if (finished.macroId.isEmpty()) {
+        return;
+    }
+    
+    qDebug() << "Macro completed:" << finished.macroId;
+    emit macroExecuted(finished.macroId);
+    m_model->setExecuting(finished.handle, false);
 }
 
 void MacroController::onConfigError(const QString &message)
@@ -2,11 +2,14 @@
 #define MACROCONTROLLER_H
 
 #include <QObject>
+#include <QQueue>
 #include <QVariantList>
 #include <QVariantMap>
 
 #include "bluetoothhid.h"
 #include "macroconfig.h"
+#include "macrolistmodel.h"
+#include "textpaster.h"
 
 /**
  * @brief MacroController - Main controller for the macro pad application
@@ -21,9 +24,18 @@ class MacroController : public QObject
     Q_PROPERTY(bool discoverable READ isDiscoverable WRITE setDiscoverable NOTIFY discoverableChanged)
     Q_PROPERTY(QString status READ status NOTIFY statusChanged)
     Q_PROPERTY(QString deviceName READ deviceName WRITE setDeviceName NOTIFY deviceNameChanged)
-    Q_PROPERTY(QVariantList macros READ macros NOTIFY macrosChanged)
+    Q_PROPERTY(MacroListModel *macroModel READ macroModel CONSTANT)
+    Q_PROPERTY(TextPaster *paster READ paster CONSTANT)
     Q_PROPERTY(int columns READ columns NOTIFY columnsChanged)
     Q_PROPERTY(int rows READ rows NOTIFY rowsChanged)
+    Q_PROPERTY(int currentPage READ currentPage WRITE setCurrentPage NOTIFY currentPageChanged)
+    Q_PROPERTY(QStringList pageNames READ pageNames NOTIFY pagesChanged)
+    Q_PROPERTY(int typingRate READ typingRate NOTIFY typingRateChanged)
+    Q_PROPERTY(int maxTypingRate READ maxTypingRate WRITE setMaxTypingRate NOTIFY maxTypingRateChanged)
+    Q_PROPERTY(QString keyboardLayout READ keyboardLayout WRITE setKeyboardLayout NOTIFY keyboardLayoutChanged)
+    Q_PROPERTY(QStringList keyboardLayouts READ keyboardLayouts CONSTANT)
+    Q_PROPERTY(QString unicodeInput READ unicodeInput WRITE setUnicodeInput NOTIFY unicodeInputChanged)
+    Q_PROPERTY(QStringList unicodeInputs READ unicodeInputs CONSTANT)
 
 public:
     explicit MacroController(QObject *parent = nullptr);
@@ -33,12 +45,38 @@ public:
     bool isDiscoverable() const;
     QString status() const;
     QString deviceName() const;
-    QVariantList macros() const;
+    MacroListModel *macroModel() const;
+    TextPaster *paster() const;
     int columns() const;
     int rows() const;
+    int currentPage() const;
+    QStringList pageNames() const;
+    int typingRate() const;
+    int maxTypingRate() const;
+    QString keyboardLayout() const;
+    QStringList keyboardLayouts() const;
+    QString unicodeInput() const;
+    QStringList unicodeInputs() const;
 
     void setDiscoverable(bool discoverable);
     void setDeviceName(const QString &name);
+    void setCurrentPage(int page);
+    void setMaxTypingRate(int charsPerSecond);
+
+    /**
+     * @brief Type text for another host keyboard layout
+     *
+     * Macros are compiled again for it, so their text keeps coming out
+     * as written.
+     */
+    void setKeyboardLayout(const QString &name);
+
+    /**
+     * @brief Enter characters the layout has no key for the host's way
+     *
+     * Macros are compiled again with it.
+     */
+    void setUnicodeInput(const QString &name);
 
 public slots:
     /**
@@ -51,6 +89,51 @@ public slots:
      */
     void executeMacro(const QString &macroId);
 
+    /**
+     * @brief Execute a macro by the handle from its "handle" field
+     *
+     * Skips the id lookup; this is what the button grid calls.
+     */
+    void executeMacroHandle(int handle);
+
+    /**
+     * @brief Note that a macro button was clicked, for latency statistics
+     *
+     * Call right before executeMacro() from the click handler.
+     */
+    void markClick();
+
+    /**
+     * @brief Latency summary per stage (see LatencyMonitor)
+     */
+    QVariantList latencyStats() const;
+
+    /**
+     * @brief Write latency histograms to a CSV file
+     * @return Path of the file, or an empty string on failure
+     */
+    QString dumpLatency();
+
+    /**
+     * @brief Clear latency histograms
+     */
+    void resetLatency();
+
+    /**
+     * @brief Type a large text, streaming it (see TextPaster)
+     */
+    void pasteText(const QString &text, bool packed = false);
+
+    /**
+     * @brief Type the contents of a text file, streaming it
+     */
+    void pasteFile(const QString &path, bool packed = false);
+
+    /**
+     * @brief Stop a running paste
+     */
+    void cancelPaste();
+
     /**
      * @brief Start Bluetooth pairing mode
      */
@@ -91,26 +174,54 @@ public slots:
      */
     void setGridLayout(int columns, int rows);
 
+    /**
+     * @brief Append an empty page and show it
+     */
+    void addPage(const QString &name);
+
+    /**
+     * @brief Remove a page
+     */
+    void removePage(int page);
+
 signals:
     void connectedChanged();
     void discoverableChanged();
     void statusChanged();
     void deviceNameChanged();
-    void macrosChanged();
     void columnsChanged();
     void rowsChanged();
+    void currentPageChanged();
+    void pagesChanged();
+    void typingRateChanged();
+    void maxTypingRateChanged();
+    void keyboardLayoutChanged();
+    void unicodeInputChanged();
     void error(const QString &message);
     void macroExecuted(const QString &macroId);
 
 private slots:
     void onBluetoothError(const QString &message);
-    void onMacroComplete();
+    void onMacroComplete(int run);
     void onConfigError(const QString &message);
+    void onPasteFinished(bool completed);
 
 private:
+    bool beginPress();
+    void runMacro(int handle, int64_t lookupStartNs);
+
     BluetoothHID *m_bluetooth;
     MacroConfig *m_config;
-    QString m_currentMacroId;
+    MacroListModel *m_model;
+    TextPaster *m_paster;
+    
+    struct Run {
+        int handle;
+        QString macroId;
+    };
+    QHash<int, Run> m_runs;   // Unfinished runs by the id BluetoothHID gave them
+    Run m_paste;              // Macro the paster is playing; no handle for plain pastes
+    QQueue<int> m_held;       // Macros started during a paste, by handle, run after it
 };
 
 #endif // MACROCONTROLLER_H
@@ -0,0 +1,152 @@
+#include "macrolistmodel.h"
+
+MacroListModel::MacroListModel(MacroConfig *config, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_config(config)
+{
+    connect(m_config, &MacroConfig::macroAboutToBeInserted,
+            this, &MacroListModel::onMacroAboutToBeInserted);
+    connect(m_config, &MacroConfig::macroInserted,
+            this, &MacroListModel::onMacroInserted);
+    connect(m_config, &MacroConfig::macroAboutToBeRemoved,
+            this, &MacroListModel::onMacroAboutToBeRemoved);
+    connect(m_config, &MacroConfig::macroRemoved,
+            this, &MacroListModel::onMacroRemoved);
+    connect(m_config, &MacroConfig::macroAboutToBeMoved,
+            this, &MacroListModel::onMacroAboutToBeMoved);
+    connect(m_config, &MacroConfig::macroMoved,
+            this, &MacroListModel::onMacroMoved);
+    connect(m_config, &MacroConfig::macroUpdated,
+            this, &MacroListModel::onMacroUpdated);
+    connect(m_config, &MacroConfig::macrosAboutToBeReset,
+            this, &MacroListModel::onMacrosAboutToBeReset);
+    connect(m_config, &MacroConfig::macrosReset,
+            this, &MacroListModel::onMacrosReset);
+}
+
+int MacroListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_config->count();
+}
+
+QVariant MacroListModel::data(const QModelIndex &index, int role) const
+{
+    const MacroConfig::Macro *macro = m_config->macroAtRow(index.row());
+    if (!index.isValid() || !macro) {
+        return QVariant();
+    }
+    
+    switch (role) {
+    case IdRole:
+        return macro->id;
+    case HandleRole:
+        return m_config->handleAtRow(index.row());
+    case Qt::DisplayRole:
+    case NameRole:
+        return macro->name;
+    case IconRole:
+        return macro->icon;
+    case ColorRole:
+        return macro->color;
+    case ExecutingRole:
+        return m_executing.contains(m_config->handleAtRow(index.row()));
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> MacroListModel::roleNames() const
+{
+    return {
+        { IdRole, "macroId" },
+        { HandleRole, "macroHandle" },
+        { NameRole, "name" },
+        { IconRole, "icon" },
+        { ColorRole, "color" },
+        { ExecutingRole, "executing" }
+    };
+}
+
+int MacroListModel::count() const
+{
+    return m_config->count();
+}
+
+void MacroListModel::setExecuting(int handle, bool executing)
+{
+    if (handle == MacroConfig::InvalidHandle) {
+        return;
+    }
+    
+    if (executing) {
+        if (++m_executing[handle] == 1) {
+            notifyExecuting(handle);
+        }
+        return;
+    }
+    
+    auto it = m_executing.find(handle);
+    if (it != m_executing.end() && --it.value() == 0) {
+        m_executing.erase(it);
+        notifyExecuting(handle);
+    }
+}
+
+void MacroListModel::onMacroAboutToBeInserted(int row)
+{
+    beginInsertRows(QModelIndex(), row, row);
+}
+
+void MacroListModel::onMacroInserted()
+{
+    endInsertRows();
+    emit countChanged();
+}
+
+void MacroListModel::onMacroAboutToBeRemoved(int row)
+{
+    beginRemoveRows(QModelIndex(), row, row);
+}
+
+void MacroListModel::onMacroRemoved()
+{
+    endRemoveRows();
+    emit countChanged();
+}
+
+void MacroListModel::onMacroAboutToBeMoved(int from, int to)
+{
+    // Qt counts the destination before the move, so moving down is one more
+    beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+}
+
+void MacroListModel::onMacroMoved()
+{
+    endMoveRows();
+}
+
+void MacroListModel::onMacroUpdated(int row)
+{
+    const QModelIndex changed = index(row);
+    emit dataChanged(changed, changed, { IdRole, NameRole, IconRole, ColorRole });
+}
+
+void MacroListModel::onMacrosAboutToBeReset()
+{
+    beginResetModel();
+}
+
+void MacroListModel::onMacrosReset()
+{
+    endResetModel();
+    emit countChanged();
+}
+
+void MacroListModel::notifyExecuting(int handle)
+{
+    const int row = m_config->rowOf(handle);
+    if (row >= 0) {
+        const QModelIndex changed = index(row);
+        emit dataChanged(changed, changed, { ExecutingRole });
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef MACROLISTMODEL_H
+#define MACROLISTMODEL_H
+
+#include <QAbstractListModel>
+
+#include "macroconfig.h"
+
+/**
+ * @brief MacroListModel - List model over the macros of a MacroConfig
+ *
+ * Views get roles instead of a freshly built QVariantList, and follow
+ * MacroConfig's per-row signals: editing one macro refreshes one
+ * delegate, and starting or finishing a macro refreshes only the
+ * executing role of the rows involved.
+ */
+class MacroListModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Role {
+        IdRole = Qt::UserRole + 1,
+        HandleRole,
+        NameRole,
+        IconRole,
+        ColorRole,
+        ExecutingRole
+    };
+
+    explicit MacroListModel(MacroConfig *config, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const;
+
+    /**
+     * @brief Count a run of a macro as started or finished
+     *
+     * A macro shows as executing while any of its runs is queued or playing.
+     */
+    void setExecuting(int handle, bool executing);
+
+signals:
+    void countChanged();
+
+private slots:
+    void onMacroAboutToBeInserted(int row);
+    void onMacroInserted();
+    void onMacroAboutToBeRemoved(int row);
+    void onMacroRemoved();
+    void onMacroAboutToBeMoved(int from, int to);
+    void onMacroMoved();
+    void onMacroUpdated(int row);
+    void onMacrosAboutToBeReset();
+    void onMacrosReset();
+
+private:
+    void notifyExecuting(int handle);
+
+    MacroConfig *m_config;
+    QHash<int, int> m_executing;   // Handle to number of unfinished runs
+};
+
+#endif // MACROLISTMODEL_H
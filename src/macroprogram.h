@@ -0,0 +1,45 @@
+#ifndef MACROPROGRAM_H
+#define MACROPROGRAM_H
+
+#include <QList>
+
+#include <cstdint>
+
+#include "hidreport.h"
+
+/**
+ * @brief One step of a compiled macro
+ *
+ * Fixed-size and self-contained: the report bytes are already in wire
+ * format, so executing a program needs no lookups or conversions.
+ */
+struct MacroInstruction {
+    enum Opcode : uint8_t {
+        OpReport = 0x01,  // Wait delayUs after the previous report, then send report
+        OpDelay = 0x02,   // Wait delayUs, send nothing
+        OpStream = 0x03   // Sole instruction of a macro whose steps are encoded as it plays
+    };
+
+    uint32_t delayUs;
+    uint8_t opcode;
+    uint8_t reserved;
+    uint8_t report[HID_REPORT_SIZE];
+};
+
+static_assert(sizeof(MacroInstruction) == 16, "MacroInstruction must stay compact");
+
+/**
+ * @brief A compiled macro: contiguous instructions, executed front to back
+ */
+typedef QList<MacroInstruction> MacroProgram;
+
+/**
+ * @brief What starting a macro does while another one is still running
+ */
+enum class ExecutionPolicy : uint8_t {
+    Queue,     // Start after everything queued before it
+    Preempt,   // Cancel the queued and parallel macros, release their keys, start now
+    Parallel   // Start now, merging its keys with the running macros
+};
+
+#endif // MACROPROGRAM_H
@@ -5,10 +5,19 @@
 #include <QFont>
 #include <QFontDatabase>
 
+#include <cstdio>
+
+#include "hiddescriptor.h"
 #include "macrocontroller.h"
 
 int main(int argc, char *argv[])
 {
+    // Lets scripts/setup-usb-gadget.sh describe the same device
+    if (argc > 1 && qstrcmp(argv[1], "--hid-descriptor") == 0) {
+        fwrite(HID_REPORT_DESCRIPTOR, 1, HID_REPORT_DESCRIPTOR_SIZE, stdout);
+        return 0;
+    }
+    
     QGuiApplication app(argc, argv);
     
     // Set application metadata
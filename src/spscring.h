@@ -0,0 +1,77 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * @brief SpscRing - Bounded single-producer/single-consumer lock-free ring
+ *
+ * One thread may call push(), one other thread may call front()/pop().
+ * Capacity must be a power of two. Elements are copied in and out, so T
+ * has to be trivially copyable.
+ */
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+    SpscRing() : m_head(0), m_tail(0) {}
+
+    /**
+     * @brief Append an element (producer side). Returns false when full.
+     */
+    bool push(const T &value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) >= Capacity) {
+            return false;
+        }
+        m_buffer[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Peek at the oldest element (consumer side). Returns nullptr when empty.
+     */
+    const T *front() const
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &m_buffer[head & (Capacity - 1)];
+    }
+
+    /**
+     * @brief Drop the oldest element (consumer side). Must follow a successful front().
+     */
+    void pop()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Approximate number of queued elements (safe from either side)
+     */
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    // Keep producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) T m_buffer[Capacity];
+};
+
+#endif // SPSCRING_H
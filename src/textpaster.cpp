@@ -0,0 +1,281 @@
+#include "textpaster.h"
+#include "bluetoothhid.h"
+#include "macroconfig.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+// Characters compiled at a time; even entered through a Unicode input
+// method, a chunk stays far below the writer's queue capacity
+static const int CHUNK_CHARS = 64;
+
+// Chunks queued ahead, so the writer never runs dry between two
+static const int CHUNKS_IN_FLIGHT = 2;
+
+static const int FILE_BLOCK_SIZE = 4096;
+
+TextPaster::TextPaster(BluetoothHID *bluetooth, QObject *parent)
+    : QObject(parent)
+    , m_bluetooth(bluetooth)
+    , m_stepIndex(0)
+    , m_active(false)
+    , m_compiled(false)
+    , m_streaming(false)
+    , m_packed(false)
+    , m_textPos(0)
+    , m_totalUnits(0)
+    , m_doneUnits(0)
+    , m_doneChars(0)
+{
+    connect(m_bluetooth, &BluetoothHID::macroComplete, this, &TextPaster::onMacroComplete);
+    connect(m_bluetooth, &BluetoothHID::macroCancelled, this, &TextPaster::onMacroCancelled);
+}
+
+bool TextPaster::isActive() const
+{
+    return m_active;
+}
+
+qreal TextPaster::progress() const
+{
+    if (m_totalUnits <= 0) {
+        return m_active ? 0.0 : 1.0;
+    }
+    return qMin(1.0, qreal(m_doneUnits) / qreal(m_totalUnits));
+}
+
+int TextPaster::charsPerSecond() const
+{
+    const qint64 elapsedMs = m_active ? m_timer.elapsed() : 0;
+    return elapsedMs > 0 ? static_cast<int>(m_doneChars * 1000 / elapsedMs) : 0;
+}
+
+bool TextPaster::start(const QVariantList &sequence, int stepGapMs)
+{
+    if (m_active) {
+        emit error("A paste is already running");
+        return false;
+    }
+    if (!m_bluetooth->isConnected()) {
+        emit error("Not connected to any device");
+        return false;
+    }
+    
+    // Sized up front from the file sizes; nothing is read yet
+    m_totalUnits = 0;
+    for (const QVariant &value : sequence) {
+        const QVariantMap step = value.toMap();
+        if (!MacroCompiler::isStreamed(step)) {
+            continue;
+        }
+        m_totalUnits += step.contains("file")
+            ? QFileInfo(step.value("file").toString()).size()
+            : step.value("text").toString().size();
+    }
+    
+    m_compiler = MacroCompiler(stepGapMs);
+    m_compiler.setTextCacheEnabled(false);
+    m_sequence = sequence;
+    m_stepIndex = 0;
+    m_compiled = false;
+    m_doneUnits = 0;
+    m_doneChars = 0;
+    m_active = true;
+    m_timer.start();
+    
+    emit activeChanged();
+    emit progressChanged();
+    feed();
+    return true;
+}
+
+bool TextPaster::pasteText(const QString &text, bool packed)
+{
+    QVariantMap step = MacroConfig::createTextAction(text, packed);
+    step["stream"] = true;
+    return start(QVariantList { step }, 0);
+}
+
+bool TextPaster::pasteFile(const QString &path, bool packed)
+{
+    QVariantMap step;
+    step["type"] = "text";
+    step["file"] = path;
+    step["packed"] = packed;
+    return start(QVariantList { step }, 0);
+}
+
+void TextPaster::cancel()
+{
+    if (!m_active) {
+        return;
+    }
+    
+    // Completions of the dropped chunks are of no interest any more
+    m_runs.clear();
+    m_bluetooth->executeProgram(MacroProgram(), ExecutionPolicy::Preempt);
+    finish(false);
+}
+
+void TextPaster::onMacroComplete(int run)
+{
+    const auto it = m_runs.constFind(run);
+    if (it == m_runs.constEnd()) {
+        return;
+    }
+    
+    m_doneUnits += it->units;
+    m_doneChars += it->chars;
+    m_runs.erase(it);
+    emit progressChanged();
+    
+    feed();
+}
+
+void TextPaster::onMacroCancelled(int run)
+{
+    // Another macro preempted voice 0; typing on after the dropped chunks
+    // would leave a gap in the middle of the text
+    if (!m_runs.contains(run)) {
+        return;
+    }
+    emit error("Paste interrupted by another macro");
+    finish(false);
+}
+
+void TextPaster::feed()
+{
+    while (m_active && !m_compiled && m_runs.size() < CHUNKS_IN_FLIGHT) {
+        Chunk chunk = { 0, 0 };
+        MacroProgram program;
+        
+        if (m_streaming) {
+            QString text;
+            if (nextChunk(text)) {
+                m_compiler.addText(text, m_packed);
+                chunk.units = m_file.isOpen() ? text.toUtf8().size() : text.size();
+                chunk.chars = text.size();
+            } else if (!m_active) {
+                return;
+            } else {
+                closeSource();
+                m_compiler.endStep();
+            }
+            program = m_compiler.take();
+        } else if (m_stepIndex < m_sequence.size()) {
+            const QVariantMap step = m_sequence.at(m_stepIndex++).toMap();
+            if (MacroCompiler::isStreamed(step)) {
+                if (!openSource(step)) {
+                    cancel();
+                    return;
+                }
+            } else {
+                m_compiler.addStep(step);
+            }
+            program = m_compiler.take();
+        } else {
+            // Lets go of held keys and plays out a trailing delay
+            program = m_compiler.finish();
+            m_compiled = true;
+        }
+        
+        if (program.isEmpty()) {
+            // Nothing typeable in this chunk
+            m_doneUnits += chunk.units;
+            m_doneChars += chunk.chars;
+        } else if (!enqueue(program, chunk)) {
+            finish(false);
+            return;
+        }
+    }
+    
+    if (m_active && m_compiled && m_runs.isEmpty()) {
+        finish(true);
+    }
+}
+
+bool TextPaster::openSource(const QVariantMap &step)
+{
+    m_packed = step.value("packed", false).toBool();
+    
+    if (step.contains("file")) {
+        m_file.setFileName(step.value("file").toString());
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            emit error("Cannot open " + m_file.fileName() + ": " + m_file.errorString());
+            return false;
+        }
+        m_decoder = QStringDecoder(QStringDecoder::Utf8);
+    } else {
+        m_text = step.value("text").toString();
+        m_textPos = 0;
+    }
+    
+    m_streaming = true;
+    return true;
+}
+
+bool TextPaster::nextChunk(QString &chunk)
+{
+    if (!m_file.isOpen()) {
+        chunk = m_text.mid(m_textPos, CHUNK_CHARS);
+    } else {
+        // Decoding keeps its state, so characters split across blocks survive
+        while (m_buffer.size() < CHUNK_CHARS && !m_file.atEnd()) {
+            char block[FILE_BLOCK_SIZE];
+            const qint64 read = m_file.read(block, sizeof(block));
+            if (read < 0) {
+                emit error("Cannot read " + m_file.fileName() + ": " + m_file.errorString());
+                cancel();
+                return false;
+            }
+            m_buffer.append(m_decoder.decode(QByteArrayView(block, read)));
+        }
+        chunk = m_buffer.left(CHUNK_CHARS);
+    }
+    
+    // Never split a surrogate pair between two chunks
+    if (chunk.size() > 1 && chunk.back().isHighSurrogate()) {
+        chunk.chop(1);
+    }
+    
+    if (m_file.isOpen()) {
+        m_buffer.remove(0, chunk.size());
+    } else {
+        m_textPos += chunk.size();
+    }
+    return !chunk.isEmpty();
+}
+
+void TextPaster::closeSource()
+{
+    m_file.close();
+    m_buffer.clear();
+    m_text.clear();
+    m_textPos = 0;
+    m_streaming = false;
+}
+
+bool TextPaster::enqueue(const MacroProgram &program, const Chunk &chunk)
+{
+    const int run = m_bluetooth->executeProgram(program);
+    if (run < 0) {
+        return false;
+    }
+    m_runs.insert(run, chunk);
+    return true;
+}
+
+void TextPaster::finish(bool completed)
+{
+    closeSource();
+    m_runs.clear();
+    m_sequence.clear();
+    m_compiler = MacroCompiler();
+    m_active = false;
+    
+    qDebug() << "Paste" << (completed ? "finished:" : "cancelled after") << m_doneChars << "chars";
+    
+    emit activeChanged();
+    emit progressChanged();
+    emit finished(completed);
+}
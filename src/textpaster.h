@@ -0,0 +1,128 @@
+#ifndef TEXTPASTER_H
+#define TEXTPASTER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringDecoder>
+#include <QVariantList>
+#include <QVariantMap>
+
+#include "macrocompiler.h"
+
+class BluetoothHID;
+
+/**
+ * @brief TextPaster - Types large texts while they are being encoded
+ *
+ * Plays macro sequences with streamed text steps (see
+ * MacroCompiler::isStreamed()), and pastes strings or files on request.
+ * The text is read and compiled a chunk at a time, and a new chunk is
+ * only queued once an earlier one has been sent, so memory stays the
+ * same for a few bytes or many megabytes. A host or transport that falls
+ * behind holds up the writer, and with it the next chunk.
+ *
+ * Other steps of the sequence are compiled by the same compiler as the
+ * chunks, so keys held by a press step stay down across them.
+ *
+ * Chunks go to voice 0 as queued macros, only a few at a time, so a
+ * macro queued on voice 0 meanwhile would be typed into the middle of
+ * the paste; MacroController holds such macros until the paste is over.
+ * A macro that preempts voice 0 ends the paste, as cancel() does, and
+ * finished() reports it as not completed.
+ */
+class TextPaster : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ isActive NOTIFY activeChanged)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged)
+    Q_PROPERTY(int charsPerSecond READ charsPerSecond NOTIFY progressChanged)
+
+public:
+    explicit TextPaster(BluetoothHID *bluetooth, QObject *parent = nullptr);
+
+    bool isActive() const;
+
+    /**
+     * @brief Part of the streamed text sent so far, from 0 to 1
+     *
+     * Files are measured in bytes, inline text in characters.
+     */
+    qreal progress() const;
+
+    /**
+     * @brief Average typing speed since the start
+     */
+    int charsPerSecond() const;
+
+    /**
+     * @brief Play a macro sequence, streaming its text steps
+     * @return false if a paste is already running or nothing is connected
+     */
+    bool start(const QVariantList &sequence, int stepGapMs);
+
+public slots:
+    /**
+     * @brief Type a string of any size
+     */
+    bool pasteText(const QString &text, bool packed = false);
+
+    /**
+     * @brief Type the contents of a UTF-8 text file
+     */
+    bool pasteFile(const QString &path, bool packed = false);
+
+    /**
+     * @brief Stop typing and release every key
+     */
+    void cancel();
+
+signals:
+    void activeChanged();
+    void progressChanged();
+    void finished(bool completed);
+    void error(const QString &message);
+
+private slots:
+    void onMacroComplete(int run);
+    void onMacroCancelled(int run);
+
+private:
+    struct Chunk {
+        qint64 units;   // Bytes of a file or characters of inline text
+        qint64 chars;
+    };
+
+    void feed();
+    bool openSource(const QVariantMap &step);
+    bool nextChunk(QString &chunk);
+    void closeSource();
+    bool enqueue(const MacroProgram &program, const Chunk &chunk);
+    void finish(bool completed);
+
+    BluetoothHID *m_bluetooth;
+    MacroCompiler m_compiler;
+    QVariantList m_sequence;
+    int m_stepIndex;
+    bool m_active;
+    bool m_compiled;                // Every step is compiled and queued
+
+    // The streamed step being read
+    bool m_streaming;
+    bool m_packed;
+    QString m_text;
+    int m_textPos;
+    QFile m_file;
+    QStringDecoder m_decoder;
+    QString m_buffer;               // Decoded from m_file, not yet compiled
+
+    QHash<int, Chunk> m_runs;       // Queued chunks by run id
+    qint64 m_totalUnits;
+    qint64 m_doneUnits;
+    qint64 m_doneChars;
+    QElapsedTimer m_timer;
+};
+
+#endif // TEXTPASTER_H
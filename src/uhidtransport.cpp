@@ -0,0 +1,155 @@
+#include "uhidtransport.h"
+#include "hiddescriptor.h"
+
+#include <QDebug>
+
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+// Control events are rare; send the whole event structure
+static bool writeEvent(int fd, const struct uhid_event &event)
+{
+    return ::write(fd, &event, sizeof(event)) == static_cast<ssize_t>(sizeof(event));
+}
+
+UhidTransport::UhidTransport()
+    : m_fd(::open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC))
+{
+    if (m_fd < 0) {
+        qWarning() << "Cannot open /dev/uhid:" << strerror(errno);
+        return;
+    }
+    
+    struct uhid_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = UHID_CREATE2;
+    strncpy(reinterpret_cast<char *>(event.u.create2.name), "MacroPad Keyboard",
+            sizeof(event.u.create2.name) - 1);
+    event.u.create2.rd_size = static_cast<uint16_t>(HID_REPORT_DESCRIPTOR_SIZE);
+    event.u.create2.bus = BUS_VIRTUAL;
+    memcpy(event.u.create2.rd_data, HID_REPORT_DESCRIPTOR, HID_REPORT_DESCRIPTOR_SIZE);
+    
+    if (!writeEvent(m_fd, event)) {
+        qWarning() << "Failed to create uhid keyboard:" << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+UhidTransport::~UhidTransport()
+{
+    if (m_fd < 0) {
+        return;
+    }
+    
+    struct uhid_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = UHID_DESTROY;
+    writeEvent(m_fd, event);
+    ::close(m_fd);
+}
+
+bool UhidTransport::isValid() const
+{
+    return m_fd >= 0;
+}
+
+QString UhidTransport::name() const
+{
+    return QStringLiteral("uhid");
+}
+
+QList<int> UhidTransport::descriptors() const
+{
+    return { m_fd };
+}
+
+int UhidTransport::reportFd() const
+{
+    return m_fd;
+}
+
+ssize_t UhidTransport::sendReport(const uint8_t *data, size_t size)
+{
+    if (size < 1) {
+        return 0;
+    }
+    
+    // uhid takes the report without the HIDP header byte
+    struct uhid_event event;
+    event.type = UHID_INPUT2;
+    event.u.input2.size = static_cast<uint16_t>(size - 1);
+    memcpy(event.u.input2.data, data + 1, size - 1);
+    
+    const size_t eventSize = offsetof(struct uhid_event, u.input2.data) + size - 1;
+    if (::write(m_fd, &event, eventSize) < 0) {
+        return -1;
+    }
+    
+    rememberReport(data, size);
+    return static_cast<ssize_t>(size);
+}
+
+HidTransport::InputResult UhidTransport::handleInput(int fd)
+{
+    struct uhid_event event;
+    ssize_t size = ::read(fd, &event, sizeof(event));
+    if (size <= 0) {
+        return size == 0 ? InputHungUp : InputHandled;
+    }
+    
+    switch (event.type) {
+    case UHID_OUTPUT:
+        // LED output report: report ID, LED bits
+        if (event.u.output.size >= 2 && event.u.output.data[0] == HID_KEYBOARD_REPORT_ID) {
+            return updateLeds(event.u.output.data[1]);
+        }
+        break;
+    
+    case UHID_GET_REPORT: {
+        struct uhid_event reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = UHID_GET_REPORT_REPLY;
+        reply.u.get_report_reply.id = event.u.get_report.id;
+        
+        // Answered from the last input report with the requested ID,
+        // without the HIDP header byte
+        const uint8_t *report = lastReport(event.u.get_report.rnum);
+        if (event.u.get_report.rtype != UHID_INPUT_REPORT) {
+            reply.u.get_report_reply.err = EIO;
+        } else if (!report) {
+            reply.u.get_report_reply.err = EINVAL;
+        } else {
+            const int size = hidReportSize(report) - 1;
+            reply.u.get_report_reply.size = static_cast<uint16_t>(size);
+            memcpy(reply.u.get_report_reply.data, report + 1, size);
+        }
+        writeEvent(m_fd, reply);
+        break;
+    }
+    
+    case UHID_SET_REPORT: {
+        InputResult result = InputHandled;
+        if (event.u.set_report.size >= 2 && event.u.set_report.data[0] == HID_KEYBOARD_REPORT_ID) {
+            result = updateLeds(event.u.set_report.data[1]);
+        }
+        
+        struct uhid_event reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = UHID_SET_REPORT_REPLY;
+        reply.u.set_report_reply.id = event.u.set_report.id;
+        writeEvent(m_fd, reply);
+        return result;
+    }
+    
+    default:
+        // START/STOP/OPEN/CLOSE: the device stays usable throughout
+        break;
+    }
+    
+    return InputHandled;
+}
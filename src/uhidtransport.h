@@ -0,0 +1,35 @@
+#ifndef UHIDTRANSPORT_H
+#define UHIDTRANSPORT_H
+
+#include "hidtransport.h"
+
+/**
+ * @brief UhidTransport - Virtual keyboard on the local machine via /dev/uhid
+ *
+ * Creates a kernel HID device with the same report descriptor as the
+ * Bluetooth keyboard, so macros type into the machine MacroPad runs on.
+ * Useful for end-to-end latency measurements against a real input stack.
+ * Needs write access to /dev/uhid.
+ */
+class UhidTransport : public HidTransport
+{
+public:
+    UhidTransport();
+    ~UhidTransport();
+
+    /**
+     * @brief Whether the virtual device was created
+     */
+    bool isValid() const;
+
+    QString name() const override;
+    QList<int> descriptors() const override;
+    int reportFd() const override;
+    ssize_t sendReport(const uint8_t *data, size_t size) override;
+    InputResult handleInput(int fd) override;
+
+private:
+    int m_fd;
+};
+
+#endif // UHIDTRANSPORT_H
@@ -0,0 +1,49 @@
+#include "unicodeinput.h"
+
+#include <atomic>
+
+// In Method order
+static const char *const METHOD_NAMES[] = { "none", "linux", "windows", "macos" };
+
+static std::atomic<UnicodeInput::Method> s_current(UnicodeInput::None);
+
+UnicodeInput::Method UnicodeInput::current()
+{
+    return s_current.load(std::memory_order_acquire);
+}
+
+void UnicodeInput::setCurrent(Method method)
+{
+    s_current.store(method, std::memory_order_release);
+}
+
+UnicodeInput::Method UnicodeInput::fromName(const QString &name, bool *ok)
+{
+    for (int i = 0; i <= MacOs; ++i) {
+        if (name.compare(QLatin1String(METHOD_NAMES[i]), Qt::CaseInsensitive) == 0) {
+            if (ok) {
+                *ok = true;
+            }
+            return static_cast<Method>(i);
+        }
+    }
+    
+    if (ok) {
+        *ok = false;
+    }
+    return None;
+}
+
+QString UnicodeInput::name(Method method)
+{
+    return QLatin1String(METHOD_NAMES[method]);
+}
+
+QStringList UnicodeInput::names()
+{
+    QStringList names;
+    for (const char *name : METHOD_NAMES) {
+        names.append(QLatin1String(name));
+    }
+    return names;
+}
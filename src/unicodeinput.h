@@ -0,0 +1,53 @@
+#ifndef UNICODEINPUT_H
+#define UNICODEINPUT_H
+
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+
+/**
+ * @brief UnicodeInput - How the host lets a keyboard enter any character
+ *
+ * Characters that no key of the host's KeyboardLayout types can only be
+ * entered through an input method of the host's OS, which reads a code
+ * point typed in hex:
+ *
+ * - Linux (IBus, GTK): Ctrl+Shift+U, the code point, Space
+ * - Windows: Alt held, keypad +, the UTF-16 code units; needs the
+ *   EnableHexNumpad registry value
+ * - macOS: Option held, the UTF-16 code units as four digits each; needs
+ *   the "Unicode Hex Input" input source
+ *
+ * The pad cannot tell which OS the host runs, so the method is chosen by
+ * the user. With None such characters are skipped.
+ */
+class UnicodeInput
+{
+public:
+    enum Method : uint8_t {
+        None,
+        Linux,
+        Windows,
+        MacOs
+    };
+
+    /**
+     * @brief Method text is compiled for; None until set
+     */
+    static Method current();
+
+    /**
+     * @brief Change the method text is compiled for (any thread)
+     */
+    static void setCurrent(Method method);
+
+    /**
+     * @brief Method by name ("none", "linux", "windows", "macos")
+     */
+    static Method fromName(const QString &name, bool *ok = nullptr);
+    static QString name(Method method);
+    static QStringList names();
+};
+
+#endif // UNICODEINPUT_H
@@ -0,0 +1,138 @@
+/**
+ * configcache_tests - Compiled cache written next to a config file
+ */
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "configcache.h"
+#include "configparser.h"
+#include "testsupport.h"
+
+class ConfigCacheTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip();
+    void changedConfigIsNotLoaded();
+    void stampedWithSnapshotLayout();
+};
+
+static const QByteArray CONFIG = R"({
+    "columns": 4,
+    "rows": 2,
+    "pages": [
+        { "name": "One", "macros": [
+            { "id": "copy", "name": "Copy", "stepGapMs": 0, "policy": "parallel",
+              "sequence": [ { "type": "key", "keyCode": 6, "modifiers": 1 } ] }
+        ] },
+        { "name": "Two", "macros": [
+            { "id": "y", "name": "Y", "sequence": [ { "type": "text", "text": "y" } ] }
+        ] }
+    ]
+})";
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+/**
+ * Parse CONFIG at page 0 as MacroConfig does, compiling for layout
+ */
+static MacroConfig::Snapshot parsed(KeyboardLayout::Id layout)
+{
+    MacroConfig::Snapshot snapshot;
+    snapshot.columns = 3;
+    snapshot.rows = 3;
+    snapshot.currentPage = 0;
+    snapshot.layout = layout;
+    ConfigParser parser(CONFIG);
+    parser.parse(snapshot);
+    return snapshot;
+}
+
+void ConfigCacheTests::roundTrip()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("macros.json");
+    QVERIFY(writeFile(path, CONFIG));
+    const MacroConfig::Snapshot snapshot = parsed(KeyboardLayout::Us);
+    QCOMPARE(snapshot.macros.size(), 1);
+    QVERIFY(ConfigCache::save(path, CONFIG, snapshot));
+    QVERIFY(QFile::exists(ConfigCache::cachePath(path)));
+    
+    MacroConfig::Snapshot loaded;
+    loaded.currentPage = 0;
+    uint64_t hash = 0;
+    QVERIFY(ConfigCache::load(path, loaded, &hash));
+    QCOMPARE(hash, ConfigCache::hash(CONFIG));
+    QCOMPARE(loaded.columns, 4);
+    QCOMPARE(loaded.rows, 2);
+    QCOMPARE(loaded.pages.size(), 2);
+    QCOMPARE(loaded.pages[1].name, QString("Two"));
+    QVERIFY(loaded.pages[1].compiled);
+    
+    // The current page comes back with its program; the sequence stays
+    // JSON until something edits it
+    QCOMPARE(loaded.macros.size(), 1);
+    const MacroConfig::Macro &macro = loaded.macros.first();
+    QCOMPARE(macro.id, QString("copy"));
+    QCOMPARE(macro.name, QString("Copy"));
+    QCOMPARE(macro.stepGapMs, 0);
+    QCOMPARE(macro.policy, ExecutionPolicy::Parallel);
+    QVERIFY(!macro.sequenceJson.isEmpty());
+    QCOMPARE(macro.program.size(), snapshot.macros.first().program.size());
+    QCOMPARE(memcmp(macro.program.constData(), snapshot.macros.first().program.constData(),
+                    macro.program.size() * sizeof(MacroInstruction)), 0);
+}
+
+void ConfigCacheTests::changedConfigIsNotLoaded()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("macros.json");
+    QVERIFY(writeFile(path, CONFIG));
+    QVERIFY(ConfigCache::save(path, CONFIG, parsed(KeyboardLayout::Us)));
+    
+    // Same size, different contents: only the hash tells them apart
+    QByteArray edited = CONFIG;
+    edited.replace("\"rows\": 2", "\"rows\": 3");
+    QVERIFY(writeFile(path, edited));
+    
+    MacroConfig::Snapshot loaded;
+    loaded.currentPage = 0;
+    QVERIFY(!ConfigCache::load(path, loaded));
+}
+
+void ConfigCacheTests::stampedWithSnapshotLayout()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("macros.json");
+    QVERIFY(writeFile(path, CONFIG));
+    
+    // Compiled for German while US stays the current layout; page two is
+    // still JSON and gets compiled by the save
+    const MacroConfig::Snapshot snapshot = parsed(KeyboardLayout::De);
+    QVERIFY(!snapshot.pages[1].compiled);
+    QVERIFY(ConfigCache::save(path, CONFIG, snapshot));
+    
+    MacroConfig::Snapshot us;
+    us.currentPage = 1;
+    QCOMPARE(us.layout, KeyboardLayout::Us);
+    QVERIFY(!ConfigCache::load(path, us));
+    
+    // German keyboards have Y where US ones have Z
+    MacroConfig::Snapshot german;
+    german.currentPage = 1;
+    german.layout = KeyboardLayout::De;
+    QVERIFY(ConfigCache::load(path, german));
+    QCOMPARE(german.macros.size(), 1);
+    QCOMPARE(german.macros.first().program.first().report[4], uint8_t(0x1D));
+}
+
+QTEST_GUILESS_MAIN(ConfigCacheTests)
+
+#include "configcache_tests.moc"
@@ -0,0 +1,144 @@
+/**
+ * configparser_tests - Messages the config parser gives for broken files
+ *
+ * Every message names the line and column of the offending value, so
+ * the tests compare them word for word.
+ */
+
+#include <QTest>
+
+#include "configparser.h"
+
+class ConfigParserTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void validConfig();
+    void schemaErrorsAreCollected();
+    void syntaxErrorStops();
+    void columnsCountCharacters();
+    void lazyPageKeepsFilePosition();
+    void rebasedPosition();
+};
+
+static MacroConfig::Snapshot emptySnapshot()
+{
+    MacroConfig::Snapshot snapshot;
+    snapshot.columns = 4;
+    snapshot.rows = 3;
+    snapshot.currentPage = 0;
+    return snapshot;
+}
+
+void ConfigParserTests::validConfig()
+{
+    const QByteArray data =
+        "{\"columns\": 5, \"macros\": [\n"
+        "  {\"id\": \"a\", \"name\": \"A\", \"sequence\": [{\"type\": \"key\", \"keyCode\": 4}]}\n"
+        "]}";
+    
+    MacroConfig::Snapshot snapshot = emptySnapshot();
+    ConfigParser parser(data);
+    QVERIFY(parser.parse(snapshot));
+    QVERIFY(parser.errors().isEmpty());
+    QCOMPARE(snapshot.columns, 5);
+    QCOMPARE(snapshot.rows, 3);
+    QCOMPARE(snapshot.pages.size(), 1);
+    QCOMPARE(snapshot.macros.size(), 1);
+    QCOMPARE(snapshot.macros.first().id, QString("a"));
+    QVERIFY(!snapshot.macros.first().program.isEmpty());
+}
+
+void ConfigParserTests::schemaErrorsAreCollected()
+{
+    const QByteArray data =
+        "{\"macros\": [\n"
+        "  {\"id\": \"a\", \"sequence\": [{\"type\": \"key\", \"keyCode\": 300}]},\n"
+        "  {\"name\": \"b\", \"sequence\": [{\"type\": \"warp\"}]}\n"
+        "]}";
+    
+    // One pass reports every problem, at the value that causes it
+    MacroConfig::Snapshot snapshot = emptySnapshot();
+    ConfigParser parser(data);
+    QVERIFY(!parser.parse(snapshot));
+    QCOMPARE(parser.errors(), QStringList({
+        "line 2, column 55: macro \"a\", step 1: \"keyCode\" must be an integer from 0 to 255",
+        "line 3, column 39: macro 2, step 1: unknown step type \"warp\"",
+        "line 3, column 3: macro 2 has no \"id\"",
+    }));
+}
+
+void ConfigParserTests::syntaxErrorStops()
+{
+    const QByteArray data =
+        "{\"macros\": [\n"
+        "  {\"id\": \"a\",, \"id\": 1}\n"
+        "]}";
+    
+    MacroConfig::Snapshot snapshot = emptySnapshot();
+    ConfigParser parser(data);
+    QVERIFY(!parser.parse(snapshot));
+    QCOMPARE(parser.errors(), QStringList({ "line 2, column 14: expected a member name" }));
+}
+
+void ConfigParserTests::columnsCountCharacters()
+{
+    // Two, three and four byte characters each take one column
+    const QByteArray data = "{\"macros\": [{\"id\": \"ä€😀\", \"stepGapMs\": -1}]}";
+    
+    MacroConfig::Snapshot snapshot = emptySnapshot();
+    ConfigParser parser(data);
+    QVERIFY(!parser.parse(snapshot));
+    QCOMPARE(parser.errors(), QStringList({
+        QString::fromUtf8("line 1, column 40: macro \"ä€😀\": \"stepGapMs\" must be an integer from 0 to 600000"),
+    }));
+}
+
+void ConfigParserTests::lazyPageKeepsFilePosition()
+{
+    const QByteArray data =
+        "{\"pages\": [\n"
+        "  {\"name\": \"One\", \"macros\": []},\n"
+        "  {\"name\": \"Two\", \"macros\": [{\"id\": \"x\", \"sequence\": [{\"type\": \"delay\", \"ms\": \"long\"}]},\n"
+        "    {\"id\": \"y\", \"stepGapMs\": \"none\"}]}\n"
+        "]}";
+    
+    // Page two is only checked for syntax until it is shown
+    MacroConfig::Snapshot snapshot = emptySnapshot();
+    ConfigParser parser(data);
+    QVERIFY(parser.parse(snapshot));
+    QCOMPARE(snapshot.pages.size(), 2);
+    const MacroConfig::Page &page = snapshot.pages[1];
+    QCOMPARE(page.name, QString("Two"));
+    QVERIFY(!page.compiled);
+    QCOMPARE(page.line, 3);
+    QCOMPARE(page.column, 29);
+    QVERIFY(page.source.startsWith("[{\"id\": \"x\""));
+    
+    // Its messages still point into the file, not into the slice
+    QList<MacroConfig::Macro> macros;
+    QString errorString;
+    QVERIFY(!MacroConfig::decodePage(page, macros, &errorString));
+    QCOMPARE(errorString, QString(
+        "line 3, column 79: macro \"x\", step 1: \"ms\" must be an integer from 0 to 600000\n"
+        "line 4, column 30: macro \"y\": \"stepGapMs\" must be an integer from 0 to 600000"));
+}
+
+void ConfigParserTests::rebasedPosition()
+{
+    // The column offset only applies to the first line of the slice
+    ConfigParser parser("[{\"id\": 5},\n {\"id\": 6}]", 10, 20);
+    QList<MacroConfig::Macro> macros;
+    QVERIFY(!parser.parsePage(macros));
+    QCOMPARE(parser.errors(), QStringList({
+        "line 10, column 28: macro 1: \"id\" must be a string",
+        "line 10, column 21: macro 1 has no \"id\"",
+        "line 11, column 9: macro 2: \"id\" must be a string",
+        "line 11, column 2: macro 2 has no \"id\"",
+    }));
+}
+
+QTEST_GUILESS_MAIN(ConfigParserTests)
+
+#include "configparser_tests.moc"
@@ -0,0 +1,492 @@
+/**
+ * hidwriter_tests - What the host receives through a HidWriter thread
+ *
+ * Each test runs a real writer into a LoopbackTransport and reads the
+ * reports back on the host end, so pacing, coalescing and hang-ups go
+ * through the same epoll loop as on the device.
+ */
+
+#include <QTest>
+
+#include <sys/socket.h>
+
+#include "hidwriter.h"
+#include "latencymonitor.h"
+#include "testsupport.h"
+
+class HidWriterTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void loopbackRecordsReports();
+    void reportAfterIdleIsSent();
+    void reportsWaitForTheirDeadline();
+    void queueDrainedAfterRequest();
+    void reportsKeepTheInterval();
+    void stalledHostSlowsWriter();
+    void pressLatencyIsRecorded();
+    void ledReportFromHost();
+    void hangUpReportsTransportId();
+    void replacedTransportIsNotReported();
+    void repeatedKeyKeepsEveryEdge();
+    void coalescingSkipsRedundantReport();
+    void unchangedReportIsSkipped();
+    void parallelVoicesAreMerged();
+    void cancelReleasesOnlyItsVoice();
+    void consumerReportKeepsKeysDown();
+    void mouseReportsAreNeverSkipped();
+};
+
+void HidWriterTests::loopbackRecordsReports()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    QVERIFY(transport->isValid());
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    const int64_t start = monotonicNowNs();
+    const HidReport press = keyboardReport(LEFT_SHIFT, { KEY_A, KEY_B }, start);
+    const HidReport release = keyboardReport(0x00, {}, start + 5 * MS);
+    QVERIFY(writer.enqueue(press));
+    QVERIFY(writer.enqueue(release));
+    
+    // Each record holds the report as written, stamped when it was sent
+    const QList<LoopbackRecord> records = receive(transport, 2);
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(memcmp(records[0].data, press.data, HID_REPORT_SIZE), 0);
+    QCOMPARE(memcmp(records[1].data, release.data, HID_REPORT_SIZE), 0);
+    QVERIFY(records[0].sentNs >= start);
+    QVERIFY(records[1].sentNs >= release.deadlineNs);
+    QVERIFY(records[1].sentNs <= monotonicNowNs());
+    
+    writer.stop();
+}
+
+void HidWriterTests::reportAfterIdleIsSent()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Each report lands just as the writer drains the previous one and
+    // goes back to sleep; none of them may wait for a later wake-up
+    for (int i = 0; i < 200; ++i) {
+        const uint8_t key = (i % 2) ? KEY_A : KEY_B;
+        QVERIFY(writer.enqueue(keyboardReport(0x00, { key }, monotonicNowNs())));
+        const QList<LoopbackRecord> records = receive(transport, 1, QUIET_MS);
+        QCOMPARE(records.size(), 1);
+        QCOMPARE(keyboardState(records[0]), keyboardState(0x00, { key }));
+    }
+    
+    writer.stop();
+}
+
+void HidWriterTests::reportsWaitForTheirDeadline()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Deadlines are absolute, so queueing all of them at once still
+    // spaces them as scheduled rather than sending them together
+    const int64_t start = monotonicNowNs() + 10 * MS;
+    const int64_t deadlines[] = { start, start + 15 * MS, start + 40 * MS };
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, deadlines[0])));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_B }, deadlines[1])));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, deadlines[2])));
+    
+    const QList<LoopbackRecord> records = receive(transport, 3);
+    QCOMPARE(records.size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        QVERIFY(records[i].sentNs >= deadlines[i]);
+        QVERIFY(records[i].sentNs < deadlines[i] + 10 * MS);
+    }
+    
+    writer.stop();
+}
+
+void HidWriterTests::queueDrainedAfterRequest()
+{
+    HidWriter writer;
+    int drained = 0;
+    connect(&writer, &HidWriter::queueDrained, this, [&drained]() {
+        ++drained;
+    });
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    
+    // Nothing is taken off the ring until the thread runs
+    const int capacity = writer.queueSpace();
+    QVERIFY(capacity > 2);
+    const int64_t start = monotonicNowNs();
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 1 * MS)));
+    QCOMPARE(writer.queueSpace(), capacity - 2);
+    
+    writer.requestQueueSpace();
+    writer.start();
+    QTRY_COMPARE(drained, 1);
+    QCOMPARE(writer.queueSpace(), capacity);
+    QCOMPARE(receive(transport, 2).size(), 2);
+    
+    writer.stop();
+}
+
+void HidWriterTests::reportsKeepTheInterval()
+{
+    HidWriter writer;
+    writer.setReportInterval(5000, 5000, 5000);
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Reports that are all due at once still go out an interval apart
+    const int64_t start = monotonicNowNs();
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start)));
+        QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start)));
+    }
+    
+    const QList<LoopbackRecord> records = receive(transport, 8);
+    QCOMPARE(records.size(), 8);
+    for (int i = 1; i < records.size(); ++i) {
+        QVERIFY(records[i].sentNs - records[i - 1].sentNs >= 5 * MS);
+    }
+    
+    writer.stop();
+}
+
+void HidWriterTests::stalledHostSlowsWriter()
+{
+    HidWriter writer;
+    writer.setReportInterval(0, 0, 4000);
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // A host that reads nothing fills the socket until writes fail with
+    // EAGAIN, and the writer starts spacing its reports
+    const int count = 1000;
+    const int64_t start = monotonicNowNs();
+    for (int i = 0; i < count; i += 2) {
+        QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start)));
+        QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start)));
+    }
+    QTRY_VERIFY(writer.reportIntervalUs() >= 1000);
+    QVERIFY(writer.reportIntervalUs() <= 4000);
+    
+    // The report that was pushed back is sent again, none is lost
+    const QList<LoopbackRecord> records = receive(transport, count, 10000);
+    QCOMPARE(records.size(), count);
+    for (int i = 0; i < count; i += 2) {
+        QCOMPARE(keyboardState(records[i]), keyboardState(0x00, { KEY_A }));
+        QCOMPARE(keyboardState(records[i + 1]), keyboardState(0x00, {}));
+    }
+    
+    writer.stop();
+}
+
+void HidWriterTests::pressLatencyIsRecorded()
+{
+    LatencyMonitor latency;
+    HidWriter writer;
+    writer.setLatencyMonitor(&latency);
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Every write is timed; only the first report of a press closes the
+    // press-to-report measurement
+    const int64_t press = monotonicNowNs();
+    latency.markPress(press);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, press + 5 * MS, HidReport::PressStart)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, press + 6 * MS)));
+    QCOMPARE(receive(transport, 2).size(), 2);
+    const int64_t received = monotonicNowNs();
+    
+    QTRY_COMPARE(latency.histogram(LatencyMonitor::Write).count(), uint64_t(2));
+    QCOMPARE(latency.histogram(LatencyMonitor::Wakeup).count(), uint64_t(2));
+    QCOMPARE(latency.histogram(LatencyMonitor::Total).count(), uint64_t(1));
+    QVERIFY(latency.histogram(LatencyMonitor::Total).maxNs() >= 5 * MS);
+    QVERIFY(latency.histogram(LatencyMonitor::Total).maxNs() <= received - press);
+    QCOMPARE(latency.takePress(), int64_t(0));
+    
+    writer.stop();
+}
+
+void HidWriterTests::ledReportFromHost()
+{
+    HidWriter writer;
+    QList<int> leds;
+    connect(&writer, &HidWriter::ledsChanged, this, [&leds](int value) {
+        leds.append(value);
+    });
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Caps Lock on, then the same state again, which is not a change
+    QVERIFY(transport->sendLeds(0x02));
+    QTRY_COMPARE(leds, QList<int>({ 0x02 }));
+    QVERIFY(transport->sendLeds(0x02));
+    QTest::qWait(QUIET_MS);
+    QCOMPARE(leds, QList<int>({ 0x02 }));
+    
+    writer.stop();
+}
+
+void HidWriterTests::hangUpReportsTransportId()
+{
+    HidWriter writer;
+    QList<int> hungUp;
+    connect(&writer, &HidWriter::hostDisconnected, this, [&hungUp](int id) {
+        hungUp.append(id);
+    });
+    writer.start();
+    
+    // USB host first, then failing over to Bluetooth once it hangs up
+    LoopbackTransport *usb = new LoopbackTransport();
+    writer.setTransport(usb, 1);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, monotonicNowNs())));
+    QCOMPARE(receive(usb, 1).size(), 1);
+    
+    ::shutdown(usb->hostFd(), SHUT_RDWR);
+    QTRY_COMPARE(hungUp, QList<int>({ 1 }));
+    
+    LoopbackTransport *bluetooth = new LoopbackTransport();
+    writer.setTransport(bluetooth, 2);
+    
+    // A new host starts with every key up, so this is not skipped as unchanged
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, monotonicNowNs())));
+    const QList<LoopbackRecord> records = receive(bluetooth, 1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(keyboardState(records[0]), keyboardState(0x00, {}));
+    
+    ::shutdown(bluetooth->hostFd(), SHUT_RDWR);
+    QTRY_COMPARE(hungUp, QList<int>({ 1, 2 }));
+    
+    writer.stop();
+}
+
+void HidWriterTests::replacedTransportIsNotReported()
+{
+    HidWriter writer;
+    QList<int> hungUp;
+    connect(&writer, &HidWriter::hostDisconnected, this, [&hungUp](int id) {
+        hungUp.append(id);
+    });
+    writer.start();
+    
+    // Handing over to another transport closes the old one quietly
+    LoopbackTransport *bluetooth = new LoopbackTransport();
+    writer.setTransport(bluetooth, 1);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, monotonicNowNs())));
+    QCOMPARE(receive(bluetooth, 1).size(), 1);
+    
+    LoopbackTransport *usb = new LoopbackTransport();
+    writer.setTransport(usb, 2);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_B }, monotonicNowNs())));
+    const QList<LoopbackRecord> records = receive(usb, 1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(keyboardState(records[0]), keyboardState(0x00, { KEY_B }));
+    
+    QTest::qWait(QUIET_MS);
+    QVERIFY(hungUp.isEmpty());
+    
+    // Detaching is not a hang-up either
+    writer.setTransport(nullptr, 3);
+    QTest::qWait(QUIET_MS);
+    QVERIFY(hungUp.isEmpty());
+    
+    writer.stop();
+}
+
+void HidWriterTests::repeatedKeyKeepsEveryEdge()
+{
+    HidWriter writer;
+    writer.setPollInterval(8000);
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Typing "aa" within one poll interval: the release between the two
+    // presses is the only thing that makes the host see a second "a"
+    const int64_t start = monotonicNowNs() + 20 * MS;
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start, HidReport::PressStart)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 1 * MS)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start + 2 * MS)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 3 * MS)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 5, 20 + QUIET_MS);
+    QCOMPARE(records.size(), 4);
+    QCOMPARE(keyboardState(records[0]), keyboardState(0x00, { KEY_A }));
+    QCOMPARE(keyboardState(records[1]), keyboardState(0x00, {}));
+    QCOMPARE(keyboardState(records[2]), keyboardState(0x00, { KEY_A }));
+    QCOMPARE(keyboardState(records[3]), keyboardState(0x00, {}));
+    
+    writer.stop();
+}
+
+void HidWriterTests::coalescingSkipsRedundantReport()
+{
+    for (int pollUs : { 0, 8000 }) {
+        HidWriter writer;
+        writer.setPollInterval(pollUs);
+        LoopbackTransport *transport = new LoopbackTransport();
+        writer.setTransport(transport, 1);
+        writer.start();
+        
+        // Letting go of a chord one key at a time: with coalescing the
+        // host sees both keys go up together, and no key edge is lost
+        const int64_t start = monotonicNowNs() + 20 * MS;
+        QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A, KEY_B }, start, HidReport::PressStart)));
+        QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_B }, start + 1 * MS)));
+        QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 2 * MS)));
+        
+        const QList<LoopbackRecord> records = receive(transport, 4, 20 + QUIET_MS);
+        QCOMPARE(records.size(), pollUs > 0 ? 2 : 3);
+        QCOMPARE(keyboardState(records.first()), keyboardState(0x00, { KEY_A, KEY_B }));
+        QCOMPARE(keyboardState(records.last()), keyboardState(0x00, {}));
+        
+        writer.stop();
+    }
+}
+
+void HidWriterTests::unchangedReportIsSkipped()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    const int64_t start = monotonicNowNs();
+    QVERIFY(writer.enqueue(keyboardReport(LEFT_SHIFT, { KEY_A }, start)));
+    QVERIFY(writer.enqueue(keyboardReport(LEFT_SHIFT, { KEY_A }, start + 1 * MS)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 2 * MS)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 3, QUIET_MS);
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(keyboardState(records[0]), keyboardState(LEFT_SHIFT, { KEY_A }));
+    QCOMPARE(keyboardState(records[1]), keyboardState(0x00, {}));
+    
+    writer.stop();
+}
+
+void HidWriterTests::parallelVoicesAreMerged()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Two macros overlapping on different voices: each report carries
+    // what the other voice still holds down
+    const int64_t start = monotonicNowNs() + 20 * MS;
+    QVERIFY(writer.enqueue(keyboardReport(LEFT_SHIFT, { KEY_A }, start, HidReport::NoFlags, 0)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_B }, start + 5 * MS, HidReport::NoFlags, 1)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 10 * MS, HidReport::NoFlags, 0)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 15 * MS, HidReport::NoFlags, 1)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 5, 20 + QUIET_MS);
+    QCOMPARE(records.size(), 4);
+    QCOMPARE(keyboardState(records[0]), keyboardState(LEFT_SHIFT, { KEY_A }));
+    QCOMPARE(keyboardState(records[1]), keyboardState(LEFT_SHIFT, { KEY_A, KEY_B }));
+    QCOMPARE(keyboardState(records[2]), keyboardState(0x00, { KEY_B }));
+    QCOMPARE(keyboardState(records[3]), keyboardState(0x00, {}));
+    
+    writer.stop();
+}
+
+void HidWriterTests::cancelReleasesOnlyItsVoice()
+{
+    HidWriter writer;
+    QList<int> finished;
+    connect(&writer, &HidWriter::macroFinished, this, [&finished](int voice) {
+        finished.append(voice);
+    });
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    const int64_t start = monotonicNowNs();
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start, HidReport::NoFlags, 0)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_B }, start + 1 * MS, HidReport::NoFlags, 1)));
+    QCOMPARE(receive(transport, 2).size(), 2);
+    
+    // Voice 1 would hold B for a second; cancelling it lets go at once,
+    // still counts its macro as finished and leaves voice 0 alone
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 1000 * MS, HidReport::MacroEnd, 1)));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, monotonicNowNs(), HidReport::Cancel, 1)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 2, QUIET_MS);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(keyboardState(records[0]), keyboardState(0x00, { KEY_A }));
+    QTRY_COMPARE(finished, QList<int>({ 1 }));
+    
+    writer.stop();
+}
+
+void HidWriterTests::consumerReportKeepsKeysDown()
+{
+    HidWriter writer;
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // A media key tapped while a key is held goes out in its own report
+    // and leaves the keyboard report alone
+    const int64_t start = monotonicNowNs();
+    HidReport mute = keyboardReport(0x00, {}, start + 1 * MS);
+    buildConsumerReport(mute.data, 0x00E2);
+    HidReport muteUp = keyboardReport(0x00, {}, start + 2 * MS);
+    buildConsumerReport(muteUp.data, 0);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, { KEY_A }, start)));
+    QVERIFY(writer.enqueue(mute));
+    QVERIFY(writer.enqueue(muteUp));
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, start + 3 * MS)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 4);
+    QCOMPARE(records.size(), 4);
+    QCOMPARE(QByteArray(reinterpret_cast<const char *>(records[1].data), HID_CONSUMER_REPORT_SIZE),
+             QByteArray("\xA1\x02\xE2\x00", 4));
+    QCOMPARE(QByteArray(reinterpret_cast<const char *>(records[2].data), HID_CONSUMER_REPORT_SIZE),
+             QByteArray("\xA1\x02\x00\x00", 4));
+    QCOMPARE(keyboardState(records[3]), keyboardState(0x00, {}));
+    
+    writer.stop();
+}
+
+void HidWriterTests::mouseReportsAreNeverSkipped()
+{
+    HidWriter writer;
+    writer.setPollInterval(8000);
+    LoopbackTransport *transport = new LoopbackTransport();
+    writer.setTransport(transport, 1);
+    writer.start();
+    
+    // Moves are relative, so a repeated one still moves, even within one
+    // poll interval; the button held by voice 1 is let go by its cancel
+    const int64_t start = monotonicNowNs();
+    HidReport move = keyboardReport(0x00, {}, start, HidReport::NoFlags, 1);
+    buildMouseReport(move.data, 0x01, 10, -5, 0, 0);
+    QVERIFY(writer.enqueue(move));
+    move.deadlineNs = start + 1 * MS;
+    QVERIFY(writer.enqueue(move));
+    QCOMPARE(receive(transport, 2).size(), 2);
+    QVERIFY(writer.enqueue(keyboardReport(0x00, {}, monotonicNowNs(), HidReport::Cancel, 1)));
+    
+    const QList<LoopbackRecord> records = receive(transport, 1);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(QByteArray(reinterpret_cast<const char *>(records[0].data), HID_MOUSE_REPORT_SIZE),
+             QByteArray("\xA1\x03\x00\x00\x00\x00\x00", HID_MOUSE_REPORT_SIZE));
+    
+    writer.stop();
+}
+
+QTEST_GUILESS_MAIN(HidWriterTests)
+
+#include "hidwriter_tests.moc"
@@ -0,0 +1,74 @@
+/**
+ * keyboardstate_tests - Press and release semantics of KeyboardState
+ */
+
+#include <QTest>
+
+#include "keyboardstate.h"
+#include "testsupport.h"
+
+class KeyboardStateTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void pressRelease();
+    void keySlots();
+};
+
+void KeyboardStateTests::pressRelease()
+{
+    KeyboardState state;
+    QVERIFY(state.isReleased());
+    
+    // Only a change reports true, so callers send no duplicate reports
+    QVERIFY(state.press(KEY_A));
+    QVERIFY(!state.press(KEY_A));
+    QVERIFY(state.press(0x00, LEFT_SHIFT));
+    QVERIFY(!state.press(0x00, LEFT_SHIFT));
+    QCOMPARE(state.modifiers(), LEFT_SHIFT);
+    QCOMPARE(state.keyCount(), 1);
+    QVERIFY(state.isPressed(KEY_A));
+    QVERIFY(!state.isPressed(0x00));
+    
+    QVERIFY(state.release(KEY_A));
+    QVERIFY(!state.release(KEY_A));
+    QVERIFY(!state.release(KEY_B));
+    QVERIFY(!state.isReleased());
+    QVERIFY(state.release(0x00, LEFT_SHIFT));
+    QVERIFY(state.isReleased());
+    
+    QVERIFY(!state.releaseAll());
+    QVERIFY(state.press(KEY_B, LEFT_SHIFT));
+    QVERIFY(state.releaseAll());
+    QVERIFY(state.isReleased());
+    QCOMPARE(state.keyCount(), 0);
+}
+
+void KeyboardStateTests::keySlots()
+{
+    KeyboardState state;
+    const uint8_t keys[] = { 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A };
+    
+    // The seventh key finds no slot and is left out
+    QVERIFY(state.press(keys, 7));
+    QCOMPARE(state.keyCount(), HID_REPORT_KEY_SLOTS);
+    QCOMPARE(state.freeSlots(), 0);
+    QVERIFY(!state.isPressed(0x0A));
+    QVERIFY(!state.press(0x0A));
+    
+    // Releasing closes the gap and keeps the press order
+    QVERIFY(state.release(0x05));
+    QCOMPARE(state.freeSlots(), 1);
+    QCOMPARE(state.key(0), uint8_t(0x04));
+    QCOMPARE(state.key(1), uint8_t(0x06));
+    QCOMPARE(state.key(5), uint8_t(0x00));
+    
+    uint8_t data[HID_REPORT_SIZE];
+    state.writeReport(data);
+    QCOMPARE(keyboardState(data), keyboardState(0x00, { 0x04, 0x06, 0x07, 0x08, 0x09 }));
+}
+
+QTEST_GUILESS_MAIN(KeyboardStateTests)
+
+#include "keyboardstate_tests.moc"
@@ -0,0 +1,113 @@
+/**
+ * latency_tests - Histogram bucketing and what LatencyMonitor reports
+ */
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include "latencymonitor.h"
+#include "testsupport.h"
+
+class LatencyTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void percentilesWithinBucket();
+    void smallValuesAreExact();
+    void pressIsTakenOnce();
+    void summaryAndDump();
+};
+
+void LatencyTests::percentilesWithinBucket()
+{
+    LatencyHistogram histogram;
+    QCOMPARE(histogram.percentileNs(50), int64_t(0));
+    
+    for (int i = 1; i <= 100; ++i) {
+        histogram.record(i * 1000);
+    }
+    QCOMPARE(histogram.count(), uint64_t(100));
+    QCOMPARE(histogram.maxNs(), int64_t(100000));
+    
+    // A percentile is the upper bound of its bucket, at most 1/16 above
+    // the value itself, and never above the largest value seen
+    const int64_t p50 = histogram.percentileNs(50);
+    QVERIFY(p50 >= 50000);
+    QVERIFY(p50 <= 50000 + 50000 / 16);
+    const int64_t p0 = histogram.percentileNs(0);
+    QVERIFY(p0 >= 1000);
+    QVERIFY(p0 <= 1000 + 1000 / 16);
+    QCOMPARE(histogram.percentileNs(100), int64_t(100000));
+    
+    histogram.reset();
+    QCOMPARE(histogram.count(), uint64_t(0));
+    QCOMPARE(histogram.maxNs(), int64_t(0));
+    QVERIFY(histogram.buckets().isEmpty());
+}
+
+void LatencyTests::smallValuesAreExact()
+{
+    LatencyHistogram histogram;
+    histogram.record(3);
+    histogram.record(3);
+    histogram.record(-5);
+    
+    // Below 32 ns every value has a bucket of its own; negative counts as 0
+    const QList<QPair<int64_t, uint64_t>> buckets = histogram.buckets();
+    QCOMPARE(buckets.size(), 2);
+    QCOMPARE(buckets[0], qMakePair(int64_t(0), uint64_t(1)));
+    QCOMPARE(buckets[1], qMakePair(int64_t(3), uint64_t(2)));
+}
+
+void LatencyTests::pressIsTakenOnce()
+{
+    LatencyMonitor monitor;
+    QCOMPARE(monitor.takePress(), int64_t(0));
+    
+    // Only the first report after a press measures it
+    monitor.markPress(42 * MS);
+    QCOMPARE(monitor.pressTime(), 42 * MS);
+    QCOMPARE(monitor.takePress(), 42 * MS);
+    QCOMPARE(monitor.takePress(), int64_t(0));
+}
+
+void LatencyTests::summaryAndDump()
+{
+    LatencyMonitor monitor;
+    monitor.record(LatencyMonitor::Write, 2 * MS);
+    monitor.record(LatencyMonitor::Write, 2 * MS);
+    
+    // One entry per stage, in stage order, times in microseconds
+    const QVariantList summary = monitor.summary();
+    QCOMPARE(summary.size(), int(LatencyMonitor::StageCount));
+    const QVariantMap write = summary[LatencyMonitor::Write].toMap();
+    QCOMPARE(write["name"].toString(), QString("write"));
+    QCOMPARE(write["count"].toULongLong(), 2ULL);
+    QCOMPARE(write["maxUs"].toDouble(), 2000.0);
+    QCOMPARE(summary[LatencyMonitor::Click].toMap()["count"].toULongLong(), 0ULL);
+    
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath("stats/latency.csv");
+    QVERIFY(monitor.dump(path));
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+    const QStringList lines = QString::fromUtf8(file.readAll()).split('\n');
+    QCOMPARE(lines[0], QString("stage,count,p50_us,p90_us,p99_us,p999_us,max_us"));
+    QCOMPARE(lines[1 + LatencyMonitor::Write], QString("write,2,2000,2000,2000,2000,2000"));
+    
+    // Then the buckets, by their upper bound
+    const int buckets = lines.indexOf("stage,bucket_upper_us,count");
+    QVERIFY(buckets > 0);
+    QVERIFY(lines[buckets + 1].startsWith("write,20"));
+    QVERIFY(lines[buckets + 1].endsWith(",2"));
+    
+    monitor.reset();
+    QCOMPARE(monitor.histogram(LatencyMonitor::Write).count(), uint64_t(0));
+}
+
+QTEST_GUILESS_MAIN(LatencyTests)
+
+#include "latency_tests.moc"
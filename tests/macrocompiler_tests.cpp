@@ -0,0 +1,350 @@
+/**
+ * macrocompiler_tests - Programs the compiler builds from macro sequences
+ */
+
+#include <QTest>
+
+#include "macrocompiler.h"
+#include "testsupport.h"
+
+class MacroCompilerTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void reportsInWireFormat();
+    void streamedStepIsNotCompiled();
+    void stepGapBetweenSteps();
+    void delayStepAddsToGap();
+    void trailingDelayIsKept();
+    void packedTextSharesReports();
+    void textBorrowsHeldKeySlot();
+    void textFollowsLayout();
+    void unicodeInputMethods();
+    void unicodeKeepsHeldAlt();
+    void mouseMoveIsSplit();
+    void clickAndScroll();
+};
+
+static QVariantMap keyStep(uint8_t keyCode)
+{
+    return QVariantMap { { "type", "key" }, { "keyCode", keyCode } };
+}
+
+static QVariantMap delayStep(int ms)
+{
+    return QVariantMap { { "type", "delay" }, { "ms", ms } };
+}
+
+static MacroProgram compileText(const QString &text, bool packed,
+                                KeyboardLayout::Id layout = KeyboardLayout::Us)
+{
+    MacroCompiler compiler(0, KeyboardLayout::layout(layout), UnicodeInput::None);
+    compiler.addText(text, packed);
+    return compiler.finish();
+}
+
+/**
+ * Pause before each instruction, in microseconds
+ */
+static QList<uint32_t> delays(const MacroProgram &program)
+{
+    QList<uint32_t> result;
+    for (const MacroInstruction &instruction : program) {
+        result.append(instruction.delayUs);
+    }
+    return result;
+}
+
+void MacroCompilerTests::reportsInWireFormat()
+{
+    const QVariantMap combo { { "type", "combo" }, { "keys", QVariantList { KEY_A, KEY_B } },
+                              { "modifiers", LEFT_CTRL } };
+    
+    // The keys of a combo go down together, modifiers with them
+    const MacroProgram program = MacroCompiler::compile(QVariantList { combo }, 0);
+    QCOMPARE(program.size(), 2);
+    QCOMPARE(keyboardState(program[0].report), keyboardState(LEFT_CTRL, { KEY_A, KEY_B }));
+    QCOMPARE(keyboardState(program[1].report), keyboardState(0x00, {}));
+    
+    // Each instruction carries the report as it goes on the wire
+    for (const MacroInstruction &instruction : program) {
+        QCOMPARE(instruction.opcode, uint8_t(MacroInstruction::OpReport));
+        QCOMPARE(instruction.report[0], uint8_t(0xA1));
+        QCOMPARE(instruction.report[1], HID_KEYBOARD_REPORT_ID);
+    }
+    
+    // An empty macro compiles to nothing to send
+    QVERIFY(MacroCompiler::compile(QVariantList(), 30).isEmpty());
+}
+
+void MacroCompilerTests::streamedStepIsNotCompiled()
+{
+    const QVariantMap text { { "type", "text" }, { "text", "abc" }, { "stream", true } };
+    
+    // The whole macro becomes a marker for TextPaster, whatever else it has
+    const MacroProgram program = MacroCompiler::compile(QVariantList { keyStep(KEY_A), text }, 30);
+    QVERIFY(MacroCompiler::streams(program));
+    QVERIFY(!MacroCompiler::streams(MacroCompiler::compile(QVariantList { keyStep(KEY_A) }, 30)));
+    QVERIFY(MacroCompiler::isStreamed(QVariantMap { { "type", "text" }, { "file", "/tmp/paste.txt" } }));
+}
+
+void MacroCompilerTests::stepGapBetweenSteps()
+{
+    const QVariantList sequence { keyStep(KEY_A), keyStep(KEY_B) };
+    
+    // The gap goes before the next step only; the writer spaces the
+    // press and release of one key by itself
+    const MacroProgram program = MacroCompiler::compile(sequence, 30);
+    QCOMPARE(program.size(), 4);
+    QCOMPARE(delays(program), QList<uint32_t>({ 0, 0, 30000, 0 }));
+    QCOMPARE(keyboardState(program[0].report), keyboardState(0x00, { KEY_A }));
+    QCOMPARE(keyboardState(program[1].report), keyboardState(0x00, {}));
+    QCOMPARE(keyboardState(program[2].report), keyboardState(0x00, { KEY_B }));
+    QCOMPARE(keyboardState(program[3].report), keyboardState(0x00, {}));
+    
+    // A zero gap runs the steps back to back
+    QCOMPARE(delays(MacroCompiler::compile(sequence, 0)), QList<uint32_t>({ 0, 0, 0, 0 }));
+    
+    // A negative gap is treated as none
+    QCOMPARE(delays(MacroCompiler::compile(sequence, -5)), QList<uint32_t>({ 0, 0, 0, 0 }));
+}
+
+void MacroCompilerTests::delayStepAddsToGap()
+{
+    const QVariantList sequence { keyStep(KEY_A), delayStep(100), keyStep(KEY_B) };
+    
+    // The gap after the key and the delay add up; none follows the delay
+    QCOMPARE(delays(MacroCompiler::compile(sequence, 30)), QList<uint32_t>({ 0, 0, 130000, 0 }));
+    QCOMPARE(delays(MacroCompiler::compile(sequence, 0)), QList<uint32_t>({ 0, 0, 100000, 0 }));
+}
+
+void MacroCompilerTests::trailingDelayIsKept()
+{
+    // A macro that ends in a delay is done only once the delay is over
+    const MacroProgram program = MacroCompiler::compile(QVariantList { keyStep(KEY_A), delayStep(50) }, 30);
+    QCOMPARE(program.size(), 3);
+    QCOMPARE(program.last().opcode, uint8_t(MacroInstruction::OpDelay));
+    QCOMPARE(program.last().delayUs, uint32_t(80000));
+    
+    // The gap after the last regular step is dropped
+    QCOMPARE(MacroCompiler::compile(QVariantList { keyStep(KEY_A) }, 30).size(), 2);
+}
+
+void MacroCompilerTests::packedTextSharesReports()
+{
+    static const uint8_t KEY_D = 0x07;
+    static const uint8_t KEY_H = 0x0B;
+    
+    // One report per key edge unpacked, one per batch of keys packed
+    QCOMPARE(compileText("abc", false).size(), 6);
+    const MacroProgram abc = compileText("abc", true);
+    QCOMPARE(abc.size(), 2);
+    QCOMPARE(keyboardState(abc[0].report), keyboardState(0x00, { KEY_A, KEY_B, KEY_C }));
+    QCOMPARE(keyboardState(abc[1].report), keyboardState(0x00, {}));
+    
+    // A batch ends when the slots are full
+    const MacroProgram full = compileText("abcdefgh", true);
+    QCOMPARE(full.size(), 4);
+    QCOMPARE(keyboardState(full[0].report), keyboardState(0x00, { KEY_A, KEY_B, KEY_C, KEY_D, 0x08, 0x09 }));
+    QCOMPARE(keyboardState(full[2].report), keyboardState(0x00, { 0x0A, KEY_H }));
+    
+    // A repeated key would not register twice in one report
+    const MacroProgram repeated = compileText("aab", true);
+    QCOMPARE(repeated.size(), 4);
+    QCOMPARE(keyboardState(repeated[0].report), keyboardState(0x00, { KEY_A }));
+    QCOMPARE(keyboardState(repeated[2].report), keyboardState(0x00, { KEY_A, KEY_B }));
+    
+    // Keys needing other modifiers start a new batch
+    const MacroProgram shifted = compileText("aBc", true);
+    QCOMPARE(shifted.size(), 6);
+    QCOMPARE(keyboardState(shifted[2].report), keyboardState(LEFT_SHIFT, { KEY_B }));
+    QCOMPARE(keyboardState(shifted[4].report), keyboardState(0x00, { KEY_C }));
+}
+
+void MacroCompilerTests::textBorrowsHeldKeySlot()
+{
+    static const uint8_t KEY_Y = 0x1C;
+    static const uint8_t KEY_Z = 0x1D;
+    const std::initializer_list<uint8_t> held { 0x04, 0x05, 0x06, 0x07, 0x08, 0x09 };
+    const std::initializer_list<uint8_t> lent { 0x04, 0x05, 0x06, 0x07, 0x08 };
+    
+    for (bool packed : { false, true }) {
+        MacroCompiler compiler(0);
+        for (uint8_t key : held) {
+            compiler.addPress(key, 0x00);
+        }
+        compiler.take();
+        
+        // Six held keys leave no slot: the last one steps aside for each
+        // typed key and goes down again, instead of the text vanishing
+        compiler.addText("zy", packed);
+        const MacroProgram program = compiler.take();
+        QCOMPARE(program.size(), 8);
+        QCOMPARE(keyboardState(program[0].report), keyboardState(0x00, lent));
+        QCOMPARE(keyboardState(program[1].report), keyboardState(0x00, { 0x04, 0x05, 0x06, 0x07, 0x08, KEY_Z }));
+        QCOMPARE(keyboardState(program[2].report), keyboardState(0x00, lent));
+        QCOMPARE(keyboardState(program[3].report), keyboardState(0x00, held));
+        QCOMPARE(keyboardState(program[5].report), keyboardState(0x00, { 0x04, 0x05, 0x06, 0x07, 0x08, KEY_Y }));
+        QCOMPARE(keyboardState(program[7].report), keyboardState(0x00, held));
+    }
+}
+
+void MacroCompilerTests::textFollowsLayout()
+{
+    static const uint8_t KEY_Q = 0x14;
+    static const uint8_t KEY_Y = 0x1C;
+    static const uint8_t KEY_Z = 0x1D;
+    static const uint8_t KEY_GRAVE = 0x35;
+    static const uint8_t KEY_SPACE = 0x2C;
+    static const uint8_t RIGHT_ALT = 0x40;
+    
+    // The same text presses other keys for another layout
+    QCOMPARE(keyboardState(compileText("z", false)[0].report), keyboardState(0x00, { KEY_Z }));
+    QCOMPARE(keyboardState(compileText("z", false, KeyboardLayout::De)[0].report), keyboardState(0x00, { KEY_Y }));
+    QCOMPARE(keyboardState(compileText("a", false, KeyboardLayout::Fr)[0].report), keyboardState(0x00, { KEY_Q }));
+    QCOMPARE(keyboardState(compileText("@", false, KeyboardLayout::De)[0].report),
+             keyboardState(RIGHT_ALT, { KEY_Q }));
+    
+    // A dead key only types its character once Space follows
+    const MacroProgram caret = compileText("^", false, KeyboardLayout::De);
+    QCOMPARE(caret.size(), 4);
+    QCOMPARE(keyboardState(caret[0].report), keyboardState(0x00, { KEY_GRAVE }));
+    QCOMPARE(keyboardState(caret[2].report), keyboardState(0x00, { KEY_SPACE }));
+    
+    // Characters a layout has no key for are left out without an input method
+    QVERIFY(compileText(QString::fromUtf8("ä"), false).isEmpty());
+    QCOMPARE(compileText(QString::fromUtf8("ä"), false, KeyboardLayout::De).size(), 2);
+}
+
+static MacroProgram compileUnicode(const QString &text, UnicodeInput::Method method)
+{
+    const QVariantMap step { { "type", "text" }, { "text", text } };
+    return MacroCompiler::compile(QVariantList { step }, 0, KeyboardLayout::layout(KeyboardLayout::Us), method);
+}
+
+static QList<QByteArray> states(const MacroProgram &program)
+{
+    QList<QByteArray> result;
+    for (const MacroInstruction &instruction : program) {
+        result.append(keyboardState(instruction.report));
+    }
+    return result;
+}
+
+void MacroCompilerTests::unicodeInputMethods()
+{
+    static const uint8_t KEY_E = 0x08;
+    static const uint8_t KEY_U = 0x18;
+    static const uint8_t KEY_0 = 0x27;
+    static const uint8_t KEY_9 = 0x26;
+    static const uint8_t KEY_SPACE = 0x2C;
+    static const uint8_t KEYPAD_PLUS = 0x57;
+    static const uint8_t KEYPAD_9 = 0x61;
+    const QString text = QString::fromUtf8("é");  // U+00E9
+    const QByteArray released = keyboardState(0x00, {});
+    const QByteArray alt = keyboardState(LEFT_ALT, {});
+    
+    // Linux: Ctrl+Shift+U, the code point, Space
+    const MacroProgram onLinux = compileUnicode(text, UnicodeInput::Linux);
+    QCOMPARE(states(onLinux), QList<QByteArray>({
+        keyboardState(LEFT_CTRL | LEFT_SHIFT, { KEY_U }), released,
+        keyboardState(0x00, { KEY_E }), released,
+        keyboardState(0x00, { KEY_9 }), released,
+        keyboardState(0x00, { KEY_SPACE }), released,
+    }));
+    
+    // Windows: Alt held over keypad +, then the digits on the keypad
+    const MacroProgram onWindows = compileUnicode(text, UnicodeInput::Windows);
+    QCOMPARE(states(onWindows), QList<QByteArray>({
+        alt, keyboardState(LEFT_ALT, { KEYPAD_PLUS }), alt,
+        keyboardState(LEFT_ALT, { KEY_E }), alt,
+        keyboardState(LEFT_ALT, { KEYPAD_9 }), alt,
+        released,
+    }));
+    
+    // macOS: Option held over four hex digits per UTF-16 unit
+    const MacroProgram onMac = compileUnicode(text, UnicodeInput::MacOs);
+    QCOMPARE(states(onMac), QList<QByteArray>({
+        alt, keyboardState(LEFT_ALT, { KEY_0 }), alt, keyboardState(LEFT_ALT, { KEY_0 }), alt,
+        keyboardState(LEFT_ALT, { KEY_E }), alt, keyboardState(LEFT_ALT, { KEY_9 }), alt,
+        released,
+    }));
+    
+    // Beyond the BMP, Windows gets one sequence per surrogate
+    const QString emoji = QString::fromUtf8("😀");  // U+1F600, D83D DE00
+    const MacroProgram pair = compileUnicode(emoji, UnicodeInput::Windows);
+    int plus = 0;
+    for (const QByteArray &state : states(pair)) {
+        plus += state == keyboardState(LEFT_ALT, { KEYPAD_PLUS }) ? 1 : 0;
+    }
+    QCOMPARE(plus, 2);
+    
+    // Without an input method the character is left out
+    QVERIFY(compileUnicode(text, UnicodeInput::None).isEmpty());
+}
+
+void MacroCompilerTests::unicodeKeepsHeldAlt()
+{
+    MacroCompiler compiler(0, KeyboardLayout::layout(KeyboardLayout::Us), UnicodeInput::Windows);
+    compiler.addPress(0x00, LEFT_ALT);
+    compiler.take();
+    
+    // An Alt held by a press step stays down through the sequence and is
+    // left for the macro to release
+    compiler.addText(QString::fromUtf8("é"));
+    const MacroProgram program = compiler.take();
+    QCOMPARE(program.size(), 6);
+    for (const MacroInstruction &instruction : program) {
+        QCOMPARE(instruction.report[2], LEFT_ALT);
+    }
+    QCOMPARE(keyboardState(compiler.finish().last().report), keyboardState(0x00, {}));
+}
+
+void MacroCompilerTests::mouseMoveIsSplit()
+{
+    const QVariantMap move { { "type", "mouse_move" }, { "x", 100 }, { "y", -40 } };
+    const MacroProgram program = MacroCompiler::compile(QVariantList { move }, 0);
+    
+    // Small even steps that add up to the whole move exactly
+    QCOMPARE(program.size(), 7);
+    int x = 0;
+    int y = 0;
+    for (const MacroInstruction &instruction : program) {
+        QCOMPARE(instruction.report[1], HID_MOUSE_REPORT_ID);
+        QCOMPARE(instruction.report[2], uint8_t(0x00));
+        const int dx = int8_t(instruction.report[3]);
+        const int dy = int8_t(instruction.report[4]);
+        QVERIFY(dx == 14 || dx == 15);
+        QVERIFY(dy == -5 || dy == -6);
+        x += dx;
+        y += dy;
+    }
+    QCOMPARE(x, 100);
+    QCOMPARE(y, -40);
+}
+
+void MacroCompilerTests::clickAndScroll()
+{
+    // A double click is two presses of the button, numbered from 1
+    const QVariantMap click { { "type", "click" }, { "button", 2 }, { "count", 2 } };
+    const MacroProgram clicks = MacroCompiler::compile(QVariantList { click }, 0);
+    QCOMPARE(clicks.size(), 4);
+    const uint8_t buttons[] = { 0x02, 0x00, 0x02, 0x00 };
+    for (int i = 0; i < clicks.size(); ++i) {
+        QCOMPARE(clicks[i].report[1], HID_MOUSE_REPORT_ID);
+        QCOMPARE(clicks[i].report[2], buttons[i]);
+    }
+    
+    // Wheel notches fit a single report up to its limit
+    const QVariantMap scroll { { "type", "scroll" }, { "y", -3 }, { "x", 200 } };
+    const MacroProgram scrolls = MacroCompiler::compile(QVariantList { scroll }, 0);
+    QCOMPARE(scrolls.size(), 2);
+    QCOMPARE(int8_t(scrolls[0].report[5]) + int8_t(scrolls[1].report[5]), -3);
+    QCOMPARE(int(int8_t(scrolls[0].report[6])), 100);
+    QCOMPARE(int(int8_t(scrolls[1].report[6])), 100);
+}
+
+QTEST_GUILESS_MAIN(MacroCompilerTests)
+
+#include "macrocompiler_tests.moc"
@@ -0,0 +1,296 @@
+/**
+ * macroconfig_tests - Macro store, pages, saving and reloading of MacroConfig
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTest>
+
+#include "macroconfig.h"
+#include "testsupport.h"
+
+class MacroConfigTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void handlesGoStale();
+    void requestedSavesAreCoalesced();
+    void pendingSaveIsFlushed();
+    void changedFileIsDiffed();
+    void ownSaveIsNotReloaded();
+    void pagesDecodeWhenShown();
+    void recompileKeepsPage();
+};
+
+/**
+ * Default config path, in the test-mode config location
+ */
+static QString configPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/macropad/macros.json";
+}
+
+/**
+ * Replace the config file the way editors and provisioning tools do
+ */
+static bool writeConfig(const QByteArray &json)
+{
+    QDir().mkpath(QFileInfo(configPath()).absolutePath());
+    QSaveFile file(configPath());
+    return file.open(QIODevice::WriteOnly) && file.write(json) == json.size() && file.commit();
+}
+
+static QByteArray macroJson(const char *id, const char *name)
+{
+    return QByteArray("{ \"id\": \"") + id + "\", \"name\": \"" + name
+        + "\", \"sequence\": [ { \"type\": \"text\", \"text\": \"" + id + "\" } ] }";
+}
+
+static QByteArray configJson(const QList<QByteArray> &macros)
+{
+    QByteArray json("{ \"columns\": 4, \"rows\": 2, \"macros\": [ ");
+    for (int i = 0; i < macros.size(); ++i) {
+        json += (i > 0 ? ", " : "") + macros[i];
+    }
+    return json + " ] }";
+}
+
+void MacroConfigTests::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void MacroConfigTests::init()
+{
+    QDir(QFileInfo(configPath()).absolutePath()).removeRecursively();
+}
+
+void MacroConfigTests::cleanup()
+{
+    KeyboardLayout::setCurrent(KeyboardLayout::layout(KeyboardLayout::Us));
+}
+
+void MacroConfigTests::handlesGoStale()
+{
+    MacroConfig config;
+    config.resetToDefaults();
+    
+    const int copy = config.macroHandle("copy");
+    QVERIFY(copy != MacroConfig::InvalidHandle);
+    QCOMPARE(config.macroAt(copy)->id, QString("copy"));
+    QCOMPARE(config.rowOf(copy), 0);
+    QCOMPARE(config.handleAtRow(0), copy);
+    QCOMPARE(config.getMacro("copy")["handle"].toInt(), copy);
+    
+    // A removed macro's handle resolves to nothing, even once another
+    // macro with the same id has taken its slot
+    config.removeMacro("copy");
+    QVERIFY(!config.macroAt(copy));
+    QCOMPARE(config.macroHandle("copy"), int(MacroConfig::InvalidHandle));
+    QCOMPARE(config.rowOf(copy), -1);
+    config.addMacro(QVariantMap { { "id", "copy" }, { "name", "Again" } });
+    const int again = config.macroHandle("copy");
+    QVERIFY(again != copy);
+    QVERIFY(!config.macroAt(copy));
+    QCOMPARE(config.macroAt(again)->name, QString("Again"));
+    QCOMPARE(config.rowOf(again), config.count() - 1);
+    
+    // Ids stay unique, so every id finds exactly one macro
+    config.addMacro(QVariantMap { { "id", "copy" }, { "name", "Third" } });
+    QCOMPARE(config.getMacro("copy_2")["name"].toString(), QString("Third"));
+    QCOMPARE(config.getMacro("copy")["name"].toString(), QString("Again"));
+    QVERIFY(config.getMacro("missing").isEmpty());
+}
+
+void MacroConfigTests::requestedSavesAreCoalesced()
+{
+    MacroConfig config;
+    QVERIFY(config.loadConfig());
+    QVERIFY(QFile::exists(configPath()));
+    QSignalSpy saved(&config, &MacroConfig::configSaved);
+    
+    // A burst of edits is written once, after the burst
+    config.addMacro(QVariantMap { { "id", "one" }, { "name", "One" } });
+    config.requestSave();
+    config.addMacro(QVariantMap { { "id", "two" }, { "name", "Two" } });
+    config.requestSave();
+    config.removeMacro("copy");
+    config.requestSave();
+    QCOMPARE(saved.size(), 0);
+    QTRY_COMPARE(saved.size(), 1);
+    
+    // The file was replaced whole, leaving no temporary file behind
+    const QStringList files = QFileInfo(configPath()).dir().entryList(QDir::Files);
+    QCOMPARE(files, QStringList({ "macros.json", "macros.json.cache" }));
+    
+    MacroConfig loaded;
+    QVERIFY(loaded.loadConfig());
+    QCOMPARE(loaded.count(), config.count());
+    QCOMPARE(loaded.getMacro("two")["name"].toString(), QString("Two"));
+    QVERIFY(loaded.getMacro("copy").isEmpty());
+}
+
+void MacroConfigTests::pendingSaveIsFlushed()
+{
+    // Edits still waiting for their save are written on the way out
+    {
+        MacroConfig config;
+        QVERIFY(config.loadConfig());
+        config.updateMacro("copy", QVariantMap { { "name", "Copy that" } });
+        config.requestSave();
+    }
+    
+    MacroConfig loaded;
+    QVERIFY(loaded.loadConfig());
+    QCOMPARE(loaded.getMacro("copy")["name"].toString(), QString("Copy that"));
+}
+
+void MacroConfigTests::changedFileIsDiffed()
+{
+    QVERIFY(writeConfig(configJson({ macroJson("copy", "Copy"), macroJson("paste", "Paste"),
+                                     macroJson("cut", "Cut") })));
+    MacroConfig config;
+    QVERIFY(config.loadConfig());
+    const int copy = config.macroHandle("copy");
+    
+    QSignalSpy removed(&config, &MacroConfig::macroRemoved);
+    QSignalSpy moved(&config, &MacroConfig::macroMoved);
+    QSignalSpy updated(&config, &MacroConfig::macroUpdated);
+    QSignalSpy inserted(&config, &MacroConfig::macroInserted);
+    QSignalSpy reset(&config, &MacroConfig::macrosReset);
+    QSignalSpy loaded(&config, &MacroConfig::configLoaded);
+    
+    // Cut is gone, Paste moved up, Copy renamed and Shot is new; each
+    // shows up as a change of its own row
+    QVERIFY(writeConfig(configJson({ macroJson("paste", "Paste"), macroJson("copy", "Copy all"),
+                                     macroJson("shot", "Shot") })));
+    QTRY_COMPARE(loaded.size(), 1);
+    QCOMPARE(reset.size(), 0);
+    QCOMPARE(removed.size(), 1);
+    QCOMPARE(removed[0][0].toInt(), 2);
+    QCOMPARE(moved.size(), 1);
+    QCOMPARE(moved[0], QList<QVariant>({ 1, 0 }));
+    QCOMPARE(updated.size(), 1);
+    QCOMPARE(updated[0][0].toInt(), 1);
+    QCOMPARE(inserted.size(), 1);
+    QCOMPARE(inserted[0][0].toInt(), 2);
+    
+    // Macros that stayed keep their handles
+    QCOMPARE(config.macroHandle("copy"), copy);
+    QCOMPARE(config.macroAt(copy)->name, QString("Copy all"));
+    QCOMPARE(config.handleAtRow(2), config.macroHandle("shot"));
+    QVERIFY(!config.macroAt(copy)->program.isEmpty());
+}
+
+void MacroConfigTests::ownSaveIsNotReloaded()
+{
+    MacroConfig config;
+    QVERIFY(config.loadConfig());
+    QSignalSpy loaded(&config, &MacroConfig::configLoaded);
+    QSignalSpy errors(&config, &MacroConfig::error);
+    
+    // The watcher sees our own write, which matches what is loaded
+    config.addMacro(QVariantMap { { "id", "one" }, { "name", "One" } });
+    QVERIFY(config.saveConfig());
+    QTest::qWait(500);
+    QCOMPARE(loaded.size(), 0);
+    QCOMPARE(errors.size(), 0);
+    
+    // A broken file is reported and the macros stay as they are
+    const int count = config.count();
+    QVERIFY(writeConfig("{ \"macros\": [ "));
+    QTRY_COMPARE(errors.size(), 1);
+    QCOMPARE(loaded.size(), 0);
+    QCOMPARE(config.count(), count);
+}
+
+void MacroConfigTests::pagesDecodeWhenShown()
+{
+    const QByteArray json = "{ \"pages\": [ "
+        "{ \"name\": \"One\", \"macros\": [ " + macroJson("a", "A") + " ] }, "
+        "{ \"name\": \"Two\", \"macros\": [ " + macroJson("b", "B") + ", " + macroJson("c", "C") + " ] }, "
+        "{ \"name\": \"Bad\", \"macros\": [ { \"id\": \"x\", \"stepGapMs\": \"none\" } ] } ] }";
+    QVERIFY(writeConfig(json));
+    
+    // Only the first page is built; the broken one is not looked at yet
+    MacroConfig config;
+    QVERIFY(config.loadConfig());
+    QCOMPARE(config.pageNames(), QStringList({ "One", "Two", "Bad" }));
+    QCOMPARE(config.currentPage(), 0);
+    QCOMPARE(config.count(), 1);
+    QCOMPARE(config.macroHandle("b"), int(MacroConfig::InvalidHandle));
+    
+    config.setCurrentPage(1);
+    QCOMPARE(config.currentPage(), 1);
+    QCOMPARE(config.count(), 2);
+    QCOMPARE(config.getMacro("b")["name"].toString(), QString("B"));
+    QVERIFY(!config.getMacroProgram("c").isEmpty());
+    QCOMPARE(config.macroHandle("a"), int(MacroConfig::InvalidHandle));
+    
+    // Edits to a page survive showing another one
+    config.addMacro(QVariantMap { { "id", "d" }, { "name", "D" } });
+    config.setCurrentPage(0);
+    QCOMPARE(config.getMacro("a")["name"].toString(), QString("A"));
+    config.setCurrentPage(1);
+    QCOMPARE(config.count(), 3);
+    QCOMPARE(config.getMacro("d")["name"].toString(), QString("D"));
+    
+    // A page that does not decode is reported and not shown
+    QSignalSpy errors(&config, &MacroConfig::error);
+    config.setCurrentPage(2);
+    QCOMPARE(errors.size(), 1);
+    QCOMPARE(config.currentPage(), 1);
+    
+    // Saving keeps every page, including the one never shown
+    QVERIFY(config.saveConfig());
+    MacroConfig loaded;
+    QVERIFY(loaded.loadConfig());
+    QCOMPARE(loaded.pageNames(), QStringList({ "One", "Two", "Bad" }));
+    loaded.setCurrentPage(1);
+    QCOMPARE(loaded.count(), 3);
+    QCOMPARE(loaded.getMacro("d")["name"].toString(), QString("D"));
+}
+
+void MacroConfigTests::recompileKeepsPage()
+{
+    static const uint8_t KEY_Y = 0x1C;
+    
+    const QByteArray json = "{ \"pages\": [ "
+        "{ \"name\": \"One\", \"macros\": [ " + macroJson("z", "Z") + " ] }, "
+        "{ \"name\": \"Two\", \"macros\": [ " + macroJson("zz", "ZZ") + " ] }, "
+        "{ \"name\": \"Three\", \"macros\": [ " + macroJson("zzz", "ZZZ") + " ] } ] }";
+    QVERIFY(writeConfig(json));
+    MacroConfig config;
+    QVERIFY(config.loadConfig());
+    config.setCurrentPage(1);
+    config.setCurrentPage(0);
+    const int handle = config.macroHandle("z");
+    QSignalSpy reset(&config, &MacroConfig::macrosReset);
+    
+    // German keyboards type z on the key US ones have y on; the page and
+    // its handles stay as they are
+    KeyboardLayout::setCurrent(KeyboardLayout::layout(KeyboardLayout::De));
+    config.recompile();
+    QCOMPARE(config.currentPage(), 0);
+    QCOMPARE(reset.size(), 0);
+    QCOMPARE(config.macroHandle("z"), handle);
+    QCOMPARE(config.getMacroProgram("z").first().report[4], KEY_Y);
+    
+    // A page decoded before, and one never shown, come up German too
+    config.setCurrentPage(1);
+    QCOMPARE(config.getMacroProgram("zz").first().report[4], KEY_Y);
+    config.setCurrentPage(2);
+    QCOMPARE(config.getMacroProgram("zzz").first().report[4], KEY_Y);
+}
+
+QTEST_GUILESS_MAIN(MacroConfigTests)
+
+#include "macroconfig_tests.moc"
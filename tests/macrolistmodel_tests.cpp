@@ -0,0 +1,97 @@
+/**
+ * macrolistmodel_tests - MacroListModel following the edits of its MacroConfig
+ */
+
+#include <QAbstractItemModelTester>
+#include <QSignalSpy>
+#include <QTest>
+
+#include "macrolistmodel.h"
+#include "testsupport.h"
+
+class MacroListModelTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void rowsFollowConfig();
+    void executingCountsRuns();
+};
+
+void MacroListModelTests::rowsFollowConfig()
+{
+    MacroConfig config;
+    config.resetToDefaults();
+    MacroListModel model(&config);
+    QAbstractItemModelTester tester(&model, QAbstractItemModelTester::FailureReportingMode::QtTest);
+    
+    QCOMPARE(model.rowCount(), config.count());
+    const QModelIndex first = model.index(0);
+    QCOMPARE(first.data(MacroListModel::IdRole).toString(), QString("copy"));
+    QCOMPARE(first.data(MacroListModel::NameRole).toString(), QString("Copy"));
+    QCOMPARE(first.data(MacroListModel::HandleRole).toInt(), config.macroHandle("copy"));
+    QCOMPARE(first.data(MacroListModel::ExecutingRole).toBool(), false);
+    
+    // Edits arrive as single-row changes, not as a reset
+    QSignalSpy reset(&model, &QAbstractItemModel::modelReset);
+    QSignalSpy inserted(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removed(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changed(&model, &QAbstractItemModel::dataChanged);
+    QSignalSpy count(&model, &MacroListModel::countChanged);
+    
+    QVariantMap macro = config.getMacro("paste");
+    macro["name"] = "Paste plain";
+    config.updateMacro("paste", macro);
+    QCOMPARE(changed.size(), 1);
+    QCOMPARE(changed[0][0].toModelIndex().row(), 1);
+    QCOMPARE(model.index(1).data(MacroListModel::NameRole).toString(), QString("Paste plain"));
+    
+    config.addMacro(QVariantMap { { "id", "extra" }, { "name", "Extra" } });
+    QCOMPARE(inserted.size(), 1);
+    QCOMPARE(inserted[0][1].toInt(), config.count() - 1);
+    config.removeMacro("copy");
+    QCOMPARE(removed.size(), 1);
+    QCOMPARE(removed[0][1].toInt(), 0);
+    QCOMPARE(count.size(), 2);
+    QCOMPARE(reset.size(), 0);
+    QCOMPARE(model.index(0).data(MacroListModel::IdRole).toString(), QString("paste"));
+    
+    // Loading another set of macros replaces the rows in one go
+    config.resetToDefaults();
+    QCOMPARE(reset.size(), 1);
+    QCOMPARE(model.rowCount(), config.count());
+}
+
+void MacroListModelTests::executingCountsRuns()
+{
+    MacroConfig config;
+    config.resetToDefaults();
+    MacroListModel model(&config);
+    QSignalSpy changed(&model, &QAbstractItemModel::dataChanged);
+    
+    // Two runs of the same macro: it executes until both are done, and
+    // only the edges touch the row
+    const int handle = config.macroHandle("cut");
+    const int row = config.rowOf(handle);
+    model.setExecuting(handle, true);
+    model.setExecuting(handle, true);
+    QCOMPARE(changed.size(), 1);
+    QCOMPARE(changed[0][0].toModelIndex().row(), row);
+    QCOMPARE(changed[0][2].value<QList<int>>(), QList<int>({ MacroListModel::ExecutingRole }));
+    QVERIFY(model.index(row).data(MacroListModel::ExecutingRole).toBool());
+    
+    model.setExecuting(handle, false);
+    QVERIFY(model.index(row).data(MacroListModel::ExecutingRole).toBool());
+    model.setExecuting(handle, false);
+    QVERIFY(!model.index(row).data(MacroListModel::ExecutingRole).toBool());
+    QCOMPARE(changed.size(), 2);
+    
+    // A finish without a start, or for no macro, changes nothing
+    model.setExecuting(handle, false);
+    model.setExecuting(MacroConfig::InvalidHandle, true);
+    QCOMPARE(changed.size(), 2);
+}
+
+QTEST_GUILESS_MAIN(MacroListModelTests)
+
+#include "macrolistmodel_tests.moc"
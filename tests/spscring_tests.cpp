@@ -0,0 +1,107 @@
+/**
+ * spscring_tests - Ordering and bounds of the writer's lock-free ring
+ */
+
+#include <QTest>
+
+#include <thread>
+
+#include "spscring.h"
+
+class SpscRingTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void pushPop();
+    void fullRing();
+    void wrapsAround();
+    void twoThreads();
+};
+
+void SpscRingTests::pushPop()
+{
+    SpscRing<int, 8> ring;
+    QVERIFY(ring.isEmpty());
+    QVERIFY(ring.front() == nullptr);
+    
+    QVERIFY(ring.push(1));
+    QVERIFY(ring.push(2));
+    QCOMPARE(ring.size(), size_t(2));
+    
+    // Oldest first
+    QCOMPARE(*ring.front(), 1);
+    ring.pop();
+    QCOMPARE(*ring.front(), 2);
+    ring.pop();
+    QVERIFY(ring.isEmpty());
+}
+
+void SpscRingTests::fullRing()
+{
+    SpscRing<int, 4> ring;
+    QCOMPARE(ring.capacity(), size_t(4));
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(ring.push(i));
+    }
+    
+    // A full ring refuses the push and keeps what it holds
+    QVERIFY(!ring.push(4));
+    QCOMPARE(ring.size(), size_t(4));
+    QCOMPARE(*ring.front(), 0);
+    
+    ring.pop();
+    QVERIFY(ring.push(4));
+}
+
+void SpscRingTests::wrapsAround()
+{
+    SpscRing<int, 4> ring;
+    
+    // Many more elements than slots go through in order
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY(ring.push(i));
+        QVERIFY(ring.push(i + 1000));
+        QCOMPARE(*ring.front(), i);
+        ring.pop();
+        QCOMPARE(*ring.front(), i + 1000);
+        ring.pop();
+    }
+    QVERIFY(ring.isEmpty());
+}
+
+void SpscRingTests::twoThreads()
+{
+    static const int COUNT = 200000;
+    SpscRing<int, 64> ring;
+    
+    std::thread producer([&ring]() {
+        for (int i = 0; i < COUNT; ++i) {
+            while (!ring.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    
+    // The consumer sees every element exactly once and in order
+    int expected = 0;
+    bool ordered = true;
+    while (expected < COUNT) {
+        const int *value = ring.front();
+        if (!value) {
+            std::this_thread::yield();
+            continue;
+        }
+        ordered = ordered && *value == expected;
+        ring.pop();
+        ++expected;
+    }
+    producer.join();
+    
+    QVERIFY(ordered);
+    QVERIFY(ring.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(SpscRingTests)
+
+#include "spscring_tests.moc"
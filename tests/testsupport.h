@@ -0,0 +1,85 @@
+#ifndef TESTSUPPORT_H
+#define TESTSUPPORT_H
+
+#include <QByteArray>
+#include <QList>
+
+#include <poll.h>
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+#include "hidreport.h"
+#include "loopbacktransport.h"
+
+/**
+ * Helpers shared by the unit tests: report builders and a loopback host
+ * that waits for what the writer sends.
+ */
+
+static const int64_t MS = 1000000;
+
+static const uint8_t KEY_A = 0x04;
+static const uint8_t KEY_B = 0x05;
+static const uint8_t KEY_C = 0x06;
+static const uint8_t LEFT_CTRL = 0x01;
+static const uint8_t LEFT_SHIFT = 0x02;
+static const uint8_t LEFT_ALT = 0x04;
+
+// Long enough for a loaded CI machine, short enough to fail fast
+static const int RECEIVE_TIMEOUT_MS = 2000;
+static const int QUIET_MS = 100;
+
+inline HidReport keyboardReport(uint8_t modifiers, std::initializer_list<uint8_t> keys,
+                                int64_t deadlineNs, uint8_t flags = HidReport::NoFlags, uint8_t voice = 0)
+{
+    HidReport report = makeKeyboardReport(modifiers, 0x00, deadlineNs, voice);
+    buildKeyboardReport(report.data, modifiers, keys.begin(), static_cast<int>(keys.size()));
+    report.flags = flags;
+    return report;
+}
+
+/**
+ * Read reports from the loopback host until count have arrived or
+ * timeoutMs has passed without them
+ */
+inline QList<LoopbackRecord> receive(LoopbackTransport *transport, int count, int timeoutMs = RECEIVE_TIMEOUT_MS)
+{
+    QList<LoopbackRecord> records;
+    const int64_t deadline = monotonicNowNs() + timeoutMs * MS;
+    while (records.size() < count) {
+        const int64_t left = deadline - monotonicNowNs();
+        if (left <= 0) {
+            break;
+        }
+        struct pollfd fd = { transport->hostFd(), POLLIN, 0 };
+        if (poll(&fd, 1, static_cast<int>(left / MS) + 1) > 0) {
+            transport->readRecords(records);
+        }
+    }
+    return records;
+}
+
+/**
+ * Bytes of one keyboard report: modifiers, then the six key slots
+ */
+inline QByteArray keyboardState(const uint8_t *data)
+{
+    return QByteArray(reinterpret_cast<const char *>(data + 2), 1)
+        + QByteArray(reinterpret_cast<const char *>(data + 4), HID_REPORT_KEY_SLOTS);
+}
+
+inline QByteArray keyboardState(const LoopbackRecord &record)
+{
+    return keyboardState(record.data);
+}
+
+inline QByteArray keyboardState(uint8_t modifiers, std::initializer_list<uint8_t> keys)
+{
+    uint8_t data[HID_REPORT_SIZE];
+    buildKeyboardReport(data, modifiers, keys.begin(), static_cast<int>(keys.size()));
+    return keyboardState(data);
+}
+
+#endif // TESTSUPPORT_H
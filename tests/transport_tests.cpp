@@ -0,0 +1,241 @@
+/**
+ * transport_tests - Bytes each transport writes and host requests it answers
+ *
+ * The transports are given one end of a socketpair; the test plays the
+ * host on the other end.
+ */
+
+#include <QTest>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "hidgtransport.h"
+#include "l2captransport.h"
+#include "testsupport.h"
+
+class TransportTests : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void l2capReportBytes();
+    void l2capGetReport();
+    void l2capSetProtocol();
+    void l2capLedReports();
+    void l2capHangUp();
+    void hidgReportBytes();
+    void hidgConsumerReportBytes();
+    void hidgLedReport();
+};
+
+/**
+ * Control and interrupt channels of one L2CAP host, as socketpairs
+ */
+struct L2capHost {
+    int control[2] = { -1, -1 };
+    int interrupt[2] = { -1, -1 };
+
+    bool open()
+    {
+        return ::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, control) == 0
+            && ::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, interrupt) == 0;
+    }
+
+    ~L2capHost()
+    {
+        ::close(control[1]);
+        ::close(interrupt[1]);
+    }
+
+    /**
+     * Send a control request and return the whole reply
+     */
+    QByteArray reply(L2capTransport &transport, const QByteArray &message)
+    {
+        if (::send(control[1], message.constData(), message.size(), 0) != message.size()) {
+            return QByteArray();
+        }
+        transport.handleInput(control[0]);
+        char data[64];
+        const ssize_t size = ::recv(control[1], data, sizeof(data), MSG_DONTWAIT);
+        return size > 0 ? QByteArray(data, size) : QByteArray();
+    }
+
+    /**
+     * Send a control request and return the first byte of the reply
+     */
+    int request(L2capTransport &transport, const QByteArray &message)
+    {
+        const QByteArray data = reply(transport, message);
+        return data.isEmpty() ? -1 : uint8_t(data[0]);
+    }
+};
+
+static QByteArray bytes(const uint8_t *data, int size)
+{
+    return QByteArray(reinterpret_cast<const char *>(data), size);
+}
+
+void TransportTests::l2capReportBytes()
+{
+    L2capHost host;
+    QVERIFY(host.open());
+    L2capTransport transport(host.control[0], host.interrupt[0]);
+    
+    // HIDP carries the whole report, header byte first
+    uint8_t data[HID_REPORT_SIZE];
+    uint8_t received[64];
+    
+    buildKeyboardReport(data, LEFT_SHIFT, KEY_A);
+    QCOMPARE(transport.sendReport(data, hidReportSize(data)), ssize_t(HID_REPORT_SIZE));
+    QCOMPARE(::recv(host.interrupt[1], received, sizeof(received), 0), ssize_t(HID_REPORT_SIZE));
+    QCOMPARE(memcmp(received, data, HID_REPORT_SIZE), 0);
+    
+    // Media keys go out in the shorter Consumer Control report
+    buildConsumerReport(data, 0x00E9);
+    QCOMPARE(transport.sendReport(data, hidReportSize(data)), ssize_t(HID_CONSUMER_REPORT_SIZE));
+    QCOMPARE(::recv(host.interrupt[1], received, sizeof(received), 0), ssize_t(HID_CONSUMER_REPORT_SIZE));
+    QCOMPARE(bytes(received, HID_CONSUMER_REPORT_SIZE), QByteArray("\xA1\x02\xE9\x00", 4));
+}
+
+void TransportTests::l2capGetReport()
+{
+    L2capHost host;
+    QVERIFY(host.open());
+    L2capTransport transport(host.control[0], host.interrupt[0]);
+    uint8_t data[HID_REPORT_SIZE];
+    
+    // Before anything is sent, each report has nothing held
+    uint8_t released[HID_REPORT_SIZE];
+    buildKeyboardReport(released, 0x00, 0x00);
+    QCOMPARE(host.reply(transport, QByteArray("\x41\x01", 2)), bytes(released, HID_REPORT_SIZE));
+    QCOMPARE(host.reply(transport, QByteArray("\x41\x02", 2)), QByteArray("\xA1\x02\x00\x00", 4));
+    
+    // Each ID answers with the last report of its own kind
+    buildKeyboardReport(data, LEFT_SHIFT, KEY_A);
+    QVERIFY(transport.sendReport(data, hidReportSize(data)) > 0);
+    const QByteArray keyboard = bytes(data, HID_REPORT_SIZE);
+    buildConsumerReport(data, 0x00CD);
+    QVERIFY(transport.sendReport(data, hidReportSize(data)) > 0);
+    QCOMPARE(host.reply(transport, QByteArray("\x41\x01", 2)), keyboard);
+    QCOMPARE(host.reply(transport, QByteArray("\x41\x02", 2)), QByteArray("\xA1\x02\xCD\x00", 4));
+    
+    // An ID the descriptor does not have, or none at all, is refused
+    QCOMPARE(host.request(transport, QByteArray("\x41\x07", 2)), 0x02);
+    QCOMPARE(host.request(transport, QByteArray("\x41", 1)), 0x02);
+    
+    // Only input reports can be read
+    QCOMPARE(host.request(transport, QByteArray("\x43\x01", 2)), 0x03);
+}
+
+void TransportTests::l2capSetProtocol()
+{
+    L2capHost host;
+    QVERIFY(host.open());
+    L2capTransport transport(host.control[0], host.interrupt[0]);
+    
+    // SET_PROTOCOL: report protocol is accepted, boot protocol refused
+    QCOMPARE(host.request(transport, QByteArray("\x71", 1)), 0x00);
+    QCOMPARE(host.request(transport, QByteArray("\x70", 1)), 0x03);
+    
+    // GET_PROTOCOL answers with report protocol
+    QCOMPARE(host.request(transport, QByteArray("\x60", 1)), 0xA0);
+}
+
+void TransportTests::l2capLedReports()
+{
+    L2capHost host;
+    QVERIFY(host.open());
+    L2capTransport transport(host.control[0], host.interrupt[0]);
+    
+    // SET_REPORT on the control channel is answered with a handshake
+    const char setReport[] = { '\x52', '\x01', '\x02' };
+    QCOMPARE(::send(host.control[1], setReport, sizeof(setReport), 0), ssize_t(sizeof(setReport)));
+    QCOMPARE(transport.handleInput(host.control[0]), HidTransport::InputLedsChanged);
+    QCOMPARE(transport.leds(), 0x02);
+    uint8_t reply = 0xFF;
+    QCOMPARE(::recv(host.control[1], &reply, 1, 0), ssize_t(1));
+    QCOMPARE(reply, uint8_t(0x00));
+    
+    // DATA|OUTPUT on the interrupt channel needs no reply
+    const char output[] = { '\xA2', '\x01', '\x03' };
+    QCOMPARE(::send(host.interrupt[1], output, sizeof(output), 0), ssize_t(sizeof(output)));
+    QCOMPARE(transport.handleInput(host.interrupt[0]), HidTransport::InputLedsChanged);
+    QCOMPARE(transport.leds(), 0x03);
+    
+    // The same state again is not a change
+    QCOMPARE(::send(host.interrupt[1], output, sizeof(output), 0), ssize_t(sizeof(output)));
+    QCOMPARE(transport.handleInput(host.interrupt[0]), HidTransport::InputHandled);
+}
+
+void TransportTests::l2capHangUp()
+{
+    L2capHost host;
+    QVERIFY(host.open());
+    L2capTransport transport(host.control[0], host.interrupt[0]);
+    
+    // Virtual cable unplug means the host dropped us
+    const char unplug = '\x15';
+    QCOMPARE(::send(host.control[1], &unplug, 1, 0), ssize_t(1));
+    QCOMPARE(transport.handleInput(host.control[0]), HidTransport::InputHungUp);
+    
+    // So does a closed channel
+    ::shutdown(host.interrupt[1], SHUT_RDWR);
+    QCOMPARE(transport.handleInput(host.interrupt[0]), HidTransport::InputHungUp);
+}
+
+void TransportTests::hidgReportBytes()
+{
+    int fds[2];
+    QVERIFY(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    HidgTransport transport(fds[0]);
+    
+    // The gadget takes the report from the report ID on, but the writer
+    // is told the whole report went out
+    uint8_t data[HID_REPORT_SIZE];
+    uint8_t received[64];
+    buildKeyboardReport(data, LEFT_SHIFT, KEY_A);
+    QCOMPARE(transport.sendReport(data, hidReportSize(data)), ssize_t(HID_REPORT_SIZE));
+    QCOMPARE(::recv(fds[1], received, sizeof(received), 0), ssize_t(HID_REPORT_SIZE - 1));
+    QCOMPARE(memcmp(received, data + 1, HID_REPORT_SIZE - 1), 0);
+    
+    ::close(fds[1]);
+}
+
+void TransportTests::hidgConsumerReportBytes()
+{
+    int fds[2];
+    QVERIFY(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    HidgTransport transport(fds[0]);
+    
+    uint8_t data[HID_REPORT_SIZE];
+    uint8_t received[64];
+    buildConsumerReport(data, 0x00E2);
+    QCOMPARE(transport.sendReport(data, hidReportSize(data)), ssize_t(HID_CONSUMER_REPORT_SIZE));
+    QCOMPARE(::recv(fds[1], received, sizeof(received), 0), ssize_t(HID_CONSUMER_REPORT_SIZE - 1));
+    QCOMPARE(bytes(received, HID_CONSUMER_REPORT_SIZE - 1), QByteArray("\x02\xE2\x00", 3));
+    
+    ::close(fds[1]);
+}
+
+void TransportTests::hidgLedReport()
+{
+    int fds[2];
+    QVERIFY(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+    HidgTransport transport(fds[0]);
+    
+    // Output reports arrive without a HIDP header
+    const char output[] = { '\x01', '\x02' };
+    QCOMPARE(::send(fds[1], output, sizeof(output), 0), ssize_t(sizeof(output)));
+    QCOMPARE(transport.handleInput(fds[0]), HidTransport::InputLedsChanged);
+    QCOMPARE(transport.leds(), 0x02);
+    
+    ::shutdown(fds[1], SHUT_RDWR);
+    QCOMPARE(transport.handleInput(fds[0]), HidTransport::InputHungUp);
+    ::close(fds[1]);
+}
+
+QTEST_GUILESS_MAIN(TransportTests)
+
+#include "transport_tests.moc"